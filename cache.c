@@ -0,0 +1,416 @@
+/*-------------------------------------------------------------------------
+ *
+ * cache.c
+ *	  columnar binary cache of parsed table
+ *
+ * The parsed table can be saved to binary file, that can be mapped to
+ * memory and rendered without parsing and calculating of widths. The
+ * file has header, array of numbers of fields of rows, array of flags
+ * of multiline rows, and for every column a descriptor with widths of
+ * column and offsets to the array of field offsets, to the arrays of
+ * display widths and numeric flags of fields, and to the zero terminated
+ * values. The widths and flags of fields are attached to loaded rows, so
+ * the rows are printed without calculating of widths of values. All
+ * arrays are aligned to 8 bytes.
+ *
+ * The file is written to temp file by two passes over buckets (sizes
+ * of columns, data), and then it is renamed, so the interrupted saving
+ * doesn't leave broken cache. The loaded file is checked, so all
+ * offsets and values are inside file.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  cache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "spill.h"
+#include "unicode.h"
+
+#define CACHE_MAGIC			"CSVPFC05"
+
+#define ALIGN8(x)			(((x) + 7) & ~((uint64_t) 7))
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	ncolumns;
+	uint32_t	nrows;
+	uint64_t	processed;
+	uint32_t	header;				/* first row is header */
+	uint32_t	pad;
+	uint64_t	nfields_offset;		/* uint32 [nrows] */
+	uint64_t	multilines_offset;	/* uint8 [nrows] */
+	uint64_t	columns_offset;		/* CacheColumnType [ncolumns] */
+} CacheHeaderType;
+
+typedef struct
+{
+	int32_t		width;
+	int32_t		intwidth;
+	int32_t		fracwidth;
+	uint8_t		multiline;
+	uint8_t		type;
+	uint8_t		pad[2];
+	uint64_t	offsets_offset;		/* uint64 [nrows + 1], relative to bytes */
+	uint64_t	widths_offset;		/* int32 [nrows] */
+	uint64_t	numeric_offset;		/* uint8 [nrows] */
+	uint64_t	bytes_offset;
+	uint64_t	bytes_size;
+} CacheColumnType;
+
+/*
+ * Returns field of column or NULL, when row has less fields.
+ */
+static const char *
+get_field(RowType *row, int column)
+{
+	return column < row->nfields ? row->fields[column] : NULL;
+}
+
+void
+save_cache(const char *path, RowBucketType *rowbucket, LinebufType *linebuf)
+{
+	CacheHeaderType *header;
+	CacheColumnType *columns;
+	RowBucketType *rb;
+	char	   *tmppath;
+	char	   *data;
+	uint32_t   *nfields;
+	uint8_t	   *multilines;
+	uint64_t   *sizes;
+	uint64_t	pos;
+	uint64_t	file_size;
+	mode_t		mask;
+	uint32_t	nrows = 0;
+	uint32_t	r;
+	int			ncolumns = linebuf->maxfields;
+	int			fd;
+	int			i;
+
+	sizes = smalloc((ncolumns + 1) * sizeof(uint64_t), "sizes");
+	memset(sizes, 0, (ncolumns + 1) * sizeof(uint64_t));
+
+	/* first pass - sizes of values of columns */
+	for (rb = rowbucket; rb; rb = rb->next_bucket)
+	{
+		int		j;
+
+		bucket_acquire(rb);
+
+		for (j = 0; j < rb->nrows; j++)
+		{
+			RowType    *row = rb->rows[j];
+
+			for (i = 0; i < row->nfields && i < ncolumns; i++)
+				sizes[i] += strlen(row->fields[i]) + 1;
+		}
+
+		nrows += rb->nrows;
+
+		bucket_release(rb);
+	}
+
+	/* calculate layout of file */
+	pos = ALIGN8(sizeof(CacheHeaderType));
+	pos = ALIGN8(pos + nrows * sizeof(uint32_t));
+	pos = ALIGN8(pos + nrows);
+	pos = ALIGN8(pos + ncolumns * sizeof(CacheColumnType));
+
+	for (i = 0; i < ncolumns; i++)
+	{
+		pos = ALIGN8(pos + (nrows + 1) * sizeof(uint64_t));
+		pos = ALIGN8(pos + nrows * sizeof(int32_t));
+		pos = ALIGN8(pos + nrows);
+		pos = ALIGN8(pos + sizes[i]);
+	}
+
+	file_size = pos;
+
+	tmppath = smalloc(strlen(path) + 8, "path");
+	sprintf(tmppath, "%s.XXXXXX", path);
+
+	fd = mkstemp(tmppath);
+	if (fd < 0)
+	{
+		fprintf(stderr, "cannot to create cache file \"%s\": %m\n", tmppath);
+		exit(1);
+	}
+
+	/* the temp file has access rights like new file */
+	mask = umask(0);
+	umask(mask);
+
+	if (fchmod(fd, 0666 & ~mask) != 0 || ftruncate(fd, file_size) != 0 ||
+		(data = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "cannot to write cache file \"%s\": %m\n", tmppath);
+		unlink(tmppath);
+		exit(1);
+	}
+
+	header = (CacheHeaderType *) data;
+	memcpy(header->magic, CACHE_MAGIC, 8);
+	header->ncolumns = ncolumns;
+	header->nrows = nrows;
+	header->processed = linebuf->processed;
+	header->header = linebuf->header;
+
+	pos = ALIGN8(sizeof(CacheHeaderType));
+	header->nfields_offset = pos;
+	pos = ALIGN8(pos + nrows * sizeof(uint32_t));
+	header->multilines_offset = pos;
+	pos = ALIGN8(pos + nrows);
+	header->columns_offset = pos;
+	pos = ALIGN8(pos + ncolumns * sizeof(CacheColumnType));
+
+	nfields = (uint32_t *) (data + header->nfields_offset);
+	multilines = (uint8_t *) (data + header->multilines_offset);
+	columns = (CacheColumnType *) (data + header->columns_offset);
+
+	for (i = 0; i < ncolumns; i++)
+	{
+		CacheColumnType *col = &columns[i];
+
+		col->width = linebuf->widths[i];
+		col->intwidth = linebuf->intwidths[i];
+		col->fracwidth = linebuf->fracwidths[i];
+		col->multiline = linebuf->multilines[i];
+		col->type = linebuf->column_types[i];
+
+		col->offsets_offset = pos;
+		pos = ALIGN8(pos + (nrows + 1) * sizeof(uint64_t));
+		col->widths_offset = pos;
+		pos = ALIGN8(pos + nrows * sizeof(int32_t));
+		col->numeric_offset = pos;
+		pos = ALIGN8(pos + nrows);
+		col->bytes_offset = pos;
+		col->bytes_size = sizes[i];
+		pos = ALIGN8(pos + sizes[i]);
+
+		/* the sizes are used as current offsets of values */
+		sizes[i] = 0;
+	}
+
+	/* second pass - all arrays are filled together */
+	r = 0;
+	for (rb = rowbucket; rb; rb = rb->next_bucket)
+	{
+		int		j;
+
+		bucket_acquire(rb);
+
+		for (j = 0; j < rb->nrows; j++, r++)
+		{
+			RowType    *row = rb->rows[j];
+
+			nfields[r] = row->nfields;
+			multilines[r] = rb->multilines[j];
+
+			for (i = 0; i < ncolumns; i++)
+			{
+				uint64_t   *offsets = (uint64_t *) (data + columns[i].offsets_offset);
+				int32_t	   *widths = (int32_t *) (data + columns[i].widths_offset);
+				uint8_t	   *numeric = (uint8_t *) (data + columns[i].numeric_offset);
+				const char *field = get_field(row, i);
+
+				offsets[r] = sizes[i];
+				widths[r] = 0;
+				numeric[r] = 0;
+
+				if (field)
+				{
+					size_t		size = strlen(field) + 1;
+					int			type = classify_field(field);
+
+					memcpy(data + columns[i].bytes_offset + sizes[i], field, size);
+					sizes[i] += size;
+
+					/* empty values are in numeric columns too */
+					widths[r] = utf_string_dsplen(field, -1);
+					numeric[r] = FIELD_TYPE_IS_NUMERIC(type) || type == FIELD_TYPE_EMPTY;
+				}
+			}
+		}
+
+		bucket_release(rb);
+	}
+
+	for (i = 0; i < ncolumns; i++)
+		((uint64_t *) (data + columns[i].offsets_offset))[nrows] = sizes[i];
+
+	if (munmap(data, file_size) != 0 || fsync(fd) != 0 || close(fd) != 0 ||
+		rename(tmppath, path) != 0)
+	{
+		fprintf(stderr, "cannot to write cache file \"%s\": %m\n", path);
+		unlink(tmppath);
+		exit(1);
+	}
+
+	free(tmppath);
+	free(sizes);
+}
+
+/*
+ * Returns true, when array of count items of size is inside file,
+ * and it is aligned.
+ */
+static bool
+is_valid_array(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size)
+{
+	return offset % 8 == 0 && offset <= file_size &&
+		   count <= (file_size - offset) / size;
+}
+
+static void
+broken_cache(const char *path)
+{
+	fprintf(stderr, "cache file \"%s\" is broken\n", path);
+	exit(1);
+}
+
+/*
+ * Maps cache file to memory, and creates rows, that points to
+ * mapped values.
+ */
+void
+load_cache(const char *path, RowBucketType *rowbucket, LinebufType *linebuf)
+{
+	CacheHeaderType *header;
+	CacheColumnType *columns;
+	RowBucketType *current = rowbucket;
+	struct stat st;
+	const char *data;
+	const uint32_t *nfields;
+	const uint8_t *multilines;
+	uint64_t	size;
+	uint32_t	r;
+	int			fd;
+	int			i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "cannot to open cache file \"%s\": %m\n", path);
+		exit(1);
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(CacheHeaderType))
+		broken_cache(path);
+
+	size = st.st_size;
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "cannot to map cache file \"%s\": %m\n", path);
+		exit(1);
+	}
+
+	close(fd);
+
+	header = (CacheHeaderType *) data;
+	if (memcmp(header->magic, CACHE_MAGIC, 8) != 0 || header->ncolumns > 1024)
+	{
+		fprintf(stderr, "file \"%s\" is not cache file\n", path);
+		exit(1);
+	}
+
+	if (!is_valid_array(header->nfields_offset, header->nrows, sizeof(uint32_t), size) ||
+		!is_valid_array(header->multilines_offset, header->nrows, 1, size) ||
+		!is_valid_array(header->columns_offset, header->ncolumns, sizeof(CacheColumnType), size))
+		broken_cache(path);
+
+	nfields = (const uint32_t *) (data + header->nfields_offset);
+	multilines = (const uint8_t *) (data + header->multilines_offset);
+	columns = (CacheColumnType *) (data + header->columns_offset);
+
+	for (i = 0; i < (int) header->ncolumns; i++)
+	{
+		const uint64_t *offsets = (const uint64_t *) (data + columns[i].offsets_offset);
+
+		if (!is_valid_array(columns[i].offsets_offset, (uint64_t) header->nrows + 1,
+							sizeof(uint64_t), size) ||
+			!is_valid_array(columns[i].widths_offset, header->nrows, sizeof(int32_t), size) ||
+			!is_valid_array(columns[i].numeric_offset, header->nrows, 1, size) ||
+			columns[i].bytes_offset > size ||
+			columns[i].bytes_size > size - columns[i].bytes_offset ||
+			offsets[header->nrows] > columns[i].bytes_size)
+			broken_cache(path);
+
+		/* the width of column is limited by size of its values */
+		if (columns[i].width < 0 || (uint64_t) columns[i].width > 2 * columns[i].bytes_size ||
+			columns[i].intwidth < 0 || columns[i].intwidth > columns[i].width ||
+			columns[i].fracwidth < 0 || columns[i].fracwidth > columns[i].width)
+			broken_cache(path);
+
+		linebuf->widths[i] = columns[i].width;
+		linebuf->intwidths[i] = columns[i].intwidth;
+		linebuf->fracwidths[i] = columns[i].fracwidth;
+		linebuf->multilines[i] = columns[i].multiline;
+		linebuf->column_types[i] = columns[i].type < FIELD_TYPE_COUNT ? columns[i].type : FIELD_TYPE_TEXT;
+	}
+
+	linebuf->maxfields = header->ncolumns;
+	linebuf->processed = header->processed;
+	linebuf->header = header->header;
+
+	for (r = 0; r < header->nrows; r++)
+	{
+		RowType	   *row;
+
+		if (nfields[r] > header->ncolumns)
+			broken_cache(path);
+
+		if (current->nrows >= 1000)
+			current = add_rowbucket(current);
+
+		/* the widths and flags of fields are stored together with row */
+		row = smalloc(offsetof(RowType, fields) +
+					  nfields[r] * (sizeof(char*) + sizeof(int) + sizeof(bool)), "RowType");
+		row->nfields = nfields[r];
+		row->lines = NULL;
+		row->widths = (int *) &row->fields[row->nfields];
+		row->numeric = (bool *) &row->widths[row->nfields];
+
+		for (i = 0; i < row->nfields; i++)
+		{
+			const uint64_t *offsets = (const uint64_t *) (data + columns[i].offsets_offset);
+			const int32_t *widths = (const int32_t *) (data + columns[i].widths_offset);
+			const uint8_t *numeric = (const uint8_t *) (data + columns[i].numeric_offset);
+			const char *bytes = data + columns[i].bytes_offset;
+
+			/* the value should be zero terminated inside values of column */
+			if (offsets[r] >= offsets[r + 1] || offsets[r + 1] > offsets[header->nrows] ||
+				bytes[offsets[r + 1] - 1] != '\0')
+				broken_cache(path);
+
+			/*
+			 * The width is limited by size of value like width of column.
+			 * The control chars have width -1, so it can be negative.
+			 */
+			if (widths[r] < -(int64_t) (offsets[r + 1] - offsets[r]) ||
+				widths[r] > 2 * (int64_t) (offsets[r + 1] - offsets[r]))
+				broken_cache(path);
+
+			row->fields[i] = (char *) bytes + offsets[r];
+			row->widths[i] = widths[r];
+			row->numeric[i] = numeric[r] != 0;
+		}
+
+		current->multilines[current->nrows] = multilines[r] != 0;
+		current->rows[current->nrows++] = row;
+	}
+}
@@ -0,0 +1,22 @@
+/*-------------------------------------------------------------------------
+ *
+ * cache.h
+ *	  columnar binary cache of parsed table
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  cache.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_CACHE_H
+#define CSV_PRETTY_CACHE_H
+
+#include "csv-pretty-format.h"
+
+extern void save_cache(const char *path, RowBucketType *rowbucket, LinebufType *linebuf);
+extern void load_cache(const char *path, RowBucketType *rowbucket, LinebufType *linebuf);
+
+#endif
@@ -4,656 +4,3424 @@
 #include <string.h>
 #include <locale.h>
 #include <ctype.h>
-
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "daemon.h"
+#include "csv-pretty-format.h"
+#include "decompress.h"
+#include "describe.h"
+#include "dictionary.h"
+#include "diff.h"
+#include "encoding.h"
+#include "expanded.h"
+#include "follow.h"
+#include "input.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "shape.h"
+#include "sort.h"
+#include "spill.h"
 #include "unicode.h"
+#include "validate.h"
 
-#ifndef offsetof
-#define offsetof(type, field)	((long) &((type *)0)->field)
-#endif							/* offsetof */
-
+/*
+ * State of one thread of deferred widths calculation. The thread
+ * processes every nthreads-th bucket, and holds own widths, that
+ * are merged when all threads are finished.
+ */
+typedef struct
+{
+	pthread_t	thread;
+	RowBucketType **buckets;
+	int			nbuckets;
+	int			first_bucket;
+	int			step;
+	DictionaryType *dictionaries;	/* dictionaries of columns or NULL */
+	LinebufType	stats;
+} WidthsWorkerType;
 
+/*
+ * One input file of multi-file mode. The table is rendered to output
+ * buffer, or in union mode the rows with source column are stored to
+ * own chain of buckets.
+ */
 typedef struct
 {
-	int		nfields;
-	char   *fields[];
-} RowType;
+	char	   *path;
+	char	   *output;
+	size_t		output_size;
+	int			error;			/* errno of opening file or 0 */
+	ConfigType *config;
+	RowBucketType *rowbucket;
+	RowBucketType *current;
+	LinebufType *linebuf;
+} InputFileType;
 
-typedef struct _rowBucketType
+typedef struct
 {
-	int			nrows;
-	RowType	   *rows[1000];
-	bool		multilines[1000];
-	bool		allocated;
-	struct _rowBucketType *next_bucket;
-} RowBucketType;
+	InputFileType *files;
+	ConfigType *config;
+	bool		unified;
+	int			first_column;	/* measured columns of separate tables */
+	int			end_column;
+} MultiFileType;
 
+/*
+ * Table of changed rows of diff mode.
+ */
 typedef struct
 {
-	char	   *buffer;
-	int			processed;
-	int			used;
-	int			size;
-	int			nfields;
-	int			maxfields;
-	int			starts[1024];		/* start of first char of column (in bytes) */
-	int			sizes[1024];		/* lenght of chars of column (in bytes) */
-	int			widths[1024];		/* display width of column */
-	char		multilines[1024];		/* true, when column has some multiline chars */
-} LinebufType;
+	RowBucketType *rowbucket;
+	RowBucketType *current;
+	LinebufType *linebuf;
+} DiffResultType;
 
+/*
+ * State of follow mode. The rows are printed immediately, and the
+ * rule line is printed, when the widths of columns are changed. The
+ * first row is held until the second row is parsed, so the header
+ * can be detected.
+ */
 typedef struct
 {
-	int			border;
-	char		linestyle;
-	char		separator;
-} ConfigType;
+	FILE	   *ofile;
+	LinebufType *linebuf;
+	ConfigType *config;
+	int			widths[1024];	/* widths used for last printed row */
+	int			maxfields;
+	long		nrows;			/* printed rows without header */
+	bool		started;		/* the first row was printed */
+	RowType	   *first_row;		/* held first row or NULL */
+	bool		first_multiline;
+} FollowType;
 
-static void *
-smalloc(int size, char *debugstr)
+/*
+ * Appends new empty bucket after current bucket.
+ */
+RowBucketType *
+add_rowbucket(RowBucketType *current)
 {
-	char *result;
+	RowBucketType *new = smalloc(sizeof(RowBucketType), "RowBucketType");
 
-	result = malloc(size);
-	if (!result)
-		exit(1);
+	new->nrows = 0;
+	new->allocated = true;
+	new->memory = 0;
+	new->spill_file = NULL;
+	new->compressed = false;
+	new->data = NULL;
+	new->next_bucket = NULL;
 
-	return result;
+	current->next_bucket = new;
+
+	return new;
 }
 
-static void
-print_vertical_header(FILE *ofile, LinebufType *linebuf, ConfigType *config, char pos)
+/*
+ * Appends row to last bucket. When the bucket is full, then new bucket
+ * is created, and full buckets can be compressed or moved to spill file
+ * (except first). Returns last bucket.
+ */
+RowBucketType *
+store_row(RowBucketType *current, RowBucketType *rowbucket, LinebufType *linebuf,
+		  ConfigType *config, RowType *row, bool multiline, long row_size)
 {
-	int		i;
-	int		border = config->border;
-
-	if (config->linestyle == 'a')
+	if (current->nrows >= 1000)
 	{
-		if ((border == 0 || border == 1) && (pos != 'm'))
-			return;
+		RowBucketType *full = current;
 
-		if (border == 2)
-			fprintf(ofile, "+-");
-		else if (border == 1)
-			fprintf(ofile, "-");
+		current = add_rowbucket(current);
 
-		for (i = 0; i < linebuf->maxfields; i++)
+		/*
+		 * The widths of rows of full bucket are known already, so
+		 * the rows can be compressed.
+		 */
+		if (config->compress && full != rowbucket)
 		{
-			int		j;
+			linebuf->row_memory -= full->memory;
+			compress_bucket(full);
+			linebuf->row_memory += full->memory;
+		}
+
+		/*
+		 * When rows needs more memory than is allowed, then the
+		 * full buckets are moved to spill file.
+		 */
+		if (config->memory_limit > 0 && linebuf->row_memory > config->memory_limit)
+		{
+			RowBucketType *rb;
 
-			if (i > 0)
+			for (rb = rowbucket->next_bucket; rb != current; rb = rb->next_bucket)
 			{
-				if (border == 0)
-					fprintf(ofile, " ");
-				else
-					fprintf(ofile, "-+-");
+				if (!rb->spill_file)
+				{
+					spill_bucket(rb, &linebuf->spill_file);
+					linebuf->row_memory -= rb->memory;
+				}
 			}
-
-			for (j = 0; j < linebuf->widths[i]; j++)
-				fprintf(ofile, "-");
 		}
+	}
 
-		if (border == 2)
-			fprintf(ofile, "-+");
-		else if (border == 1)
-			fprintf(ofile, "-");
-		else if (border == 0 && linebuf->multilines[linebuf->maxfields - 1])
-			fputc(' ', ofile);
+	current->memory += row_size;
+	linebuf->row_memory += row_size;
 
-		fprintf(ofile, "\n");
-	}
-	else if (config->linestyle == 'u')
-	{
-		if ((border == 0 || border == 1) && (pos != 'm'))
-			return;
+	current->multilines[current->nrows] = multiline;
+	current->rows[current->nrows++] = row;
 
-		if (border == 2)
-		{
-			if (pos == 't')
-				fprintf(ofile, "\342\224\214");
-			else if (pos == 'm')
-				fprintf(ofile, "\342\224\234");
-			else
-				fprintf(ofile, "\342\224\224");
+	return current;
+}
 
-			fprintf(ofile, "\342\224\200");
-		}
-		else if (border == 1)
-			fprintf(ofile, "\342\224\200");
+__thread jmp_buf *error_context = NULL;
 
-		for (i = 0; i < linebuf->maxfields; i++)
-		{
-			int		j;
+/*
+ * Ends processing after reported error. When the current thread has
+ * error context, then it jumps there, else the process exits.
+ */
+void
+fatal_error(void)
+{
+	if (error_context)
+		longjmp(*error_context, 1);
 
-			if (i > 0)
-			{
-				if (border == 0)
-					fprintf(ofile, " ");
-				else
-				{
-					fprintf(ofile, "\342\224\200");
-					if (pos == 't')
-						fprintf(ofile, "\342\224\254");
-					else if (pos == 'm')
-						fprintf(ofile, "\342\224\274");
-					else
-						fprintf(ofile, "\342\224\264");
+	exit(1);
+}
 
-					fprintf(ofile, "\342\224\200");
-				}
-			}
+void *
+smalloc(int size, char *debugstr)
+{
+	char *result;
 
-			for (j = 0; j < linebuf->widths[i]; j++)
-				fprintf(ofile, "\342\224\200");
-		}
+	result = malloc(size);
+	if (!result)
+		fatal_error();
 
-		if (border == 2)
+	return result;
+}
+
+/* size of "... (N bytes)" suffix of truncated field */
+#define SKIPPED_MARK_SIZE		32
+
+/*
+ * Classes of chars used by classify_field. The chars of text have
+ * CC_TEXT class, so the content of field can be described by bitmap
+ * of classes of chars without any branches.
+ */
+#define CC_DIGIT		0x01
+#define CC_SIGN			0x02
+#define CC_DOT			0x04
+#define CC_EXP			0x08
+#define CC_DATESEP		0x10
+#define CC_SPACE		0x20
+#define CC_TEXT			0x40
+
+static const unsigned char char_classes[256] = {
+	[0 ... 255] = CC_TEXT,
+	['0' ... '9'] = CC_DIGIT,
+	['+'] = CC_SIGN,
+	['-'] = CC_SIGN | CC_DATESEP,
+	['.'] = CC_DOT | CC_DATESEP,
+	['e'] = CC_EXP,
+	['E'] = CC_EXP,
+	['/'] = CC_DATESEP,
+	[':'] = CC_DATESEP,
+	['T'] = CC_DATESEP,
+	[' '] = CC_SPACE
+};
+
+static bool
+is_number(const unsigned char *ptr, const unsigned char *end, bool *isint)
+{
+	bool	digits = false;
+
+	*isint = true;
+
+	if (*ptr == '+' || *ptr == '-')
+		ptr++;
+
+	while (ptr < end && isdigit(*ptr))
+	{
+		ptr++;
+		digits = true;
+	}
+
+	if (ptr < end && *ptr == '.')
+	{
+		*isint = false;
+		ptr++;
+
+		while (ptr < end && isdigit(*ptr))
 		{
-			fprintf(ofile, "\342\224\200");
-			if (pos == 't')
-				fprintf(ofile, "\342\224\220");
-			else if (pos == 'm')
-				fprintf(ofile, "\342\224\244");
-			else
-				fprintf(ofile, "\342\224\230");
+			ptr++;
+			digits = true;
 		}
-		else if (border == 1)
-			fprintf(ofile, "\342\224\200");
+	}
 
-		fprintf(ofile, "\n");
+	if (digits && ptr < end && (*ptr == 'e' || *ptr == 'E'))
+	{
+		*isint = false;
+		ptr++;
+
+		if (ptr < end && (*ptr == '+' || *ptr == '-'))
+			ptr++;
+
+		if (ptr == end)
+			return false;
+
+		while (ptr < end && isdigit(*ptr))
+			ptr++;
 	}
+
+	return digits && ptr == end;
 }
 
 /*
- * Header detection - simple heuristic, when first row has all text fields
- * and second rows has any numeric field, then csv has header.
+ * Date is detected by format YYYY-MM-DD, YYYY/MM/DD, DD.MM.YYYY or
+ * DD/MM/YYYY, that can be followed by time.
  */
 static bool
-is_header(RowBucketType *rb)
+is_date(const unsigned char *ptr, const unsigned char *end)
 {
-	RowType	   *row;
-	int		i;
+#define D(i)	isdigit(ptr[i])
 
-	if (rb->nrows < 2)
+	if (end - ptr < 10)
 		return false;
 
-	row = rb->rows[0];
+	if (!((D(0) && D(1) && D(2) && D(3) &&
+		   (ptr[4] == '-' || ptr[4] == '/') && D(5) && D(6) &&
+		   ptr[7] == ptr[4] && D(8) && D(9)) ||
+		  (D(0) && D(1) && (ptr[2] == '.' || ptr[2] == '/') &&
+		   D(3) && D(4) && ptr[5] == ptr[2] &&
+		   D(6) && D(7) && D(8) && D(9))))
+		return false;
 
-	for (i = 0; i < row->nfields; i++)
-	{
-		if (row->fields[i][0] == '\0')
-			return false;
-		if (isdigit((row->fields[i])[0]))
-			return false;
-	}
+#undef D
 
-	row = rb->rows[1];
+	return end - ptr == 10 || ptr[10] == ' ' || ptr[10] == 'T';
+}
 
-	for (i = 0; i < row->nfields; i++)
+static bool
+is_bool(const unsigned char *ptr, const unsigned char *end)
+{
+	static const char *names[] = {"true", "false", "t", "f", "yes", "no", NULL};
+	const char **name;
+
+	for (name = names; *name; name++)
 	{
-		if (row->fields[i][0] == '\0')
-			return true;
-		if (isdigit((row->fields[i])[0]))
+		size_t	len = strlen(*name);
+
+		if ((size_t) (end - ptr) == len && strncasecmp((const char *) ptr, *name, len) == 0)
 			return true;
 	}
 
 	return false;
 }
 
-static char *
-fput_line(char *str, bool multiline, FILE *ofile)
+/*
+ * Returns type of field. The leading and trailing spaces are ignored.
+ */
+int
+classify_field(const char *str)
 {
-	char   *nextline = NULL;
+	const unsigned char *ptr = (const unsigned char *) str;
+	const unsigned char *end;
+	const unsigned char *p;
+	unsigned char	mask = 0;
+	bool	isint;
 
-	if (multiline)
-	{
-		char   *ptr = str;
-		int		size = 0;
-		int		chrl;
+	while (*ptr == ' ')
+		ptr++;
 
-		while (*ptr)
-		{
-			if (*ptr == '\n')
-			{
-				nextline = ptr + 1;
-				break;
-			}
+	if (*ptr == '\0')
+		return FIELD_TYPE_EMPTY;
 
-			chrl = utf8charlen(*ptr);
-			size += chrl;
-			ptr += chrl;
-		}
+	end = ptr + strlen((const char *) ptr);
+	while (end[-1] == ' ')
+		end--;
 
-		fwrite(str, 1, size, ofile);
-	}
-	else
-		fputs(str, ofile);
+	for (p = ptr; p < end; p++)
+		mask |= char_classes[*p];
 
-	return nextline;
+	if ((mask & ~(CC_DIGIT | CC_SIGN | CC_DOT | CC_EXP | CC_DATESEP)) == 0 &&
+		(mask & CC_DIGIT) &&
+		is_number(ptr, end, &isint))
+		return isint ? FIELD_TYPE_INT : FIELD_TYPE_FLOAT;
+
+	if ((mask & (CC_DIGIT | CC_DATESEP)) == (CC_DIGIT | CC_DATESEP) && is_date(ptr, end))
+		return FIELD_TYPE_DATE;
+
+	if ((mask & CC_TEXT) && end - ptr <= 5 && is_bool(ptr, end))
+		return FIELD_TYPE_BOOL;
+
+	return FIELD_TYPE_TEXT;
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * Creates index of lines of multiline field.
+ */
+static FieldLinesType *
+index_field_lines(const char *field, int *maxwidth)
 {
-	FILE   *ifile = stdin;
-	FILE   *ofile = stdout;
+	FieldLinesType *result;
+	const char *ptr;
+	int		nlines = 1;
+	int		i;
 
-	LinebufType	linebuf;
-	RowBucketType	rowbucket, *current;
-	ConfigType		config;
+	for (ptr = strchr(field, '\n'); ptr; ptr = strchr(ptr + 1, '\n'))
+		nlines += 1;
 
-	bool	skip_initial;
-	bool	closed = false;
-	bool	printed_headline = false;
-	int		c;
-	int		first_nw = 0;
-	int		last_nw = 0;
-	int		pos = 0;
-	int		printed_rows = 0;
-	int		instr = false;
+	result = smalloc(offsetof(FieldLinesType, lines) + nlines * sizeof(FieldLineType), "FieldLinesType");
+	result->nlines = nlines;
+	result->shared = false;
 
-	bool	last_multiline_column;
-	int		last_column;
+	*maxwidth = 0;
 
-	setlocale(LC_ALL, "");
+	for (i = 0, ptr = field; i < nlines; i++)
+	{
+		const char *end = strchr(ptr, '\n');
+		FieldLineType *line = &result->lines[i];
 
-	memset(&linebuf, 0, sizeof(linebuf));
+		if (!end)
+			end = ptr + strlen(ptr);
 
-	linebuf.buffer = malloc(1024);
-	linebuf.used = 0;
-	linebuf.size = 1024;
-	linebuf.nfields = 0;
+		line->offset = ptr - field;
+		line->size = end - ptr;
+		line->width = line->size > 0 ? utf_string_dsplen(ptr, line->size) : 0;
 
-	/* for debug purposes */
-	memset(linebuf.buffer, 0, 1024);
+		if (line->width > *maxwidth)
+			*maxwidth = line->width;
 
-	config.separator = -1;
-	config.linestyle = 'a';
-	config.border = 0;
+		ptr = end + 1;
+	}
+
+	return result;
+}
 
-	rowbucket.nrows = 0;
-	rowbucket.allocated = false;
-	rowbucket.next_bucket = NULL;
+/*
+ * Calculates properties of field. When the field is multiline, then
+ * the index of its lines is created.
+ */
+static void
+describe_field(const char *field, FieldInfoType *info)
+{
+	info->multiline = strchr(field, '\n') != NULL;
 
-	current = &rowbucket;
+	if (info->multiline)
+		info->lines = index_field_lines(field, &info->width);
+	else
+	{
+		info->lines = NULL;
+		info->width = utf_string_dsplen(field, -1);
+	}
 
-	skip_initial = true;
+	info->type = classify_field(field);
+	info->intwidth = 0;
+	info->fracwidth = 0;
 
-	c = fgetc(ifile);
-	do
+	if (FIELD_TYPE_IS_NUMERIC(info->type))
 	{
-		if (c != EOF && (c != '\n' || instr))
-		{
-			int		l;
+		const char *dot = strchr(field, '.');
+		int		size = strlen(field);
 
-			if (skip_initial)
-			{
-				if (c == ' ')
-					goto next_char;
+		info->fracwidth = dot ? size - (dot - field) : 0;
+		info->intwidth = size - info->fracwidth;
+	}
+}
 
-				skip_initial = false;
-				last_nw = first_nw;
-			}
+static void
+set_field_lines(RowType *row, int i, FieldLinesType *lines)
+{
+	if (!row->lines)
+	{
+		row->lines = smalloc(row->nfields * sizeof(FieldLinesType *), "FieldLinesType");
+		memset(row->lines, 0, row->nfields * sizeof(FieldLinesType *));
+	}
 
-			if (linebuf.used >= linebuf.size)
-			{
-				linebuf.size += linebuf.size < (10 * 1024) ? linebuf.size  : (10 * 1024);
-				linebuf.buffer = realloc(linebuf.buffer, linebuf.size);
+	/* the row can be measured again */
+	if (row->lines[i] && row->lines[i] != lines && !row->lines[i]->shared)
+		free(row->lines[i]);
 
-				/* for debug purposes */
-				memset(linebuf.buffer + linebuf.used, 0, linebuf.size - linebuf.used);
-			}
+	row->lines[i] = lines;
+}
 
-			if (c == '"')
-			{
-				if (instr)
-				{
-					int     c2 = fgetc(ifile);
+/*
+ * Creates index of lines of field, where the lines wider than maxwidth
+ * are wrapped. Every line has at least one char.
+ */
+static FieldLinesType *
+wrap_field_lines(const char *field, int maxwidth)
+{
+	FieldLinesType *result;
+	const char *ptr;
+	int		nlines = 0;
+	int		i;
 
-					if (c2 == '"')
-					{
-						/* double double quotes */
-						linebuf.buffer[linebuf.used++] = c;
-						pos = pos + 1;
-					}
-					else
-					{
-						/* start of end of string */
-						ungetc(c2, ifile);
-						instr = false;
-					}
-				}
-				else
-					instr = true;
-			}
-			else
+	for (i = 0; i < 2; i++)
+	{
+		if (i == 1)
+		{
+			result = smalloc(offsetof(FieldLinesType, lines) + nlines * sizeof(FieldLineType), "FieldLinesType");
+			result->nlines = nlines;
+			result->shared = false;
+			nlines = 0;
+		}
+
+		ptr = field;
+
+		for (;;)
+		{
+			int		width;
+			int		size = utf_string_prefix(ptr, -1, maxwidth, &width);
+
+			/* too wide char is not divided */
+			if (size == 0 && *ptr != '\0' && *ptr != '\n')
 			{
-				linebuf.buffer[linebuf.used++] = c;
-				pos = pos + 1;
+				size = utf8charlen(*ptr);
+				width = utf_dsplen(ptr);
 			}
 
-			if (config.separator == -1 && !instr)
+			if (i == 1)
 			{
-				/*
-				 * Automatic separator detection - now it is very simple, first win.
-				 * Can be enhanced in future by more sofisticated mechanism.
-				 */
-				if (c == ',')
-					config.separator = ',';
-				else if (c == ';')
-					config.separator = ';';
-				else if (c == '|')
-					config.separator = '|';
+				result->lines[nlines].offset = ptr - field;
+				result->lines[nlines].size = size;
+				result->lines[nlines].width = width;
 			}
 
-			if (config.separator != -1 && c == config.separator && !instr)
-			{
-				if (!skip_initial)
-				{
-					linebuf.sizes[linebuf.nfields] = last_nw - first_nw;
-					linebuf.starts[linebuf.nfields++] = first_nw;
-				}
-				else
-				{
-					linebuf.sizes[linebuf.nfields] = 0;
-					linebuf.starts[linebuf.nfields++] = -1;
-				}
+			nlines += 1;
+			ptr += size;
 
-				skip_initial = true;
-				first_nw = pos;
-			}
-			else if (instr || c != ' ')
-			{
-				last_nw = pos;
-			}
+			if (*ptr == '\0')
+				break;
+			else if (*ptr == '\n')
+				ptr += 1;
+		}
+	}
 
-			l = utf8charlen(c);
-			if (l > 1)
-			{
-				int		i;
+	return result;
+}
 
-				/* read othe chars */
-				for (i = 1; i < l; i++)
-				{
-					c = fgetc(ifile);
-					if (c == EOF)
-					{
-						fprintf(stderr, "unexpected quit, broken unicode char\n");
-						break;
-					}
+/*
+ * Wraps fields of limited columns, that are wider than column. Returns
+ * true, when some field of row has more lines.
+ */
+static bool
+wrap_row_lines(RowType *row, bool multiline, LinebufType *linebuf)
+{
+	int		nfields = row->nfields < linebuf->end_column ? row->nfields : linebuf->end_column;
+	int		i;
 
-					linebuf.buffer[linebuf.used++] = c;
-					pos = pos + 1;
+	for (i = linebuf->first_column; i < nfields; i++)
+	{
+		FieldLinesType *lines = multiline && row->lines ? row->lines[i] : NULL;
+		bool	wrap = false;
+
+		if (!linebuf->limited[i])
+			continue;
+
+		if (lines)
+		{
+			int		j;
+
+			for (j = 0; j < lines->nlines; j++)
+			{
+				if (lines->lines[j].width > linebuf->widths[i])
+				{
+					wrap = true;
+					break;
 				}
-				last_nw = pos;
 			}
 		}
 		else
+			wrap = utf_string_dsplen(row->fields[i], -1) > linebuf->widths[i];
+
+		if (wrap)
 		{
-			char	   *locbuf;
-			RowType	   *row;
-			int			i;
-			int			data_size;
-			bool		multiline;
+			set_field_lines(row, i, wrap_field_lines(row->fields[i], linebuf->widths[i]));
+			multiline = true;
+		}
+	}
 
-			if (!skip_initial)
-			{
-				linebuf.sizes[linebuf.nfields] = last_nw - first_nw;
-				linebuf.starts[linebuf.nfields++] = first_nw;
-			}
-			else
-			{
-				linebuf.sizes[linebuf.nfields] = 0;
-				linebuf.starts[linebuf.nfields++] = -1;
-			}
+	return multiline;
+}
 
-			/* move row from linebuf to rowbucket */
-			if (current->nrows >= 1000)
-			{
-				RowBucketType *new = smalloc(sizeof(RowBucketType), "RowBucketType");
+/*
+ * Creates indexes of lines of multiline fields of row, that has not
+ * indexes (loaded from cache).
+ */
+static void
+index_row_lines(RowType *row)
+{
+	int		i;
 
-				new->nrows = 0;
-				new->allocated = true;
-				new->next_bucket = NULL;
+	for (i = 0; i < row->nfields; i++)
+	{
+		if (strchr(row->fields[i], '\n'))
+		{
+			int		width;
 
-				current->next_bucket = new;
-				current = new;
-			}
+			set_field_lines(row, i, index_field_lines(row->fields[i], &width));
+		}
+	}
+}
 
-			if (!linebuf.used)
-				goto next_row;
+/*
+ * Returns bucket of histogram of widths for width.
+ */
+static int
+width_bucket(int width)
+{
+	int		bits;
 
-			data_size = 0;
-			for (i = 0; i < linebuf.nfields; i++)
-				data_size += linebuf.sizes[i] + 1;
+	if (width < 32)
+		return width;
 
-			locbuf = smalloc(data_size, "locbuf");
-			memset(locbuf, 0, data_size);
+	bits = 32 - __builtin_clz(width);
 
-			row = smalloc(offsetof(RowType, fields) + (linebuf.nfields * sizeof(char*)), "RowType");
-			row->nfields = linebuf.nfields;
+	return 32 + (bits - 6) * 4 + ((width >> (bits - 3)) & 3);
+}
 
-			multiline = false;
+/*
+ * Returns the biggest width of bucket of histogram of widths.
+ */
+static int
+width_bucket_upper(int bucket)
+{
+	int		shift;
 
-			for (i = 0; i < linebuf.nfields; i++)
-			{
-				int		width;
-				bool	_multiline;
+	if (bucket < 32)
+		return bucket;
 
-				row->fields[i] = locbuf;
+	shift = (bucket - 32) / 4 + 3;
 
-				if (linebuf.sizes[i] > 0)
-					memcpy(locbuf, linebuf.buffer + linebuf.starts[i], linebuf.sizes[i]);
+	return ((4 + (bucket - 32) % 4) << shift) + (1 << shift) - 1;
+}
 
-				locbuf[linebuf.sizes[i]] = '\0';
-				locbuf += linebuf.sizes[i] + 1;
+/*
+ * Updates widths, multilines and types of columns by fields of row.
+ * The properties of interned fields are passed in infos, other fields
+ * are described now. Returns true, when some field of row is multiline.
+ */
+static bool
+measure_row(RowType *row, LinebufType *linebuf, bool first_row, FieldInfoType **infos)
+{
+	bool	multiline = false;
+	int		i;
 
-				width = utf_string_dsplen_multiline(row->fields[i], linebuf.sizes[i], &_multiline, false);
-				if (width > linebuf.widths[i])
-					linebuf.widths[i] = width;
+	/* the fields out of viewport are not measured */
+	for (i = linebuf->first_column; i < row->nfields && i < linebuf->end_column; i++)
+	{
+		FieldInfoType	_info;
+		FieldInfoType  *info;
 
-				multiline |= _multiline;
-				linebuf.multilines[i] |= _multiline;
-			}
+		if (infos && infos[i])
+			info = infos[i];
+		else
+		{
+			describe_field(row->fields[i], &_info);
+			info = &_info;
+		}
 
-			if (linebuf.nfields > linebuf.maxfields)
-				linebuf.maxfields = linebuf.nfields;
+		if (info->lines)
+			set_field_lines(row, i, info->lines);
 
-			current->multilines[current->nrows] = multiline;
-			current->rows[current->nrows++] = row;
+		if (info->width > linebuf->widths[i])
+			linebuf->widths[i] = info->width;
 
-next_row:
+		multiline |= info->multiline;
+		linebuf->multilines[i] |= info->multiline;
 
-			linebuf.used = 0;
-			linebuf.nfields = 0;
+		if (info->intwidth > linebuf->intwidths[i])
+			linebuf->intwidths[i] = info->intwidth;
+		if (info->fracwidth > linebuf->fracwidths[i])
+			linebuf->fracwidths[i] = info->fracwidth;
 
-			linebuf.processed += 1;
+		if (first_row)
+		{
+			linebuf->first_types[i] = info->type;
+			linebuf->first_widths[i] = info->width;
+		}
+		else
+		{
+			linebuf->types[i][(int) info->type] += 1;
+			if (linebuf->width_histograms)
+				linebuf->width_histograms[i][width_bucket(info->width)] += 1;
+		}
+	}
 
-			skip_initial = true;
-			first_nw = 0;
-			last_nw = 0;
-			pos = 0;
+	return multiline;
+}
 
-			closed = c == EOF;
-		}
+/*
+ * Returns the most specific type, that covers all counted types.
+ */
+static int
+column_type(int *counts)
+{
+	int		result = FIELD_TYPE_EMPTY;
+	int		i;
 
-next_char:
+	for (i = FIELD_TYPE_INT; i < FIELD_TYPE_COUNT; i++)
+	{
+		if (counts[i] == 0)
+			continue;
 
-		c = fgetc(ifile);
+		if (result == FIELD_TYPE_EMPTY)
+			result = i;
+		else if ((result == FIELD_TYPE_INT && i == FIELD_TYPE_FLOAT))
+			result = FIELD_TYPE_FLOAT;
+		else
+			return FIELD_TYPE_TEXT;
 	}
-	while (!closed);
 
-	current = &rowbucket;
+	return result;
+}
+
+/*
+ * Header detection - simple heuristic, when first row has all text fields
+ * and some column has not text values in other rows, then csv has header.
+ * When the csv has not header, then the first row is used for inferring
+ * of types of columns too. Only measured columns are used.
+ */
+static void
+infer_column_types(LinebufType *linebuf)
+{
+	bool	header = true;
+	bool	typed_column = false;
+	int		end = linebuf->maxfields < linebuf->end_column ? linebuf->maxfields : linebuf->end_column;
+	int		i;
+
+	for (i = linebuf->first_column; i < end; i++)
+	{
+		int		type = column_type(linebuf->types[i]);
+
+		if (linebuf->first_types[i] != FIELD_TYPE_TEXT)
+			header = false;
 
-	print_vertical_header(ofile, &linebuf, &config, 't');
+		if (type != FIELD_TYPE_TEXT && type != FIELD_TYPE_EMPTY)
+			typed_column = true;
+	}
 
-	last_multiline_column = linebuf.multilines[linebuf.maxfields - 1];
-	last_column = linebuf.maxfields - 1;
+	linebuf->header = header && typed_column;
 
-	while (current)
+	for (i = linebuf->first_column; i < end; i++)
 	{
-		int		i;
+		int		counts[FIELD_TYPE_COUNT];
 
-		for (i = 0; i < current->nrows; i++)
+		memcpy(counts, linebuf->types[i], sizeof(counts));
+
+		if (!linebuf->header)
+			counts[(int) linebuf->first_types[i]] += 1;
+
+		linebuf->column_types[i] = column_type(counts);
+
+		/* the numbers are aligned by decimal point */
+		if (FIELD_TYPE_IS_NUMERIC(linebuf->column_types[i]))
 		{
-			int		j;
-			bool	isheader = false;
-			RowType	   *row;
-			bool	free_row;
-			bool	more_lines = true;
-			bool	multiline = current->multilines[i];
+			int		width = linebuf->intwidths[i] + linebuf->fracwidths[i];
 
-			/*
-			 * For multilines we can modify pointers so do copy now
-			 */
-			if (multiline)
-			{
-				RowType	   *source = current->rows[i];
-				int			size;
+			if (width > linebuf->widths[i])
+				linebuf->widths[i] = width;
+		}
+	}
+}
 
-				size = offsetof(RowType, fields) + (source->nfields * sizeof(char*));
+/*
+ * Forgets measured widths and types of columns. It is used, when the
+ * growing file was truncated, and it is read from begin again.
+ */
+static void
+reset_columns_stats(LinebufType *linebuf)
+{
+	linebuf->processed = 0;
+	linebuf->maxfields = 0;
+	linebuf->header = false;
+	linebuf->has_limited = false;
+
+	memset(linebuf->widths, 0, sizeof(linebuf->widths));
+	memset(linebuf->first_widths, 0, sizeof(linebuf->first_widths));
+	if (linebuf->width_histograms)
+		memset(linebuf->width_histograms, 0, WIDTH_HISTOGRAMS_SIZE);
+	memset(linebuf->limited, 0, sizeof(linebuf->limited));
+	memset(linebuf->multilines, 0, sizeof(linebuf->multilines));
+	memset(linebuf->intwidths, 0, sizeof(linebuf->intwidths));
+	memset(linebuf->fracwidths, 0, sizeof(linebuf->fracwidths));
+	memset(linebuf->types, 0, sizeof(linebuf->types));
+	memset(linebuf->first_types, 0, sizeof(linebuf->first_types));
+	memset(linebuf->column_types, 0, sizeof(linebuf->column_types));
+}
 
-				row = smalloc(size, "RowType");
-				memcpy(row, source, size);
+static void *
+widths_worker(void *arg)
+{
+	WidthsWorkerType *worker = (WidthsWorkerType *) arg;
+	int		i;
 
-				free_row = true;
-			}
-			else
-			{
-				row = current->rows[i];
-				free_row = false;
-			}
+	for (i = worker->first_bucket; i < worker->nbuckets; i += worker->step)
+	{
+		RowBucketType *rb = worker->buckets[i];
+		int		j;
 
-			while (more_lines)
-			{
-				more_lines = false;
+		for (j = 0; j < rb->nrows; j++)
+		{
+			RowType    *row = rb->rows[j];
+			FieldInfoType *infos[1024];
+			int			k;
 
-				if (config.border == 2)
+			/*
+			 * The interned values are described already. The dictionaries
+			 * are not changed after parsing, so they can be searched by
+			 * more threads.
+			 */
+			if (worker->dictionaries)
+			{
+				for (k = 0; k < row->nfields; k++)
 				{
-					if (config.linestyle == 'a')
-						fprintf(ofile, "| ");
-					else
-						fprintf(ofile, "\342\224\202 ");
-				}
-				else if (config.border == 1)
-					fprintf(ofile, " ");
+					DictEntryType *entry = NULL;
 
-				isheader = printed_rows == 0 ? is_header(&rowbucket) : false;
+					if (*row->fields[k])
+						entry = dictionary_find(&worker->dictionaries[k],
+												row->fields[k],
+												strlen(row->fields[k]));
 
-				for (j = 0; j < row->nfields; j++)
-				{
-					int		width;
-					int		spaces;
-					char   *field;
-					bool	_more_lines = false;
+					infos[k] = entry ? &entry->info : NULL;
+				}
+			}
 
-					if (j > 0)
-					{
-						if (config.border != 0)
-						{
-							if (config.linestyle == 'a')
-								fprintf(ofile, "| ");
-							else
-								fprintf(ofile, "\342\224\202 ");
-						}
-					}
+			rb->multilines[j] = measure_row(row,
+											&worker->stats,
+											i == 0 && j == 0,
+											worker->dictionaries ? infos : NULL);
+		}
+	}
 
-					field = row->fields[j];
+	return NULL;
+}
 
-					if (field && *field != '\0')
-					{
-						bool	_isdigit = isdigit(field[0]);
+/*
+ * Allocates histograms of widths of columns. They are used only by auto
+ * max width, so they are not allocated by init_table.
+ */
+static void
+init_width_histograms(LinebufType *linebuf)
+{
+	linebuf->width_histograms = smalloc(WIDTH_HISTOGRAMS_SIZE, "width histograms");
+	memset(linebuf->width_histograms, 0, WIDTH_HISTOGRAMS_SIZE);
+}
 
-						if (multiline)
-						{
-							width = utf_string_dsplen_multiline(field, -1, &_more_lines, true);
-							more_lines |= _more_lines;
-						}
-						else
-							width = utf_string_dsplen(field, -1);
+/*
+ * Calculate widths of columns of already parsed rows. The buckets are
+ * distributed between nthreads threads, and the partial results are
+ * merged to linebuf.
+ */
+static void
+calculate_widths_parallel(RowBucketType *rowbucket, LinebufType *linebuf, int nthreads)
+{
+	WidthsWorkerType *workers;
+	RowBucketType **buckets;
+	RowBucketType *rb;
+	int		nbuckets = 0;
+	int		i, j;
 
-						spaces = linebuf.widths[j] - width;
+	for (rb = rowbucket; rb; rb = rb->next_bucket)
+		nbuckets += 1;
 
-						/* left spaces */
-						if (isheader)
-							printf("%*s", spaces / 2, "");
-						else if (_isdigit)
-							printf("%*s", spaces, "");
+	buckets = smalloc(nbuckets * sizeof(RowBucketType *), "buckets");
 
-						if (multiline)
-							row->fields[j] = fput_line(row->fields[j], multiline, ofile);
-						else
-							(void) fput_line(row->fields[j], multiline, ofile);
+	for (rb = rowbucket, i = 0; rb; rb = rb->next_bucket)
+		buckets[i++] = rb;
 
-						/* right spaces */
-						if (isheader)
-							printf("%*s", spaces - (spaces / 2), "");
-						else if (!_isdigit)
-							printf("%*s", spaces, "");
-					}
-					else
-						printf("%*s", linebuf.widths[j], "");
+	if (nthreads > nbuckets)
+		nthreads = nbuckets;
 
-					if (_more_lines)
-					{
-						if (config.linestyle == 'a')
-							fputc('+', ofile);
-						else
-							fputs("\342\206\265", ofile);
-					}
-					else
-					{
-						if (config.border != 0 || j < last_column || last_multiline_column)
-							fputc(' ', ofile);
-					}
-				}
+	workers = smalloc(nthreads * sizeof(WidthsWorkerType), "WidthsWorkerType");
+	memset(workers, 0, nthreads * sizeof(WidthsWorkerType));
 
-				for (j = row->nfields; j < linebuf.maxfields; j++)
-				{
-					bool	addspace;
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].buckets = buckets;
+		workers[i].nbuckets = nbuckets;
+		workers[i].first_bucket = i;
+		workers[i].step = nthreads;
+		workers[i].dictionaries = linebuf->dictionaries;
+		workers[i].stats.first_column = linebuf->first_column;
+		workers[i].stats.end_column = linebuf->end_column;
+
+		if (linebuf->width_histograms)
+			init_width_histograms(&workers[i].stats);
+
+		/* the first part is processed by main thread */
+		if (i > 0 && pthread_create(&workers[i].thread, NULL, widths_worker, &workers[i]) != 0)
+		{
+			fprintf(stderr, "cannot to create thread\n");
+			exit(1);
+		}
+	}
 
-					if (j > 0)
-					{
-						if (config.border != 0)
-						{
-							if (config.linestyle == 'a')
-								fprintf(ofile, "| ");
-							else
-								fprintf(ofile, "\342\224\202 ");
-						}
-					}
+	widths_worker(&workers[0]);
 
-					addspace = config.border != 0 || j < last_column || last_multiline_column;
+	for (i = 0; i < nthreads; i++)
+	{
+		if (i > 0)
+			pthread_join(workers[i].thread, NULL);
 
-					fprintf(ofile, "%*s", linebuf.widths[j] + (addspace ? 1 : 0), "");
-				}
+		for (j = 0; j < linebuf->maxfields; j++)
+		{
+			LinebufType *stats = &workers[i].stats;
+			int			k;
 
-				if (config.border == 2)
-				{
-					if (config.linestyle == 'a')
-						fprintf(ofile, "|");
-					else
-						fprintf(ofile, "\342\224\202");
-				}
+			if (stats->widths[j] > linebuf->widths[j])
+				linebuf->widths[j] = stats->widths[j];
+			if (stats->intwidths[j] > linebuf->intwidths[j])
+				linebuf->intwidths[j] = stats->intwidths[j];
+			if (stats->fracwidths[j] > linebuf->fracwidths[j])
+				linebuf->fracwidths[j] = stats->fracwidths[j];
 
-				fprintf(ofile, "\n");
+			linebuf->multilines[j] |= stats->multilines[j];
 
-				if (isheader)
-				{
-					print_vertical_header(ofile, &linebuf, &config, 'm');
-					printed_headline = true;
-				}
+			for (k = 0; k < FIELD_TYPE_COUNT; k++)
+				linebuf->types[j][k] += stats->types[j][k];
 
-				printed_rows += 1;
+			if (linebuf->width_histograms)
+			{
+				for (k = 0; k < WIDTH_HISTOGRAM_SIZE; k++)
+					linebuf->width_histograms[j][k] += stats->width_histograms[j][k];
 			}
 
-			if (free_row)
-				free(row);
+			/* first row is in first bucket processed by first worker */
+			if (i == 0)
+			{
+				linebuf->first_types[j] = stats->first_types[j];
+				linebuf->first_widths[j] = stats->first_widths[j];
+			}
 		}
 
-		current = current->next_bucket;
+		free(workers[i].stats.width_histograms);
 	}
 
-	print_vertical_header(ofile, &linebuf, &config, 'b');
+	free(workers);
+	free(buckets);
+}
+
+static void
+print_vertical_header(FILE *ofile, LinebufType *linebuf, ConfigType *config, char pos)
+{
+	int		i;
+	int		border = config->border;
+
+	if (config->linestyle == 'a')
+	{
+		if ((border == 0 || border == 1) && (pos != 'm'))
+			return;
+
+		if (border == 2)
+			fprintf(ofile, "+-");
+		else if (border == 1)
+			fprintf(ofile, "-");
+
+		for (i = linebuf->first_column; i < linebuf->end_column; i++)
+		{
+			int		j;
+
+			if (i > linebuf->first_column)
+			{
+				if (border == 0)
+					fprintf(ofile, " ");
+				else
+					fprintf(ofile, "-+-");
+			}
+
+			for (j = 0; j < linebuf->widths[i]; j++)
+				fprintf(ofile, "-");
+		}
+
+		if (border == 2)
+			fprintf(ofile, "-+");
+		else if (border == 1)
+			fprintf(ofile, "-");
+		else if (border == 0 && linebuf->multilines[linebuf->end_column - 1])
+			fputc(' ', ofile);
+
+		fprintf(ofile, "\n");
+	}
+	else if (config->linestyle == 'u')
+	{
+		if ((border == 0 || border == 1) && (pos != 'm'))
+			return;
+
+		if (border == 2)
+		{
+			if (pos == 't')
+				fprintf(ofile, "\342\224\214");
+			else if (pos == 'm')
+				fprintf(ofile, "\342\224\234");
+			else
+				fprintf(ofile, "\342\224\224");
+
+			fprintf(ofile, "\342\224\200");
+		}
+		else if (border == 1)
+			fprintf(ofile, "\342\224\200");
+
+		for (i = linebuf->first_column; i < linebuf->end_column; i++)
+		{
+			int		j;
+
+			if (i > linebuf->first_column)
+			{
+				if (border == 0)
+					fprintf(ofile, " ");
+				else
+				{
+					fprintf(ofile, "\342\224\200");
+					if (pos == 't')
+						fprintf(ofile, "\342\224\254");
+					else if (pos == 'm')
+						fprintf(ofile, "\342\224\274");
+					else
+						fprintf(ofile, "\342\224\264");
+
+					fprintf(ofile, "\342\224\200");
+				}
+			}
+
+			for (j = 0; j < linebuf->widths[i]; j++)
+				fprintf(ofile, "\342\224\200");
+		}
+
+		if (border == 2)
+		{
+			fprintf(ofile, "\342\224\200");
+			if (pos == 't')
+				fprintf(ofile, "\342\224\220");
+			else if (pos == 'm')
+				fprintf(ofile, "\342\224\244");
+			else
+				fprintf(ofile, "\342\224\230");
+		}
+		else if (border == 1)
+			fprintf(ofile, "\342\224\200");
+
+		fprintf(ofile, "\n");
+	}
+}
+
+/*
+ * Reads CSV from input, and stores rows to rowbucket chain. The widths
+ * of columns are calculated immediately, when deferred mode is not used.
+ */
+static void
+parse_csv(InputType *input, RowBucketType *rowbucket, LinebufType *linebuf, ConfigType *config)
+{
+	RowBucketType *current = rowbucket;
+	bool	skip_initial;
+	bool	closed = false;
+	int		c;
+	int		first_nw = 0;
+	int		last_nw = 0;
+	int		pos = 0;
+	int		instr = false;
+	bool	oversized;
+	bool	first_row = true;
+
+	/* the validate reader passes only complete valid chars */
+	bool	validated = config->invalid_utf8 != 0;
+
+	skip_initial = true;
+
+	c = input_getc(input);
+	do
+	{
+		if (c != EOF && (c != '\n' || instr))
+		{
+			int		l;
+
+			if (skip_initial)
+			{
+				if (c == ' ')
+					goto next_char;
+
+				skip_initial = false;
+				last_nw = first_nw;
+			}
+
+			/* there should be space for complete multibyte char */
+			if (linebuf->used + 4 > linebuf->size)
+			{
+				linebuf->size *= 2;
+				linebuf->buffer = realloc(linebuf->buffer, linebuf->size);
+				if (!linebuf->buffer)
+				{
+					fprintf(stderr, "out of memory\n");
+					fatal_error();
+				}
+			}
+
+			/*
+			 * The chars of field longer than max_field_size are only counted.
+			 * The decision is done for complete multibyte char.
+			 */
+			oversized = config->max_field_size > 0 && !skip_initial &&
+						pos - first_nw >= config->max_field_size &&
+						(instr || c != config->separator);
+
+			if (oversized)
+			{
+				if (c == '"')
+				{
+					if (instr)
+					{
+						int		c2 = input_getc(input);
+
+						if (c2 == '"')
+							linebuf->skipped[linebuf->nfields] += 1;
+						else
+						{
+							input_ungetc(c2, input);
+							instr = false;
+						}
+					}
+					else
+						instr = true;
+				}
+				else
+					linebuf->skipped[linebuf->nfields] += utf8charlen(c);
+			}
+			else if (c == '"')
+			{
+				if (instr)
+				{
+					int     c2 = input_getc(input);
+
+					if (c2 == '"')
+					{
+						/* double double quotes */
+						linebuf->buffer[linebuf->used++] = c;
+						pos = pos + 1;
+					}
+					else
+					{
+						/* start of end of string */
+						input_ungetc(c2, input);
+						instr = false;
+					}
+				}
+				else
+					instr = true;
+			}
+			else
+			{
+				linebuf->buffer[linebuf->used++] = c;
+				pos = pos + 1;
+			}
+
+			if (config->separator == -1 && !instr)
+			{
+				/*
+				 * Automatic separator detection - now it is very simple, first win.
+				 * Can be enhanced in future by more sofisticated mechanism.
+				 */
+				if (c == ',')
+					config->separator = ',';
+				else if (c == ';')
+					config->separator = ';';
+				else if (c == '|')
+					config->separator = '|';
+			}
+
+			if (config->separator != -1 && c == config->separator && !instr)
+			{
+				if (!skip_initial)
+				{
+					linebuf->sizes[linebuf->nfields] = last_nw - first_nw;
+					linebuf->starts[linebuf->nfields++] = first_nw;
+				}
+				else
+				{
+					linebuf->sizes[linebuf->nfields] = 0;
+					linebuf->starts[linebuf->nfields++] = -1;
+				}
+
+				skip_initial = true;
+				first_nw = pos;
+			}
+			else if (instr || c != ' ')
+			{
+				last_nw = pos;
+			}
+
+			l = c < 0x80 ? 1 : utf8charlen(c);
+			if (l > 1 && validated && input->pos + l - 1 <= input->len)
+			{
+				/* the rest of validated char is copied without checks */
+				if (!oversized)
+				{
+					memcpy(linebuf->buffer + linebuf->used, input->buffer + input->pos, l - 1);
+					linebuf->used += l - 1;
+					pos += l - 1;
+				}
+
+				input->pos += l - 1;
+				last_nw = pos;
+			}
+			else if (l > 1)
+			{
+				int		i;
+
+				/* read othe chars */
+				for (i = 1; i < l; i++)
+				{
+					c = input_getc(input);
+					if (c == EOF)
+					{
+						fprintf(stderr, "unexpected quit, broken unicode char\n");
+
+						/* the incomplete char is not stored */
+						if (!oversized)
+						{
+							linebuf->used -= i;
+							pos -= i;
+						}
+						break;
+					}
+
+					if (oversized)
+						continue;
+
+					linebuf->buffer[linebuf->used++] = c;
+					pos = pos + 1;
+				}
+				last_nw = pos;
+			}
+		}
+		else
+		{
+			char	   *locbuf;
+			RowType	   *row;
+			int			i;
+			int			data_size;
+			int			row_size;
+			bool		multiline;
+			DictEntryType *entries[1024];
+			FieldInfoType *infos[1024];
+
+			if (!skip_initial)
+			{
+				linebuf->sizes[linebuf->nfields] = last_nw - first_nw;
+				linebuf->starts[linebuf->nfields++] = first_nw;
+			}
+			else
+			{
+				linebuf->sizes[linebuf->nfields] = 0;
+				linebuf->starts[linebuf->nfields++] = -1;
+			}
+
+			if (!linebuf->used)
+				goto next_row;
+
+			data_size = 0;
+			for (i = 0; i < linebuf->nfields; i++)
+			{
+				entries[i] = NULL;
+
+				/* try to use interned value */
+				if (linebuf->dictionaries && linebuf->sizes[i] > 0 && linebuf->skipped[i] == 0)
+				{
+					bool	found;
+
+					entries[i] = dictionary_lookup(&linebuf->dictionaries[i],
+												   linebuf->buffer + linebuf->starts[i],
+												   linebuf->sizes[i],
+												   &found);
+
+					if (entries[i])
+					{
+						if (!found)
+						{
+							describe_field(entries[i]->value, &entries[i]->info);
+							if (entries[i]->info.lines)
+								entries[i]->info.lines->shared = true;
+						}
+
+						infos[i] = &entries[i]->info;
+						continue;
+					}
+				}
+
+				infos[i] = NULL;
+
+				data_size += linebuf->sizes[i] + 1;
+				if (linebuf->skipped[i] > 0)
+					data_size += SKIPPED_MARK_SIZE;
+			}
+
+			row_size = offsetof(RowType, fields) + (linebuf->nfields * sizeof(char*)) + data_size;
+
+			/* the fields are stored together with row */
+			row = smalloc(row_size, "RowType");
+			row->nfields = linebuf->nfields;
+			row->lines = NULL;
+			row->widths = NULL;
+			row->numeric = NULL;
+
+			locbuf = (char *) &row->fields[linebuf->nfields];
+			memset(locbuf, 0, data_size);
+
+			for (i = 0; i < linebuf->nfields; i++)
+			{
+				if (entries[i])
+				{
+					row->fields[i] = entries[i]->value;
+					continue;
+				}
+
+				row->fields[i] = locbuf;
+
+				if (linebuf->sizes[i] > 0)
+					memcpy(locbuf, linebuf->buffer + linebuf->starts[i], linebuf->sizes[i]);
+
+				locbuf[linebuf->sizes[i]] = '\0';
+				locbuf += linebuf->sizes[i] + 1;
+
+				/* too long field is displayed truncated with its size */
+				if (linebuf->skipped[i] > 0)
+				{
+					snprintf(locbuf - 1, SKIPPED_MARK_SIZE + 1, "... (%ld bytes)",
+							 linebuf->sizes[i] + linebuf->skipped[i]);
+					locbuf += SKIPPED_MARK_SIZE;
+					linebuf->skipped[i] = 0;
+				}
+			}
+
+			/* in deferred mode the widths are calculated after parsing */
+			if (!config->deferred_widths)
+				multiline = measure_row(row, linebuf, first_row, infos);
+			else
+				multiline = false;
+
+			first_row = false;
+
+			if (linebuf->nfields > linebuf->maxfields)
+				linebuf->maxfields = linebuf->nfields;
+
+			if (linebuf->row_handler)
+				linebuf->row_handler(row, multiline, linebuf->row_handler_arg);
+			else
+				current = store_row(current, rowbucket, linebuf, config,
+									row, multiline, row_size);
+
+next_row:
+
+			memset(linebuf->skipped, 0, linebuf->nfields * sizeof(long));
+
+			linebuf->used = 0;
+			linebuf->nfields = 0;
+
+			linebuf->processed += 1;
+
+			skip_initial = true;
+			first_nw = 0;
+			last_nw = 0;
+			pos = 0;
+
+			closed = c == EOF;
+		}
+
+next_char:
+
+		c = input_getc(input);
+
+		/*
+		 * The growing file was truncated. The partial row of previous
+		 * content is forgotten, the consumer of rows can close its table,
+		 * and the columns are measured again.
+		 */
+		if (input->restarted)
+		{
+			input->restarted = false;
+
+			if (linebuf->row_handler)
+				linebuf->row_handler(NULL, false, linebuf->row_handler_arg);
+
+			memset(linebuf->skipped, 0, sizeof(linebuf->skipped));
+			reset_columns_stats(linebuf);
+
+			linebuf->used = 0;
+			linebuf->nfields = 0;
+
+			skip_initial = true;
+			instr = false;
+			first_nw = 0;
+			last_nw = 0;
+			pos = 0;
+			first_row = true;
+		}
+	}
+	while (!closed);
+}
+
+/*
+ * Prints all lines of row. The lines of multiline fields are taken
+ * from prepared indexes.
+ */
+static void
+print_row(FILE *ofile, RowType *row, bool multiline, LinebufType *linebuf,
+		  ConfigType *config, bool isheader)
+{
+	int		last_column = linebuf->end_column - 1;
+	int		nfields = row->nfields < linebuf->end_column ? row->nfields : linebuf->end_column;
+	bool	last_multiline_column = linebuf->multilines[last_column];
+	bool	more_lines = true;
+	int		line = 0;
+
+	if (multiline && !row->lines)
+	{
+		index_row_lines(row);
+
+		/* the flag loaded from cache file can be wrong */
+		multiline = row->lines != NULL;
+	}
+
+	if (config->wrap && linebuf->has_limited)
+		multiline = wrap_row_lines(row, multiline, linebuf);
+
+	while (more_lines)
+	{
+		int		j;
+
+		more_lines = false;
+
+		if (config->border == 2)
+		{
+			if (config->linestyle == 'a')
+				fprintf(ofile, "| ");
+			else
+				fprintf(ofile, "\342\224\202 ");
+		}
+		else if (config->border == 1)
+			fprintf(ofile, " ");
+
+		/* the fields out of viewport are skipped */
+		for (j = linebuf->first_column; j < nfields; j++)
+		{
+			FieldLinesType *lines = multiline ? row->lines[j] : NULL;
+			const char *field = row->fields[j];
+			int		size = -1;
+			int		width = 0;
+			bool	_more_lines = false;
+			bool	_wrapped = false;
+			bool	truncated = false;
+
+			if (j > linebuf->first_column)
+			{
+				if (config->border != 0)
+				{
+					if (config->linestyle == 'a')
+						fprintf(ofile, "| ");
+					else
+						fprintf(ofile, "\342\224\202 ");
+				}
+			}
+
+			if (lines)
+			{
+				if (line < lines->nlines)
+				{
+					FieldLineType *fl = &lines->lines[line];
+
+					field += fl->offset;
+					size = fl->size;
+					width = fl->width;
+
+					_more_lines = line + 1 < lines->nlines;
+					more_lines |= _more_lines;
+
+					/* the line was wrapped, not ended by new line */
+					_wrapped = _more_lines && field[size] != '\n';
+				}
+				else
+					field = NULL;
+			}
+			else if (line > 0)
+				field = NULL;
+
+			if (field && *field != '\0' && size != 0)
+			{
+				bool	numeric = FIELD_TYPE_IS_NUMERIC(linebuf->column_types[j]);
+				int		spaces;
+				int		fraction_spaces = 0;
+
+				/* the row loaded from cache has widths and flags of fields */
+				if (row->widths)
+				{
+					numeric = numeric && row->numeric[j];
+
+					if (size == -1)
+						width = row->widths[j];
+				}
+				else if (size == -1)
+					width = utf_string_dsplen(field, -1);
+
+				/* the field of limited column is truncated */
+				if (linebuf->limited[j] && width > linebuf->widths[j])
+				{
+					size = utf_string_prefix(field, size, linebuf->widths[j] - 1, &width);
+					width += 1;
+					truncated = true;
+				}
+
+				spaces = linebuf->widths[j] - width;
+
+				/* numbers are aligned by decimal point */
+				if (numeric && !isheader)
+				{
+					char   *dot = strchr(field, '.');
+
+					fraction_spaces = linebuf->fracwidths[j] - (dot ? (int) strlen(dot) : 0);
+					spaces -= fraction_spaces;
+				}
+
+				/* left spaces */
+				if (isheader)
+					fprintf(ofile, "%*s", spaces / 2, "");
+				else if (numeric)
+					fprintf(ofile, "%*s", spaces, "");
+
+				if (size == -1)
+					fputs(field, ofile);
+				else
+					fwrite(field, 1, size, ofile);
+
+				if (truncated)
+				{
+					if (config->linestyle == 'a')
+						fputc('~', ofile);
+					else
+						fputs("\342\200\246", ofile);
+				}
+
+				/* right spaces */
+				if (isheader)
+					fprintf(ofile, "%*s", spaces - (spaces / 2), "");
+				else if (!numeric)
+					fprintf(ofile, "%*s", spaces, "");
+				else
+					fprintf(ofile, "%*s", fraction_spaces, "");
+			}
+			else
+				fprintf(ofile, "%*s", linebuf->widths[j], "");
+
+			if (_wrapped)
+			{
+				if (config->linestyle == 'a')
+					fputc('.', ofile);
+				else
+					fputs("\342\200\246", ofile);
+			}
+			else if (_more_lines)
+			{
+				if (config->linestyle == 'a')
+					fputc('+', ofile);
+				else
+					fputs("\342\206\265", ofile);
+			}
+			else
+			{
+				if (config->border != 0 || j < last_column || last_multiline_column)
+					fputc(' ', ofile);
+			}
+		}
+
+		for (j = nfields > linebuf->first_column ? nfields : linebuf->first_column;
+			 j < linebuf->end_column; j++)
+		{
+			bool	addspace;
+
+			if (j > linebuf->first_column)
+			{
+				if (config->border != 0)
+				{
+					if (config->linestyle == 'a')
+						fprintf(ofile, "| ");
+					else
+						fprintf(ofile, "\342\224\202 ");
+				}
+			}
+
+			addspace = config->border != 0 || j < last_column || last_multiline_column;
+
+			fprintf(ofile, "%*s", linebuf->widths[j] + (addspace ? 1 : 0), "");
+		}
+
+		if (config->border == 2)
+		{
+			if (config->linestyle == 'a')
+				fprintf(ofile, "|");
+			else
+				fprintf(ofile, "\342\224\202");
+		}
+
+		fprintf(ofile, "\n");
+
+		line += 1;
+	}
+}
+
+/*
+ * Reduces widths of text columns to max width. In auto mode the max
+ * width of column is the width of 99 percent of fields (first row is
+ * not counted), but the first row (possible header) is not reduced.
+ * The numeric columns are not reduced.
+ */
+static void
+limit_widths(LinebufType *linebuf, ConfigType *config)
+{
+	int		i;
+
+	linebuf->has_limited = false;
+	memset(linebuf->limited, 0, sizeof(linebuf->limited));
+
+	if (config->max_width == 0)
+		return;
+
+	for (i = 0; i < linebuf->maxfields; i++)
+	{
+		int		max_width = config->max_width;
+
+		if (FIELD_TYPE_IS_NUMERIC(linebuf->column_types[i]))
+			continue;
+
+		if (max_width == -1)
+		{
+			long	total = 0;
+			long	count = 0;
+			int		j;
+
+			if (!linebuf->width_histograms)
+				continue;
+
+			for (j = 0; j < WIDTH_HISTOGRAM_SIZE; j++)
+				total += linebuf->width_histograms[i][j];
+
+			/* histogram is not available for table loaded from cache */
+			if (total == 0)
+				continue;
+
+			for (j = 0; j < WIDTH_HISTOGRAM_SIZE; j++)
+			{
+				count += linebuf->width_histograms[i][j];
+				if (count * 100 >= total * 99)
+					break;
+			}
+
+			max_width = width_bucket_upper(j);
+
+			if (max_width < linebuf->first_widths[i])
+				max_width = linebuf->first_widths[i];
+			if (max_width < 1)
+				max_width = 1;
+		}
+
+		if (linebuf->widths[i] > max_width)
+		{
+			linebuf->widths[i] = max_width;
+			linebuf->limited[i] = true;
+			linebuf->has_limited = true;
+		}
+	}
+}
+
+/*
+ * Sets the span of displayed columns. It starts by first_column, and
+ * it has so many columns, that fits to width of viewport (at least one).
+ */
+static void
+set_visible_columns(LinebufType *linebuf, ConfigType *config)
+{
+	int		separator_width = config->border == 0 ? 1 : 3;
+	int		total;
+	int		i;
+
+	if (config->width == 0)
+	{
+		linebuf->end_column = linebuf->maxfields;
+		return;
+	}
+
+	total = config->border == 2 ? 4 : (config->border == 1 ? 2 : 0);
+
+	for (i = linebuf->first_column; i < linebuf->maxfields; i++)
+	{
+		total += linebuf->widths[i];
+		if (i > linebuf->first_column)
+			total += separator_width;
+
+		if (total > config->width && i > linebuf->first_column)
+			break;
+	}
+
+	linebuf->end_column = i;
+}
+
+static void
+print_table(FILE *ofile, RowBucketType *rowbucket, LinebufType *linebuf, ConfigType *config)
+{
+	RowBucketType *current = rowbucket;
+	RowBucketType loaded;
+	bool	printed_headline = false;
+	bool	range = config->first_row > 0 || config->nrows > 0;
+	long	end_row = config->nrows > 0 ? config->first_row + config->nrows : LONG_MAX;
+	long	rowno = 0;
+	long	printed_rows = 0;
+
+	limit_widths(linebuf, config);
+	set_visible_columns(linebuf, config);
+
+	print_vertical_header(ofile, linebuf, config, 't');
+
+	while (current && rowno < end_row)
+	{
+		RowBucketType *rb = current;
+		int		i;
+
+		/* the buckets before range of rows are not read */
+		if (current != rowbucket && rowno + current->nrows <= config->first_row)
+		{
+			rowno += current->nrows;
+			current = current->next_bucket;
+			continue;
+		}
+
+		/*
+		 * The rows of spilled or compressed bucket are loaded to private
+		 * copy of bucket, so the table can be rendered by more threads
+		 * (in daemon) together.
+		 */
+		if (current->spill_file || current->compressed)
+		{
+			rb = &loaded;
+			memcpy(rb, current, sizeof(RowBucketType));
+			bucket_acquire(rb);
+		}
+
+		for (i = 0; i < rb->nrows; i++)
+		{
+			bool	isheader = current == rowbucket && i == 0 && linebuf->header;
+
+			/* the header is printed always */
+			if (!isheader)
+			{
+				rowno += 1;
+				if (rowno <= config->first_row || rowno > end_row)
+					continue;
+
+				printed_rows += 1;
+			}
+
+			print_row(ofile, rb->rows[i], rb->multilines[i],
+					  linebuf, config, isheader);
+
+			if (isheader)
+			{
+				print_vertical_header(ofile, linebuf, config, 'm');
+				printed_headline = true;
+			}
+		}
+
+		if (rb == &loaded)
+			bucket_release(rb);
+
+		current = current->next_bucket;
+	}
+
+	print_vertical_header(ofile, linebuf, config, 'b');
+
+	if (range)
+		fprintf(ofile, "(%ld rows)\n", printed_rows);
+	else
+		fprintf(ofile, "(%d rows)\n", linebuf->processed - (printed_headline ? 1 : 0));
+}
+
+/*
+ * Prints top rule and the held first row as header or as data row.
+ * The widths of columns should be prepared.
+ */
+static void
+follow_start(FollowType *follow)
+{
+	LinebufType *linebuf = follow->linebuf;
+	ConfigType *config = follow->config;
+
+	print_vertical_header(follow->ofile, linebuf, config, 't');
+
+	print_row(follow->ofile, follow->first_row, follow->first_multiline,
+			  linebuf, config, linebuf->header);
+
+	if (linebuf->header)
+		print_vertical_header(follow->ofile, linebuf, config, 'm');
+	else
+		follow->nrows += 1;
+
+	memcpy(follow->widths, linebuf->widths, linebuf->maxfields * sizeof(int));
+	follow->maxfields = linebuf->maxfields;
+
+	free_row(follow->first_row);
+	follow->first_row = NULL;
+	follow->started = true;
+}
+
+/*
+ * Prints the held first row (when it is alone), bottom rule and number
+ * of rows.
+ */
+static void
+follow_finish(FollowType *follow)
+{
+	LinebufType *linebuf = follow->linebuf;
+	int		end_column = linebuf->end_column;
+
+	if (follow->first_row)
+	{
+		infer_column_types(linebuf);
+		limit_widths(linebuf, follow->config);
+	}
+
+	set_visible_columns(linebuf, follow->config);
+
+	if (follow->first_row)
+		follow_start(follow);
+
+	if (follow->started)
+		print_vertical_header(follow->ofile, linebuf, follow->config, 'b');
+
+	fprintf(follow->ofile, "(%ld rows)\n", follow->nrows);
+
+	linebuf->end_column = end_column;
+}
+
+/*
+ * Handler of rows in follow mode. The row is printed by widths of
+ * columns measured until now, and it is released. The NULL row means
+ * truncated file, then the current table is closed, and new table is
+ * started by next rows.
+ */
+static void
+follow_row(RowType *row, bool multiline, void *arg)
+{
+	FollowType *follow = (FollowType *) arg;
+	LinebufType *linebuf = follow->linebuf;
+	ConfigType *config = follow->config;
+	int		end_column = linebuf->end_column;
+
+	if (!row)
+	{
+		follow_finish(follow);
+
+		follow->nrows = 0;
+		follow->maxfields = 0;
+		follow->started = false;
+
+		return;
+	}
+
+	/* the header can be detected, when some data row is known */
+	if (!follow->started && !follow->first_row)
+	{
+		follow->first_row = row;
+		follow->first_multiline = multiline;
+		return;
+	}
+
+	infer_column_types(linebuf);
+	limit_widths(linebuf, config);
+	set_visible_columns(linebuf, config);
+
+	if (!follow->started)
+		follow_start(follow);
+	else if (linebuf->maxfields != follow->maxfields ||
+			 memcmp(follow->widths, linebuf->widths, linebuf->maxfields * sizeof(int)) != 0)
+		print_vertical_header(follow->ofile, linebuf, config, 'm');
+
+	memcpy(follow->widths, linebuf->widths, linebuf->maxfields * sizeof(int));
+	follow->maxfields = linebuf->maxfields;
+
+	print_row(follow->ofile, row, multiline, linebuf, config, false);
+
+	follow->nrows += 1;
+
+	/* the next rows are measured in viewport, not in visible span */
+	linebuf->end_column = end_column;
+
+	free_row(row);
+}
+
+/*
+ * Prints stored rows in expanded mode. The rows printed when they
+ * were parsed are not stored.
+ */
+static void
+print_expanded(ExpandedType *expanded, RowBucketType *rowbucket)
+{
+	RowBucketType *current = rowbucket;
+
+	while (current)
+	{
+		int		i;
+
+		for (i = 0; i < current->nrows; i++)
+		{
+			if (i == 0)
+				bucket_acquire(current);
+
+			expanded_print_row(expanded, current->rows[i]);
+		}
+
+		bucket_release(current);
+
+		current = current->next_bucket;
+	}
+
+	expanded_finish(expanded);
+}
+
+/*
+ * Clears widths and types of columns, and sets maxfields by rows
+ * of rowbucket, so the columns can be measured again.
+ */
+static void
+reset_columns(RowBucketType *rowbucket, LinebufType *linebuf)
+{
+	RowBucketType *rb;
+
+	memset(linebuf->widths, 0, sizeof(linebuf->widths));
+	memset(linebuf->multilines, 0, sizeof(linebuf->multilines));
+	memset(linebuf->intwidths, 0, sizeof(linebuf->intwidths));
+	memset(linebuf->fracwidths, 0, sizeof(linebuf->fracwidths));
+	memset(linebuf->types, 0, sizeof(linebuf->types));
+	memset(linebuf->first_types, 0, sizeof(linebuf->first_types));
+	memset(linebuf->first_widths, 0, sizeof(linebuf->first_widths));
+	if (linebuf->width_histograms)
+		memset(linebuf->width_histograms, 0, WIDTH_HISTOGRAMS_SIZE);
+
+	linebuf->maxfields = 0;
+
+	for (rb = rowbucket; rb; rb = rb->next_bucket)
+	{
+		int		i;
+
+		for (i = 0; i < rb->nrows; i++)
+		{
+			if (rb->rows[i]->nfields > linebuf->maxfields)
+				linebuf->maxfields = rb->rows[i]->nfields;
+		}
+	}
+}
+
+/*
+ * In top rows mode the rows are not measured by parser, and only rows
+ * that survive in heap of sorter are measured by deferred widths
+ * calculation. The first row and survivors are measured together, so
+ * header can be detected. When the first row is not header, it can
+ * push out the last survivor, and then the result is measured again.
+ */
+static void
+measure_top_rows(SorterType *sorter, RowBucketType *rowbucket,
+				 LinebufType *linebuf, ConfigType *config)
+{
+	RowBucketType candidates;
+	RowBucketType *current = &candidates;
+	RowBucketType *rb;
+	int		i;
+
+	if (!sorter->has_first_row)
+		return;
+
+	memset(&candidates, 0, sizeof(candidates));
+
+	candidates.rows[candidates.nrows++] = sorter->first_row.row;
+
+	for (i = 0; i < sorter->nitems; i++)
+	{
+		if (current->nrows >= 1000)
+			current = add_rowbucket(current);
+
+		current->rows[current->nrows++] = sorter->items[i].row;
+	}
+
+	reset_columns(&candidates, linebuf);
+	calculate_widths_parallel(&candidates, linebuf, config->nthreads);
+	infer_column_types(linebuf);
+
+	/* the flags of multiline rows are calculated by measuring */
+	sorter->first_row.multiline = candidates.multilines[0];
+
+	for (rb = &candidates, i = -1; rb; rb = rb->next_bucket)
+	{
+		int		j;
+
+		for (j = 0; j < rb->nrows; j++, i++)
+		{
+			if (i >= 0)
+				sorter->items[i].multiline = rb->multilines[j];
+		}
+	}
+
+	rb = candidates.next_bucket;
+	while (rb)
+	{
+		RowBucketType *next = rb->next_bucket;
+
+		free(rb);
+		rb = next;
+	}
+
+	if (sorter_finish(sorter, rowbucket, linebuf, config) > 0)
+	{
+		reset_columns(rowbucket, linebuf);
+		calculate_widths_parallel(rowbucket, linebuf, config->nthreads);
+		infer_column_types(linebuf);
+	}
+
+	/* only displayed rows are counted */
+	linebuf->processed = 0;
+	for (rb = rowbucket; rb; rb = rb->next_bucket)
+		linebuf->processed += rb->nrows;
+}
+
+/*
+ * Appends row created from values to table. The row is measured
+ * like parsed row.
+ */
+static RowBucketType *
+append_row(RowBucketType *current, RowBucketType *rowbucket, LinebufType *linebuf,
+		   int nfields, char **values)
+{
+	RowType	   *row;
+	char	   *locbuf;
+	int			data_size = 0;
+	int			i;
+
+	for (i = 0; i < nfields; i++)
+		data_size += strlen(values[i]) + 1;
+
+	row = smalloc(offsetof(RowType, fields) + nfields * sizeof(char *) + data_size, "RowType");
+	row->nfields = nfields;
+	row->lines = NULL;
+	row->widths = NULL;
+	row->numeric = NULL;
+
+	locbuf = (char *) &row->fields[nfields];
+
+	for (i = 0; i < nfields; i++)
+	{
+		row->fields[i] = locbuf;
+		strcpy(locbuf, values[i]);
+		locbuf += strlen(values[i]) + 1;
+	}
+
+	if (current->nrows >= 1000)
+		current = add_rowbucket(current);
+
+	current->multilines[current->nrows] = measure_row(row, linebuf, current == rowbucket && current->nrows == 0, NULL);
+	current->rows[current->nrows++] = row;
+
+	if (nfields > linebuf->maxfields)
+		linebuf->maxfields = nfields;
+
+	linebuf->processed += 1;
+
+	return current;
+}
+
+/*
+ * Initializes empty table.
+ */
+static void
+init_table(RowBucketType *rowbucket, LinebufType *linebuf)
+{
+	memset(linebuf, 0, sizeof(LinebufType));
+
+	linebuf->buffer = malloc(1024);
+	linebuf->used = 0;
+	linebuf->size = 1024;
+	linebuf->nfields = 0;
+
+	/* for debug purposes */
+	memset(linebuf->buffer, 0, 1024);
+
+	linebuf->first_column = 0;
+	linebuf->end_column = 1024;
+
+	rowbucket->nrows = 0;
+	rowbucket->allocated = false;
+	rowbucket->memory = 0;
+	rowbucket->spill_file = NULL;
+	rowbucket->compressed = false;
+	rowbucket->data = NULL;
+	rowbucket->next_bucket = NULL;
+}
+
+/*
+ * Prints statistics of columns as table with one row per column.
+ */
+static void
+print_describe(FILE *ofile, DescribeType *describe, LinebufType *linebuf, ConfigType *config)
+{
+	LinebufType	result_linebuf;
+	RowBucketType	result;
+	RowBucketType *current = &result;
+	char	   *values[DESCRIBE_NFIELDS];
+	int			i;
+
+	describe_finish(describe, linebuf);
+
+	init_table(&result, &result_linebuf);
+
+	if (config->max_width == -1)
+		init_width_histograms(&result_linebuf);
+
+	current = append_row(current, &result, &result_linebuf,
+						 DESCRIBE_NFIELDS, (char **) describe_field_names);
+
+	for (i = 0; i < linebuf->maxfields; i++)
+	{
+		describe_column(describe, linebuf, i, values);
+		current = append_row(current, &result, &result_linebuf, DESCRIBE_NFIELDS, values);
+	}
+
+	infer_column_types(&result_linebuf);
+
+	print_table(ofile, &result, &result_linebuf, config);
+}
+
+/*
+ * Returns stack of readers of input file.
+ */
+static ReaderType *
+input_reader(FILE *ifile, ConfigType *config)
+{
+	ReaderType *reader;
+
+	reader = decompress_reader(file_reader(ifile), config->nthreads);
+	reader = encoding_reader(reader, config->encoding);
+
+	if (config->invalid_utf8)
+		reader = validate_reader(reader, config->invalid_utf8);
+
+	if (config->pipeline)
+		reader = pipeline_reader(reader);
+
+	return reader;
+}
+
+/*
+ * Releases rows and buckets of table.
+ */
+static void
+free_table(RowBucketType *rowbucket, LinebufType *linebuf)
+{
+	RowBucketType *rb = rowbucket;
+
+	while (rb)
+	{
+		RowBucketType *next = rb->next_bucket;
+
+		/* the rows of spilled or compressed buckets are released already */
+		if (!rb->spill_file && !rb->compressed)
+			free_bucket_rows(rb);
+
+		free(rb->data);
+		free(rb);
+
+		rb = next;
+	}
+
+	if (linebuf->spill_file)
+		fclose(linebuf->spill_file);
+
+	free(linebuf->width_histograms);
+	free(linebuf->buffer);
+	free(linebuf);
+}
+
+/*
+ * Parses file to table cached by daemon. The table is parsed with
+ * options of client, and with options of storage of daemon. The error
+ * of parsing doesn't stop daemon, the table is released and false is
+ * returned. The readers, that can be in broken state, are not released.
+ */
+static bool
+load_daemon_table(const char *path, const ParseOptionsType *options,
+				  CachedTableType *table, void *arg)
+{
+	ConfigType	config = *((ConfigType *) arg);
+	InputType	input;
+	jmp_buf		error_jmp;
+	FILE	   *ifile;
+
+	config.max_field_size = options->max_field_size;
+	config.encoding = options->encoding;
+	config.invalid_utf8 = options->invalid_utf8;
+
+	ifile = fopen(path, "r");
+	if (!ifile)
+		return false;
+
+	table->rowbucket = smalloc(sizeof(RowBucketType), "RowBucketType");
+	table->linebuf = smalloc(sizeof(LinebufType), "LinebufType");
+
+	init_table(table->rowbucket, table->linebuf);
+
+	/* the table can be rendered with auto max width */
+	init_width_histograms(table->linebuf);
+
+	if (setjmp(error_jmp) != 0)
+	{
+		error_context = NULL;
+
+		free_table(table->rowbucket, table->linebuf);
+		fclose(ifile);
+
+		return false;
+	}
+
+	error_context = &error_jmp;
+
+	input_init(&input, input_reader(ifile, &config));
+
+	parse_csv(&input, table->rowbucket, table->linebuf, &config);
+
+	input_close(&input);
+	fclose(ifile);
+
+	if (config.deferred_widths)
+		calculate_widths_parallel(table->rowbucket, table->linebuf, config.nthreads);
+
+	error_context = NULL;
+
+	infer_column_types(table->linebuf);
+
+	/* the buffer of parser is not necessary */
+	free(table->linebuf->buffer);
+	table->linebuf->buffer = NULL;
+
+	table->memory = sizeof(LinebufType) + WIDTH_HISTOGRAMS_SIZE + table->linebuf->row_memory;
+
+	return true;
+}
+
+/*
+ * Renders cached table by options of request. Returns false, when the
+ * rendering failed.
+ */
+static bool
+render_daemon_table(FILE *ofile, CachedTableType *table,
+					RenderRequestType *request, void *arg)
+{
+	ConfigType	config = *((ConfigType *) arg);
+	LinebufType *linebuf = smalloc(sizeof(LinebufType), "LinebufType");
+	jmp_buf		error_jmp;
+
+	if (setjmp(error_jmp) != 0)
+	{
+		error_context = NULL;
+		free(linebuf);
+
+		return false;
+	}
+
+	/* the widths of cached table are not changed by rendering */
+	memcpy(linebuf, table->linebuf, sizeof(LinebufType));
+
+	config.border = request->border;
+	config.linestyle = request->linestyle;
+	config.width = request->width;
+	config.max_width = request->max_width;
+	config.wrap = false;
+	config.first_row = request->first_row;
+	config.nrows = request->nrows;
+
+	linebuf->first_column = request->first_column;
+
+	error_context = &error_jmp;
+
+	print_table(ofile, table->rowbucket, linebuf, &config);
+
+	error_context = NULL;
+
+	free(linebuf);
+
+	return true;
+}
+
+/*
+ * Handler of rows in union mode. The row is copied to new row with
+ * name of file in first field.
+ */
+static void
+union_row(RowType *row, bool multiline, void *arg)
+{
+	InputFileType *file = (InputFileType *) arg;
+	RowType	   *newrow;
+	char	   *locbuf;
+	int			data_size = strlen(file->path) + 1;
+	int			row_size;
+	int			i;
+
+	for (i = 0; i < row->nfields; i++)
+		data_size += strlen(row->fields[i]) + 1;
+
+	row_size = offsetof(RowType, fields) + (row->nfields + 1) * sizeof(char *) + data_size;
+
+	newrow = smalloc(row_size, "RowType");
+	newrow->nfields = row->nfields + 1;
+	newrow->lines = NULL;
+	newrow->widths = NULL;
+	newrow->numeric = NULL;
+
+	locbuf = (char *) &newrow->fields[newrow->nfields];
+
+	strcpy(locbuf, file->path);
+	newrow->fields[0] = locbuf;
+	locbuf += strlen(file->path) + 1;
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		strcpy(locbuf, row->fields[i]);
+		newrow->fields[i + 1] = locbuf;
+		locbuf += strlen(row->fields[i]) + 1;
+	}
+
+	free_row(row);
+
+	/* the rows are measured when all files are parsed */
+	file->current = store_row(file->current, file->rowbucket, file->linebuf,
+							  file->config, newrow, false, row_size);
+}
+
+/*
+ * Parses one file of multi-file mode, and renders its table to buffer,
+ * or stores its rows for union.
+ */
+static void
+process_file(int taskno, void *arg)
+{
+	MultiFileType *multi = (MultiFileType *) arg;
+	InputFileType *file = &multi->files[taskno];
+	ConfigType	config = *multi->config;
+	InputType	input;
+	FILE	   *ifile;
+	FILE	   *ofile;
+
+	ifile = fopen(file->path, "r");
+	if (!ifile)
+	{
+		file->error = errno;
+		return;
+	}
+
+	file->config = &config;
+	file->rowbucket = smalloc(sizeof(RowBucketType), "RowBucketType");
+	file->linebuf = smalloc(sizeof(LinebufType), "LinebufType");
+
+	init_table(file->rowbucket, file->linebuf);
+
+	if (config.max_width == -1)
+		init_width_histograms(file->linebuf);
+
+	if (multi->unified)
+	{
+		file->current = file->rowbucket;
+		file->linebuf->end_column = 0;
+		file->linebuf->row_handler = union_row;
+		file->linebuf->row_handler_arg = file;
+	}
+	else
+	{
+		file->linebuf->first_column = multi->first_column;
+		file->linebuf->end_column = multi->end_column;
+	}
+
+	input_init(&input, input_reader(ifile, &config));
+
+	parse_csv(&input, file->rowbucket, file->linebuf, &config);
+
+	input_close(&input);
+	fclose(ifile);
+
+	if (multi->unified)
+	{
+		/* only rows are used */
+		free(file->linebuf->width_histograms);
+		free(file->linebuf->buffer);
+		free(file->linebuf);
+		file->linebuf = NULL;
+		file->config = NULL;
+
+		return;
+	}
+
+	infer_column_types(file->linebuf);
+
+	ofile = open_memstream(&file->output, &file->output_size);
+	if (!ofile)
+	{
+		fprintf(stderr, "cannot to create output buffer\n");
+		exit(1);
+	}
+
+	print_table(ofile, file->rowbucket, file->linebuf, &config);
+
+	fclose(ofile);
+
+	free_table(file->rowbucket, file->linebuf);
+	file->rowbucket = NULL;
+	file->linebuf = NULL;
+	file->config = NULL;
+}
+
+static bool
+equal_rows(RowType *row1, RowType *row2, int offset)
+{
+	int		i;
+
+	if (row1->nfields != row2->nfields)
+		return false;
+
+	for (i = offset; i < row1->nfields; i++)
+	{
+		if (strcmp(row1->fields[i], row2->fields[i]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Joins rows of all files to one table. The first row of first file
+ * can be header, then the same first rows of other files are removed,
+ * and the header of source column is "source".
+ */
+static void
+print_union(FILE *ofile, MultiFileType *multi, int nfiles,
+			LinebufType *linebuf, ConfigType *config)
+{
+	RowBucketType *rowbucket = NULL;
+	RowBucketType *last = NULL;
+	RowType	   *first_row = NULL;
+	char	   *first_source = NULL;
+	RowType   **removed;
+	bool	   *removed_multilines;
+	int		i;
+
+	/* the first rows same as first row of first file (possible header) */
+	removed = smalloc(nfiles * sizeof(RowType *), "RowType");
+	removed_multilines = smalloc(nfiles * sizeof(bool), "multilines");
+	memset(removed, 0, nfiles * sizeof(RowType *));
+
+	for (i = 0; i < nfiles; i++)
+	{
+		InputFileType *file = &multi->files[i];
+		RowBucketType *rb;
+
+		if (file->error)
+		{
+			fprintf(stderr, "cannot to open file \"%s\": %s\n", file->path, strerror(file->error));
+			continue;
+		}
+
+		if (!first_row && file->rowbucket->nrows > 0)
+			first_row = file->rowbucket->rows[0];
+		else if (first_row && file->rowbucket->nrows > 0 &&
+				 equal_rows(first_row, file->rowbucket->rows[0], 1))
+		{
+			rb = file->rowbucket;
+
+			/* the row is removed before inference of header */
+			removed[i] = rb->rows[0];
+			removed_multilines[i] = rb->multilines[0];
+			memmove(rb->rows, rb->rows + 1, (rb->nrows - 1) * sizeof(RowType *));
+			memmove(rb->multilines, rb->multilines + 1, (rb->nrows - 1) * sizeof(bool));
+			rb->nrows -= 1;
+		}
+
+		if (last)
+			last->next_bucket = file->rowbucket;
+		else
+			rowbucket = file->rowbucket;
+
+		for (rb = file->rowbucket; rb; rb = rb->next_bucket)
+		{
+			linebuf->processed += rb->nrows;
+			last = rb;
+		}
+	}
+
+	if (!rowbucket)
+	{
+		rowbucket = smalloc(sizeof(RowBucketType), "RowBucketType");
+		memset(rowbucket, 0, sizeof(RowBucketType));
+	}
+
+	if (first_row)
+	{
+		first_source = first_row->fields[0];
+		first_row->fields[0] = "source";
+	}
+
+	reset_columns(rowbucket, linebuf);
+	calculate_widths_parallel(rowbucket, linebuf, config->nthreads);
+	infer_column_types(linebuf);
+
+	/*
+	 * The same first rows of other files are removed, only when the first
+	 * row is header. Else they are returned back as data rows.
+	 */
+	for (i = 0; i < nfiles; i++)
+	{
+		RowBucketType *rb = multi->files[i].rowbucket;
+
+		if (!removed[i])
+			continue;
+
+		if (linebuf->header)
+		{
+			free_row(removed[i]);
+			continue;
+		}
+
+		memmove(rb->rows + 1, rb->rows, rb->nrows * sizeof(RowType *));
+		memmove(rb->multilines + 1, rb->multilines, rb->nrows * sizeof(bool));
+		rb->rows[0] = removed[i];
+		rb->multilines[0] = measure_row(removed[i], linebuf, false, NULL) ||
+							removed_multilines[i];
+		rb->nrows += 1;
+
+		linebuf->processed += 1;
+	}
+
+	free(removed);
+	free(removed_multilines);
+
+	/* the first row is not header, so it shows its file too */
+	if (first_row && !linebuf->header)
+	{
+		infer_column_types(linebuf);
+
+		first_row->fields[0] = first_source;
+
+		if (linebuf->first_column == 0 && linebuf->end_column > 0)
+		{
+			int		width = utf_string_dsplen(first_source, -1);
+
+			if (width > linebuf->widths[0])
+				linebuf->widths[0] = width;
+		}
+	}
+
+	print_table(ofile, rowbucket, linebuf, config);
+}
+
+/*
+ * Processes more files in pool of threads. The tables are printed in
+ * order of files, or the rows of all files are printed as one table.
+ */
+static void
+process_files(char **paths, int nfiles, bool unified, FILE *ofile,
+			  LinebufType *linebuf, ConfigType *config)
+{
+	ConfigType	file_config = *config;
+	MultiFileType multi;
+	PoolType   *pool;
+	int		i;
+
+	/*
+	 * The files are parsed in threads of pool, so every file is parsed
+	 * in one thread. The rows of union are moved between tables, so
+	 * they are not spilled or compressed.
+	 */
+	file_config.nthreads = 1;
+	file_config.pipeline = false;
+	file_config.deferred_widths = false;
+	file_config.dictionary = false;
+
+	if (unified)
+	{
+		file_config.memory_limit = 0;
+		file_config.compress = false;
+	}
+
+	multi.files = smalloc(nfiles * sizeof(InputFileType), "InputFileType");
+	memset(multi.files, 0, nfiles * sizeof(InputFileType));
+	multi.config = &file_config;
+	multi.unified = unified;
+	multi.first_column = linebuf->first_column;
+	multi.end_column = linebuf->end_column;
+
+	for (i = 0; i < nfiles; i++)
+		multi.files[i].path = paths[i];
+
+	pool = pool_start(nfiles, config->nthreads, process_file, &multi);
+
+	for (i = 0; i < nfiles && !unified; i++)
+	{
+		InputFileType *file = &multi.files[i];
+
+		pool_wait(pool, i);
+
+		if (file->error)
+		{
+			fprintf(stderr, "cannot to open file \"%s\": %s\n", file->path, strerror(file->error));
+			continue;
+		}
+
+		fprintf(ofile, "%s==> %s <==\n", i > 0 ? "\n" : "", file->path);
+		fwrite(file->output, 1, file->output_size, ofile);
+
+		free(file->output);
+	}
+
+	pool_finish(pool);
+
+	if (unified)
+		print_union(ofile, &multi, nfiles, linebuf, config);
+
+	free(multi.files);
+}
+
+/*
+ * Stores changed row to result table.
+ */
+static void
+diff_emit(int nfields, char **values, void *arg)
+{
+	DiffResultType *result = (DiffResultType *) arg;
+
+	result->current = append_row(result->current, result->rowbucket, result->linebuf,
+								 nfields, values);
+}
+
+/*
+ * Parses file, and sends its rows to row handler of diff.
+ */
+static void
+diff_parse_file(const char *path, RowHandlerType handler, DiffType *diff, ConfigType *config)
+{
+	LinebufType	linebuf;
+	RowBucketType	rowbucket;
+	InputType	input;
+	FILE	   *ifile;
+	char		separator = config->separator;
+
+	ifile = fopen(path, "r");
+	if (!ifile)
+	{
+		fprintf(stderr, "cannot to open file \"%s\": %m\n", path);
+		exit(1);
+	}
+
+	/* the rows are not measured, only changed rows are measured */
+	init_table(&rowbucket, &linebuf);
+	linebuf.end_column = 0;
+	linebuf.row_handler = handler;
+	linebuf.row_handler_arg = diff;
+
+	input_init(&input, input_reader(ifile, config));
+
+	parse_csv(&input, &rowbucket, &linebuf, config);
+
+	input_close(&input);
+
+	free(linebuf.buffer);
+
+	/* the separator is detected for every file */
+	config->separator = separator;
+}
+
+/*
+ * Compares old and new file by key columns, and stores added, removed
+ * and changed rows to table. The rows of smaller file are hashed, and
+ * the rows of larger file are streamed. When the rows of smaller file
+ * cannot be in memory limit, then the rows are partitioned to temp files.
+ */
+static void
+diff_files(const char *old_path, const char *new_path, const char *keys,
+		   RowBucketType *rowbucket, LinebufType *linebuf, ConfigType *config)
+{
+	DiffResultType result;
+	DiffType   *diff;
+	struct stat old_stat;
+	struct stat new_stat;
+	const char *hashed_path;
+	const char *probed_path;
+	bool		hashed_is_old;
+	long		hashed_size;
+	int			npartitions = 0;
+
+	if (stat(old_path, &old_stat) != 0)
+	{
+		fprintf(stderr, "cannot to open file \"%s\": %m\n", old_path);
+		exit(1);
+	}
+
+	if (stat(new_path, &new_stat) != 0)
+	{
+		fprintf(stderr, "cannot to open file \"%s\": %m\n", new_path);
+		exit(1);
+	}
+
+	hashed_is_old = old_stat.st_size <= new_stat.st_size;
+	hashed_path = hashed_is_old ? old_path : new_path;
+	probed_path = hashed_is_old ? new_path : old_path;
+	hashed_size = hashed_is_old ? old_stat.st_size : new_stat.st_size;
+
+	/* parsed rows need about twice more memory than input */
+	if (config->memory_limit > 0 && hashed_size > config->memory_limit)
+		npartitions = hashed_size * 2 / config->memory_limit + 1;
+
+	result.rowbucket = rowbucket;
+	result.current = rowbucket;
+	result.linebuf = linebuf;
+
+	diff = diff_init(keys, hashed_is_old, npartitions, config->linestyle == 'u',
+					 diff_emit, &result);
+
+	diff_parse_file(hashed_path, diff_build_row, diff, config);
+	diff_parse_file(probed_path, diff_probe_row, diff, config);
+
+	diff_finish(diff);
+
+	free(diff);
+}
+
+/*
+ * Returns size in bytes. The size can have suffix k, M or G.
+ */
+static long
+parse_size(const char *str)
+{
+	char   *endptr;
+	long	result;
+
+	result = strtol(str, &endptr, 10);
+
+	if (*endptr == 'k' || *endptr == 'K')
+		result *= 1024L, endptr++;
+	else if (*endptr == 'M')
+		result *= 1024L * 1024, endptr++;
+	else if (*endptr == 'G')
+		result *= 1024L * 1024 * 1024, endptr++;
+
+	if (*endptr != '\0' || result <= 0)
+	{
+		fprintf(stderr, "invalid size \"%s\"\n", str);
+		exit(1);
+	}
+
+	return result;
+}
+
+static void
+print_help(const char *progname)
+{
+	fprintf(stdout, "%s formats CSV from file or stdin to pretty table.\n\n", progname);
+	fprintf(stdout, "Usage:\n");
+	fprintf(stdout, "  %s [OPTION]... [FILE]...\n\n", progname);
+
+#if defined(HAVE_LIBZ) && defined(HAVE_LIBZSTD)
+	fprintf(stdout, "The input compressed by gzip or zstd is decompressed.\n\n");
+#elif defined(HAVE_LIBZ)
+	fprintf(stdout, "The input compressed by gzip is decompressed.\n\n");
+#elif defined(HAVE_LIBZSTD)
+	fprintf(stdout, "The input compressed by zstd is decompressed.\n\n");
+#endif
+
+	fprintf(stdout, "Options:\n");
+	fprintf(stdout, "  -b, --border=N           border style (0, 1, 2)\n");
+	fprintf(stdout, "  -l, --linestyle=STYLE    line style (ascii, unicode)\n");
+	fprintf(stdout, "  -j, --jobs=N             calculate widths or process more files in N threads (0 = number of CPUs)\n");
+	fprintf(stdout, "  --pipeline               read input and write output in own threads\n");
+	fprintf(stdout, "  -f, --follow             print rows appended to file until it is removed\n");
+	fprintf(stdout, "  -x, --expanded           print every record as block of lines \"column | value\"\n");
+	fprintf(stdout, "                           (the first row is names of columns, when all its fields are text)\n");
+	fprintf(stdout, "  -D, --dictionary         store repeated values of low cardinality columns once\n");
+	fprintf(stdout, "  --memory-limit=SIZE      move rows over SIZE bytes to temp file (suffix k, M, G)\n");
+	fprintf(stdout, "  --compress               keep parsed rows compressed in memory\n");
+	fprintf(stdout, "  --encoding=ENCODING      input encoding (auto, utf8, latin1, cp1250, utf16le, utf16be)\n");
+	fprintf(stdout, "  --invalid-utf8=MODE      replace invalid UTF-8 chars by U+FFFD or escape them (replace, escape)\n");
+	fprintf(stdout, "                           (the input is not transcoded, when encoding is not specified)\n");
+	fprintf(stdout, "  --max-field-size=SIZE    truncate fields longer than SIZE bytes (suffix k, M, G)\n");
+	fprintf(stdout, "  --first-column=N         show table from column N\n");
+	fprintf(stdout, "  --width=N                show only columns, that fit to N chars (auto = terminal width)\n");
+	fprintf(stdout, "  --max-width=N            truncate text columns wider than N chars (auto = 99th percentile)\n");
+	fprintf(stdout, "  --wrap                   wrap fields of reduced columns instead of truncating\n");
+	fprintf(stdout, "  --first-row=N            show rows from row N (header is shown always)\n");
+	fprintf(stdout, "  --row-count=N            show only N rows\n");
+	fprintf(stdout, "  --shape                  only print number of records and fields, and separator\n");
+	fprintf(stdout, "  --describe               print statistics of columns instead of table\n");
+	fprintf(stdout, "  --sort=KEYS              sort rows by columns, KEYS is list like \"3n,-1\"\n");
+	fprintf(stdout, "                           (\"-\" descending order, \"n\" numeric values)\n");
+	fprintf(stdout, "  --limit=K                show only first K sorted rows\n");
+	fprintf(stdout, "  --union                  print rows of all files as one table with source column\n");
+	fprintf(stdout, "  --diff                   print added (+), removed (-) and changed (~) rows of second file\n");
+	fprintf(stdout, "  --key=COLUMNS            key columns of diff, COLUMNS is list like \"1,3\" (default 1)\n");
+	fprintf(stdout, "  --daemon                 hold parsed tables and render them for clients on socket\n");
+	fprintf(stdout, "  --cache-size=SIZE        memory for tables held by daemon (default 1G)\n");
+	fprintf(stdout, "  --socket=PATH            socket of daemon\n");
+	fprintf(stdout, "  --no-daemon              don't use running daemon\n");
+	fprintf(stdout, "  --save-cache=FILE        save parsed table to binary cache file\n");
+	fprintf(stdout, "  --load-cache=FILE        render table from binary cache file instead input\n");
+	fprintf(stdout, "  --help                   show this help, then exit\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE   *ifile = stdin;
+	FILE   *ofile = stdout;
+	InputType	input;
+	ReaderType *reader;
+	DescribeType *describe = NULL;
+	ExpandedType *expanded = NULL;
+	FollowType *follow = NULL;
+	bool		run_daemon = false;
+	bool		use_daemon = true;
+	char	   *socket_path = NULL;
+	long		cache_size = 1024L * 1024 * 1024;
+	bool		unified = false;
+	bool		diff = false;
+	char	   *diff_keys = "1";
+	char	  **paths = NULL;
+	int			npaths = 0;
+	int			i;
+	SorterType *sorter = NULL;
+
+	LinebufType	linebuf;
+	RowBucketType	rowbucket;
+	ConfigType		config;
+
+	int		opt;
+
+	static struct option long_options[] =
+	{
+		{"border", required_argument, 0, 'b'},
+		{"linestyle", required_argument, 0, 'l'},
+		{"jobs", required_argument, 0, 'j'},
+		{"dictionary", no_argument, 0, 'D'},
+		{"pipeline", no_argument, 0, 2},
+		{"save-cache", required_argument, 0, 3},
+		{"load-cache", required_argument, 0, 4},
+		{"max-field-size", required_argument, 0, 5},
+		{"memory-limit", required_argument, 0, 6},
+		{"compress", no_argument, 0, 7},
+		{"shape", no_argument, 0, 8},
+		{"describe", no_argument, 0, 9},
+		{"sort", required_argument, 0, 10},
+		{"limit", required_argument, 0, 11},
+		{"invalid-utf8", required_argument, 0, 12},
+		{"encoding", required_argument, 0, 13},
+		{"first-column", required_argument, 0, 14},
+		{"width", required_argument, 0, 15},
+		{"expanded", no_argument, 0, 'x'},
+		{"follow", no_argument, 0, 'f'},
+		{"max-width", required_argument, 0, 16},
+		{"wrap", no_argument, 0, 17},
+		{"first-row", required_argument, 0, 18},
+		{"row-count", required_argument, 0, 19},
+		{"daemon", no_argument, 0, 20},
+		{"cache-size", required_argument, 0, 21},
+		{"socket", required_argument, 0, 22},
+		{"no-daemon", no_argument, 0, 23},
+		{"union", no_argument, 0, 24},
+		{"diff", no_argument, 0, 25},
+		{"key", required_argument, 0, 26},
+		{"help", no_argument, 0, 1},
+		{0, 0, 0, 0}
+	};
+
+	setlocale(LC_ALL, "");
+
+	config.separator = -1;
+	config.linestyle = 'a';
+	config.border = 0;
+	config.nthreads = 1;
+	config.pipeline = false;
+	config.save_cache = NULL;
+	config.load_cache = NULL;
+	config.max_field_size = 0;
+	config.dictionary = false;
+	config.memory_limit = 0;
+	config.compress = false;
+	config.shape = false;
+	config.describe = false;
+	config.sort = NULL;
+	config.limit = 0;
+	config.invalid_utf8 = 0;
+	config.encoding = ENCODING_AUTO;
+	config.first_column = 0;
+	config.width = 0;
+	config.expanded = false;
+	config.follow = false;
+	config.max_width = 0;
+	config.wrap = false;
+	config.first_row = 0;
+	config.nrows = 0;
+
+	while ((opt = getopt_long(argc, argv, "b:l:j:Dxf", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'b':
+				config.border = atoi(optarg);
+				if (config.border < 0 || config.border > 2)
+				{
+					fprintf(stderr, "border should be 0, 1 or 2\n");
+					exit(1);
+				}
+				break;
+			case 'l':
+				if (strcmp(optarg, "ascii") == 0 || strcmp(optarg, "a") == 0)
+					config.linestyle = 'a';
+				else if (strcmp(optarg, "unicode") == 0 || strcmp(optarg, "u") == 0)
+					config.linestyle = 'u';
+				else
+				{
+					fprintf(stderr, "linestyle should be \"ascii\" or \"unicode\"\n");
+					exit(1);
+				}
+				break;
+			case 'j':
+				config.nthreads = atoi(optarg);
+				if (config.nthreads == 0)
+					config.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+				if (config.nthreads < 1)
+				{
+					fprintf(stderr, "number of jobs should be positive number\n");
+					exit(1);
+				}
+				break;
+			case 'D':
+				config.dictionary = true;
+				break;
+			case 'x':
+				config.expanded = true;
+				break;
+			case 'f':
+				config.follow = true;
+				break;
+			case 2:
+				config.pipeline = true;
+				break;
+			case 3:
+				config.save_cache = optarg;
+				break;
+			case 4:
+				config.load_cache = optarg;
+				break;
+			case 5:
+				config.max_field_size = parse_size(optarg);
+				break;
+			case 6:
+				config.memory_limit = parse_size(optarg);
+				break;
+			case 7:
+				config.compress = true;
+				break;
+			case 8:
+				config.shape = true;
+				break;
+			case 9:
+				config.describe = true;
+				break;
+			case 10:
+				config.sort = optarg;
+				break;
+			case 11:
+				config.limit = atoi(optarg);
+				if (config.limit < 1)
+				{
+					fprintf(stderr, "limit should be positive number\n");
+					exit(1);
+				}
+				break;
+			case 12:
+				if (strcmp(optarg, "replace") == 0)
+					config.invalid_utf8 = INVALID_UTF8_REPLACE;
+				else if (strcmp(optarg, "escape") == 0)
+					config.invalid_utf8 = INVALID_UTF8_ESCAPE;
+				else
+				{
+					fprintf(stderr, "invalid-utf8 should be \"replace\" or \"escape\"\n");
+					exit(1);
+				}
+				break;
+			case 13:
+				config.encoding = encoding_from_name(optarg);
+				if (config.encoding == -1)
+				{
+					fprintf(stderr, "unknown encoding \"%s\"\n", optarg);
+					exit(1);
+				}
+				break;
+			case 14:
+				config.first_column = atoi(optarg) - 1;
+				if (config.first_column < 0 || config.first_column >= 1024)
+				{
+					fprintf(stderr, "first column should be number between 1 and 1024\n");
+					exit(1);
+				}
+				if (config.width == 0)
+					config.width = -1;
+				break;
+			case 15:
+				config.width = strcmp(optarg, "auto") == 0 ? -1 : atoi(optarg);
+				if (config.width == 0 || config.width < -1)
+				{
+					fprintf(stderr, "width should be positive number or \"auto\"\n");
+					exit(1);
+				}
+				break;
+			case 16:
+				config.max_width = strcmp(optarg, "auto") == 0 ? -1 : atoi(optarg);
+				if (config.max_width == 0 || config.max_width < -1)
+				{
+					fprintf(stderr, "max width should be positive number or \"auto\"\n");
+					exit(1);
+				}
+				break;
+			case 17:
+				config.wrap = true;
+				break;
+			case 18:
+				config.first_row = atol(optarg) - 1;
+				if (config.first_row < 0)
+				{
+					fprintf(stderr, "first row should be positive number\n");
+					exit(1);
+				}
+				break;
+			case 19:
+				config.nrows = atol(optarg);
+				if (config.nrows <= 0)
+				{
+					fprintf(stderr, "row count should be positive number\n");
+					exit(1);
+				}
+				break;
+			case 20:
+				run_daemon = true;
+				break;
+			case 21:
+				cache_size = parse_size(optarg);
+				break;
+			case 22:
+				socket_path = optarg;
+				break;
+			case 23:
+				use_daemon = false;
+				break;
+			case 24:
+				unified = true;
+				break;
+			case 25:
+				diff = true;
+				break;
+			case 26:
+				diff_keys = optarg;
+				break;
+			case 1:
+				print_help(argv[0]);
+				exit(0);
+			default:
+				fprintf(stderr, "Try %s --help\n", argv[0]);
+				exit(1);
+		}
+	}
+
+	/*
+	 * The spilled or compressed rows should have known widths, so the
+	 * widths cannot be calculated after parsing when memory is limited.
+	 */
+	config.deferred_widths = config.nthreads > 1 &&
+							 config.memory_limit == 0 && !config.compress &&
+							 !config.describe && !config.sort && !config.expanded &&
+							 !config.follow;
+
+	/*
+	 * Only limited number of rows is hold in memory in top rows mode,
+	 * and only these rows are measured after parsing.
+	 */
+	if (config.limit > 0)
+	{
+		if (!config.sort)
+		{
+			fprintf(stderr, "limit can be used only with sort\n");
+			exit(1);
+		}
+
+		config.deferred_widths = true;
+		config.memory_limit = 0;
+		config.compress = false;
+	}
+
+	if (config.describe && (config.save_cache || config.load_cache))
+	{
+		fprintf(stderr, "cannot to use cache file in describe mode\n");
+		exit(1);
+	}
+
+	/*
+	 * In follow mode the rows are printed immediately, so they cannot be
+	 * sorted or described. The output is flushed when input is waiting,
+	 * so the output is written without pipeline.
+	 */
+	if (config.follow)
+	{
+		if (config.sort || config.describe || config.save_cache || config.load_cache)
+		{
+			fprintf(stderr, "follow mode cannot be used with sort, describe or cache\n");
+			exit(1);
+		}
+
+		config.pipeline = false;
+	}
+
+	if (config.sort && (config.describe || config.load_cache))
+	{
+		fprintf(stderr, "cannot to sort rows in describe mode or from cache file\n");
+		exit(1);
+	}
+
+	/* invalid chars are replaced or escaped, so input should not be transcoded */
+	if (config.invalid_utf8 && config.encoding == ENCODING_AUTO)
+		config.encoding = ENCODING_UTF8;
+
+	/* the patterns, that are not expanded by shell, are expanded here */
+	paths = smalloc((argc - optind + 1) * sizeof(char *), "paths");
+
+	for (i = optind; i < argc; i++)
+	{
+		glob_t		g;
+		size_t		j;
+
+		if (!strpbrk(argv[i], "*?[") || access(argv[i], F_OK) == 0)
+		{
+			paths[npaths++] = argv[i];
+			continue;
+		}
+
+		if (glob(argv[i], 0, NULL, &g) != 0)
+		{
+			fprintf(stderr, "no file matches pattern \"%s\"\n", argv[i]);
+			exit(1);
+		}
+
+		paths = realloc(paths, (npaths + g.gl_pathc + argc - i) * sizeof(char *));
+		if (!paths)
+			exit(1);
+
+		/* the list of paths is not released */
+		for (j = 0; j < g.gl_pathc; j++)
+			paths[npaths++] = g.gl_pathv[j];
+	}
+
+	/*
+	 * In diff mode the rows of files are not stored, only changed rows
+	 * are stored and measured.
+	 */
+	if (diff)
+	{
+		if (npaths != 2)
+		{
+			fprintf(stderr, "diff mode requires two input files\n");
+			exit(1);
+		}
+
+		if (config.shape || config.describe || config.sort || config.expanded ||
+			config.follow || config.save_cache || config.load_cache || unified || run_daemon)
+		{
+			fprintf(stderr, "diff mode cannot be used with shape, describe, sort, expanded, follow, union or cache\n");
+			exit(1);
+		}
+
+		config.dictionary = false;
+		config.deferred_widths = false;
+	}
+	else if (npaths > 1 || unified)
+	{
+		if (config.shape || config.describe || config.sort || config.expanded ||
+			config.follow || config.save_cache || config.load_cache || run_daemon)
+		{
+			fprintf(stderr, "more input files can be printed only as tables\n");
+			exit(1);
+		}
+	}
+	else if (npaths == 1)
+	{
+		ifile = fopen(paths[0], "r");
+		if (!ifile)
+		{
+			fprintf(stderr, "cannot to open file \"%s\": %m\n", paths[0]);
+			exit(1);
+		}
+	}
+
+	/* the viewport has width of terminal, or the table is not limited */
+	if (config.width == -1)
+	{
+		struct winsize size;
+
+		config.width = 0;
+
+		if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+			config.width = size.ws_col;
+		else if (getenv("COLUMNS"))
+			config.width = atoi(getenv("COLUMNS"));
+
+		if (config.width < 0)
+			config.width = 0;
+	}
+
+	if (!socket_path)
+		socket_path = daemon_socket_path();
+
+	/* the daemon parses tables with current options */
+	if (run_daemon)
+	{
+		config.pipeline = false;
+
+		daemon_run(socket_path, cache_size,
+				   load_daemon_table, render_daemon_table, free_table, &config);
+	}
+
+	/*
+	 * The table of file can be rendered by running daemon, when only
+	 * options of parsing and rendering are used. The options of parsing
+	 * are sent to daemon, so the output is same like output of local
+	 * processing. Without daemon the file is processed here.
+	 */
+	if (use_daemon && npaths == 1 && !unified &&
+		!config.shape && !config.describe && !config.sort && !config.expanded &&
+		!config.follow && !config.save_cache && !config.load_cache &&
+		!config.wrap)
+	{
+		RenderRequestType request;
+
+		memset(&request, 0, sizeof(request));
+
+		if (realpath(paths[0], request.path))
+		{
+			request.options.max_field_size = config.max_field_size;
+			request.options.encoding = config.encoding;
+			request.options.invalid_utf8 = config.invalid_utf8;
+
+			request.border = config.border;
+			request.linestyle = config.linestyle;
+			request.first_column = config.first_column;
+			request.width = config.width;
+			request.max_width = config.max_width;
+			request.first_row = config.first_row;
+			request.nrows = config.nrows;
+
+			if (daemon_render(socket_path, &request, stdout))
+				return 0;
+		}
+	}
+
+	/* in shape mode the fields are not stored, and nothing is formatted */
+	if (config.shape)
+	{
+		ShapeType	shape;
+
+		reader = decompress_reader(file_reader(ifile), config.nthreads);
+		reader = encoding_reader(reader, config.encoding);
+
+		if (config.pipeline)
+			reader = pipeline_reader(reader);
+
+		input_init(&input, reader);
+
+		count_shape(&input, config.separator, &shape);
+
+		input_close(&input);
+
+		fprintf(stdout, "records: %ld\n", shape.records);
+		fprintf(stdout, "min fields: %d\n", shape.min_fields);
+		fprintf(stdout, "max fields: %d\n", shape.max_fields);
+
+		if (shape.separator != -1)
+			fprintf(stdout, "separator: '%c'\n", shape.separator);
+		else
+			fprintf(stdout, "separator: none\n");
+
+		return 0;
+	}
+
+	init_table(&rowbucket, &linebuf);
+
+	if (config.max_width == -1)
+		init_width_histograms(&linebuf);
+
+	/*
+	 * Only columns of viewport are measured. Every displayed column has
+	 * at least one char with separator, so the viewport cannot to have
+	 * more columns. The cache has to hold widths of all columns.
+	 */
+	if (!config.save_cache)
+	{
+		linebuf.first_column = config.first_column;
+
+		if (config.width > 0)
+		{
+			long	end_column = config.first_column + 1 +
+								 (config.border == 0 ? config.width : config.width / 3);
+
+			if (end_column < 1024)
+				linebuf.end_column = end_column;
+		}
+	}
+
+	if (config.dictionary)
+	{
+		linebuf.dictionaries = smalloc(1024 * sizeof(DictionaryType), "DictionaryType");
+		memset(linebuf.dictionaries, 0, 1024 * sizeof(DictionaryType));
+	}
+
+	if (diff)
+	{
+		if (config.pipeline)
+			ofile = pipeline_writer(stdout);
+
+		diff_files(paths[0], paths[1], diff_keys, &rowbucket, &linebuf, &config);
+
+		infer_column_types(&linebuf);
+
+		print_table(ofile, &rowbucket, &linebuf, &config);
+
+		if (config.pipeline)
+			fclose(ofile);
+
+		return 0;
+	}
+
+	/* the files are processed in threads, and printed in order */
+	if (npaths > 1 || unified)
+	{
+		/* the output of all files is written by one buffer */
+		setvbuf(stdout, NULL, _IOFBF, 1024 * 1024);
+
+		process_files(paths, npaths, unified, ofile, &linebuf, &config);
+
+		return 0;
+	}
+
+	/* in describe mode the rows are not stored */
+	if (config.describe)
+	{
+		describe = describe_init();
+		linebuf.row_handler = describe_row;
+		linebuf.row_handler_arg = describe;
+	}
+
+	/*
+	 * In expanded mode the rows are printed immediately, and they are not
+	 * measured. The sorted rows are printed after sorting.
+	 */
+	if (config.expanded && !config.describe)
+	{
+		if (config.pipeline)
+			ofile = pipeline_writer(stdout);
+
+		expanded = expanded_init(ofile, &config);
+
+		if (!config.sort && !config.load_cache && !config.save_cache)
+		{
+			linebuf.end_column = 0;
+			linebuf.row_handler = expanded_row;
+			linebuf.row_handler_arg = expanded;
+		}
+	}
+
+	if (config.follow && !expanded)
+	{
+		follow = smalloc(sizeof(FollowType), "FollowType");
+		memset(follow, 0, sizeof(FollowType));
+
+		follow->ofile = ofile;
+		follow->linebuf = &linebuf;
+		follow->config = &config;
+
+		linebuf.row_handler = follow_row;
+		linebuf.row_handler_arg = follow;
+	}
+
+	/* in sort mode the rows are stored after sorting */
+	if (config.sort)
+	{
+		sorter = sorter_init(config.sort, config.memory_limit, config.limit);
+		linebuf.row_handler = sorter_add_row;
+		linebuf.row_handler_arg = sorter;
+	}
+
+	if (config.pipeline && !expanded)
+		ofile = pipeline_writer(stdout);
+
+	if (config.load_cache)
+		load_cache(config.load_cache, &rowbucket, &linebuf);
+	else
+	{
+		/* the growing file is read as UTF-8 text */
+		if (config.follow)
+		{
+			reader = follow_reader(ifile, npaths == 1 ? paths[0] : NULL);
+
+			if (config.invalid_utf8)
+				reader = validate_reader(reader, config.invalid_utf8);
+		}
+		else
+			reader = input_reader(ifile, &config);
+
+		input_init(&input, reader);
+
+		parse_csv(&input, &rowbucket, &linebuf, &config);
+
+		input_close(&input);
+
+		if (config.limit > 0)
+			measure_top_rows(sorter, &rowbucket, &linebuf, &config);
+		else
+		{
+			if (config.deferred_widths)
+				calculate_widths_parallel(&rowbucket, &linebuf, config.nthreads);
+
+			infer_column_types(&linebuf);
+
+			if (sorter)
+				sorter_finish(sorter, &rowbucket, &linebuf, &config);
+		}
+	}
+
+	if (config.save_cache)
+		save_cache(config.save_cache, &rowbucket, &linebuf);
+
+	linebuf.first_column = config.first_column;
+
+	if (config.describe)
+		print_describe(ofile, describe, &linebuf, &config);
+	else if (expanded)
+		print_expanded(expanded, &rowbucket);
+	else if (follow)
+		follow_finish(follow);
+	else
+		print_table(ofile, &rowbucket, &linebuf, &config);
+
+	if (config.pipeline)
+		fclose(ofile);
 
-	fprintf(ofile, "(%d rows)\n", linebuf.processed - (printed_headline ? 1 : 0));
+	return 0;
 }
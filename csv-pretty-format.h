@@ -0,0 +1,187 @@
+/*-------------------------------------------------------------------------
+ *
+ * csv-pretty-format.h
+ *	  types used by more modules
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  csv-pretty-format.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_FORMAT_H
+#define CSV_PRETTY_FORMAT_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifndef offsetof
+#define offsetof(type, field)	((long) &((type *)0)->field)
+#endif							/* offsetof */
+
+/*
+ * Types of fields detected by classify_field
+ */
+#define FIELD_TYPE_EMPTY		0
+#define FIELD_TYPE_INT			1
+#define FIELD_TYPE_FLOAT		2
+#define FIELD_TYPE_DATE			3
+#define FIELD_TYPE_BOOL			4
+#define FIELD_TYPE_TEXT			5
+
+#define FIELD_TYPE_COUNT		6
+
+#define FIELD_TYPE_IS_NUMERIC(t)	((t) == FIELD_TYPE_INT || (t) == FIELD_TYPE_FLOAT)
+
+/*
+ * Histogram of widths of fields of column. Widths less than 32 have
+ * own bucket, longer widths have four buckets per power of two.
+ */
+#define WIDTH_HISTOGRAM_SIZE	136
+#define WIDTH_HISTOGRAMS_SIZE	(1024 * WIDTH_HISTOGRAM_SIZE * sizeof(int))
+
+/*
+ * Index of lines of multiline field, so the lines can be printed
+ * without repeated searching of line ends and calculating of widths.
+ */
+typedef struct
+{
+	int			offset;			/* start of line in field (in bytes) */
+	int			size;			/* size of line (in bytes) */
+	int			width;			/* display width of line */
+} FieldLineType;
+
+typedef struct
+{
+	int			nlines;
+	bool		shared;			/* owned by dictionary entry */
+	FieldLineType lines[];
+} FieldLinesType;
+
+/*
+ * Properties of field used for calculating of column's statistics
+ */
+typedef struct
+{
+	int			width;
+	bool		multiline;
+	char		type;
+	int			intwidth;		/* width of integer part of number */
+	int			fracwidth;		/* width of fraction part of number */
+	FieldLinesType *lines;		/* index of lines of multiline field */
+} FieldInfoType;
+
+typedef struct
+{
+	int		nfields;
+	FieldLinesType **lines;		/* indexes of multiline fields or NULL */
+	int	   *widths;				/* display widths of fields from cache or NULL */
+	bool   *numeric;			/* fields aligned as numbers, only with widths */
+	char   *fields[];
+} RowType;
+
+typedef struct _rowBucketType
+{
+	int			nrows;
+	RowType	   *rows[1000];
+	bool		multilines[1000];
+	bool		allocated;
+	long		memory;			/* allocated memory of rows */
+	FILE	   *spill_file;		/* file with rows of spilled bucket or NULL */
+	long		spill_offset;
+	size_t		spill_size;
+	bool		compressed;		/* stored rows are compressed */
+	char	   *data;			/* compressed rows in memory or NULL */
+	size_t		data_size;
+	size_t		raw_size;		/* size of serialized rows before compression */
+	struct _rowBucketType *next_bucket;
+} RowBucketType;
+
+/*
+ * Handler of parsed rows. When it is used, the rows are not stored
+ * in row buckets, and the handler is owner of row. When the growing
+ * file is read from begin again, the handler is called with NULL row.
+ */
+typedef void (*RowHandlerType) (RowType *row, bool multiline, void *arg);
+
+typedef struct
+{
+	char	   *buffer;
+	int			processed;
+	int			used;
+	int			size;
+	int			nfields;
+	int			maxfields;
+	int			starts[1024];		/* start of first char of column (in bytes) */
+	int			sizes[1024];		/* lenght of chars of column (in bytes) */
+	long		skipped[1024];		/* not stored bytes of too long field */
+	int			widths[1024];		/* display width of column */
+	int			first_widths[1024];		/* display width of fields of first row */
+	int		  (*width_histograms)[WIDTH_HISTOGRAM_SIZE];	/* without first row, only for auto max width */
+	bool		limited[1024];			/* width of column was reduced by max width */
+	bool		has_limited;			/* some column was reduced */
+	char		multilines[1024];		/* true, when column has some multiline chars */
+	int			intwidths[1024];		/* width of integer part of numbers */
+	int			fracwidths[1024];		/* width of decimal point and fraction part */
+	int			types[1024][FIELD_TYPE_COUNT];	/* number of fields of types (without first row) */
+	char		first_types[1024];		/* types of fields of first row */
+	char		column_types[1024];		/* inferred type of column */
+	bool		header;					/* first row is header */
+	struct _DictionaryType *dictionaries;	/* dictionaries of columns or NULL */
+	long		row_memory;				/* allocated memory of rows in memory */
+	FILE	   *spill_file;
+	int			first_column;			/* first measured and displayed column */
+	int			end_column;				/* columns from here are not measured and displayed */
+	RowHandlerType row_handler;		/* consumer of parsed rows or NULL */
+	void	   *row_handler_arg;
+} LinebufType;
+
+typedef struct
+{
+	int			border;
+	char		linestyle;
+	char		separator;
+	int			nthreads;		/* > 1 when widths are calculated after parsing */
+	bool		pipeline;		/* reading and writing in own threads */
+	char	   *save_cache;		/* path of columnar cache file */
+	char	   *load_cache;
+	long		max_field_size;	/* bytes over this limit are not stored */
+	bool		dictionary;		/* intern values of low cardinality columns */
+	long		memory_limit;	/* rows over this limit are spilled to disk */
+	bool		compress;		/* full buckets are compressed in memory */
+	bool		shape;			/* only count records and fields */
+	bool		describe;		/* print statistics of columns instead table */
+	bool		expanded;		/* print records as blocks of columns */
+	bool		follow;			/* print rows appended to growing file */
+	long		first_row;		/* number of skipped rows (without header) */
+	long		nrows;			/* number of displayed rows or 0 (all) */
+	char	   *sort;			/* sort keys or NULL */
+	int			limit;			/* number of displayed sorted rows or 0 */
+	char		invalid_utf8;	/* repair of invalid UTF-8 or 0 */
+	int			encoding;		/* input encoding, ENCODING_AUTO is detection */
+	int			first_column;	/* first displayed column (from zero) */
+	int			width;			/* width of viewport or 0 (full table) */
+	int			max_width;		/* max width of text column, -1 is auto, or 0 */
+	bool		wrap;			/* too long fields are wrapped, not truncated */
+	bool		deferred_widths;	/* widths are calculated after parsing */
+} ConfigType;
+
+/*
+ * The fatal error ends process. The thread of daemon sets error_context,
+ * and then the fatal error of one request jumps there, so the daemon
+ * can serve other requests.
+ */
+extern __thread jmp_buf *error_context;
+
+extern void fatal_error(void) __attribute__ ((noreturn));
+extern void *smalloc(int size, char *debugstr);
+extern RowBucketType *add_rowbucket(RowBucketType *current);
+extern RowBucketType *store_row(RowBucketType *current, RowBucketType *rowbucket,
+								LinebufType *linebuf, ConfigType *config,
+								RowType *row, bool multiline, long row_size);
+extern int classify_field(const char *str);
+
+#endif
@@ -0,0 +1,645 @@
+/*-------------------------------------------------------------------------
+ *
+ * daemon.c
+ *	  render server with cache of parsed tables
+ *
+ * The daemon listens on unix socket, and it holds parsed tables in
+ * memory. The table is identified by path, options of parsing,
+ * modification time and size of file, so the changed file is parsed
+ * again. When the tables need more memory than cache size, then the
+ * least recently used tables are released.
+ *
+ * The request is one line:
+ *
+ *   RENDER max_field_size encoding invalid_utf8 border linestyle first_column
+ *          width max_width first_row nrows path
+ *
+ * The invalid_utf8 is number of mode char (0 is no validation).
+ *
+ * The response starts by line "OK" followed by rendered table and by
+ * end mark, or by line "ERROR message". The client without end mark
+ * knows, that the output is incomplete. The file, that cannot be read
+ * or parsed, is answered by error, and the client processes it self.
+ * Every connection is processed by own thread, so
+ * slow client doesn't block other clients. The client, that doesn't send
+ * request in DAEMON_REQUEST_TIMEOUT, is disconnected. The tables in use
+ * are not released until their rendering is finished.
+ *
+ * The socket is created in private directory of user with umask 077,
+ * and the client talks only with daemon of same user (checked by owner
+ * of socket and by credentials of peer), so other users cannot to read
+ * tables, or to inject output.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  daemon.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "input.h"
+
+/* time for sending request by client (in seconds) */
+#define DAEMON_REQUEST_TIMEOUT		10
+
+/* the end of rendered table, zero byte is not in rendered text */
+#define DAEMON_END_MARK				"\0END\n"
+#define DAEMON_END_MARK_SIZE		5
+
+typedef struct
+{
+	CachedTableType *first;
+	CachedTableType *last;
+	long		memory;
+	long		cache_size;
+	TableFreeType free_table;
+	pthread_mutex_t lock;		/* protects list, memory and refcounts */
+} TableCacheType;
+
+typedef struct
+{
+	TableCacheType cache;
+	TableLoaderType loader;
+	TableRendererType renderer;
+	void	   *arg;
+} DaemonType;
+
+typedef struct
+{
+	int			fd;
+	DaemonType *daemon;
+} ConnectionType;
+
+/*
+ * Returns default path of socket. It is in private directory of user,
+ * the directory in /tmp is created by daemon.
+ */
+char *
+daemon_socket_path(void)
+{
+	static char path[PATH_MAX];
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if (dir && *dir)
+		snprintf(path, sizeof(path), "%s/csv-pretty-format.sock", dir);
+	else
+		snprintf(path, sizeof(path), "/tmp/csv-pretty-format-%d/socket", (int) getuid());
+
+	return path;
+}
+
+/*
+ * Returns true, when the path is socket owned by current user.
+ */
+static bool
+is_own_socket(const char *socket_path)
+{
+	struct stat st;
+
+	return lstat(socket_path, &st) == 0 &&
+		   S_ISSOCK(st.st_mode) && st.st_uid == getuid();
+}
+
+/*
+ * Returns true, when the process on other side of connection runs
+ * under current user.
+ */
+static bool
+is_own_peer(int fd)
+{
+	struct ucred cred;
+	socklen_t	len = sizeof(cred);
+
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+		   len == sizeof(cred) && cred.uid == getuid();
+}
+
+static int
+connect_socket(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	int		fd;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Sends request to daemon, and writes rendered table to ofile. Returns
+ * false, when daemon is not running, or when it cannot to render table.
+ * Then nothing is written. The end mark is held back, and when it is
+ * missing, then the output is incomplete, and it is fatal error.
+ */
+bool
+daemon_render(const char *socket_path, RenderRequestType *request, FILE *ofile)
+{
+	FILE   *f;
+	char	status[256];
+	char	buf[INPUT_BLOCK_SIZE];
+	size_t	held = 0;
+	size_t	n;
+	int		fd;
+
+	/* the socket created by other user is not used */
+	if (!is_own_socket(socket_path))
+		return false;
+
+	fd = connect_socket(socket_path);
+	if (fd == -1)
+		return false;
+
+	if (!is_own_peer(fd))
+	{
+		close(fd);
+		return false;
+	}
+
+	if (dprintf(fd, "RENDER %ld %d %d %d %c %d %d %d %ld %ld %s\n",
+				request->options.max_field_size, request->options.encoding,
+				(int) request->options.invalid_utf8,
+				request->border, request->linestyle,
+				request->first_column, request->width, request->max_width,
+				request->first_row, request->nrows,
+				request->path) < 0 ||
+		!(f = fdopen(fd, "r")))
+	{
+		close(fd);
+		return false;
+	}
+
+	if (!fgets(status, sizeof(status), f) || strcmp(status, "OK\n") != 0)
+	{
+		fclose(f);
+		return false;
+	}
+
+	while ((n = fread(buf + held, 1, sizeof(buf) - held, f)) > 0)
+	{
+		held += n;
+
+		if (held > DAEMON_END_MARK_SIZE)
+		{
+			fwrite(buf, 1, held - DAEMON_END_MARK_SIZE, ofile);
+			memmove(buf, buf + held - DAEMON_END_MARK_SIZE, DAEMON_END_MARK_SIZE);
+			held = DAEMON_END_MARK_SIZE;
+		}
+	}
+
+	fclose(f);
+
+	if (held != DAEMON_END_MARK_SIZE ||
+		memcmp(buf, DAEMON_END_MARK, DAEMON_END_MARK_SIZE) != 0)
+	{
+		fflush(ofile);
+		fprintf(stderr, "daemon did not finish output, the table is incomplete\n");
+		exit(1);
+	}
+
+	return true;
+}
+
+static void
+unlink_table(TableCacheType *cache, CachedTableType *table)
+{
+	if (table->prev)
+		table->prev->next = table->next;
+	else
+		cache->first = table->next;
+
+	if (table->next)
+		table->next->prev = table->prev;
+	else
+		cache->last = table->prev;
+
+	table->prev = NULL;
+	table->next = NULL;
+}
+
+static void
+push_table(TableCacheType *cache, CachedTableType *table)
+{
+	table->prev = NULL;
+	table->next = cache->first;
+
+	if (cache->first)
+		cache->first->prev = table;
+	else
+		cache->last = table;
+
+	cache->first = table;
+}
+
+static void
+destroy_table(TableCacheType *cache, CachedTableType *table)
+{
+	cache->free_table(table->rowbucket, table->linebuf);
+
+	free(table->path);
+	free(table);
+}
+
+/*
+ * Removes table from cache. The table is destroyed, when it is not
+ * used by some thread, else it is destroyed by last thread.
+ */
+static void
+evict_table(TableCacheType *cache, CachedTableType *table)
+{
+	unlink_table(cache, table);
+	cache->memory -= table->memory;
+
+	table->evicted = true;
+
+	if (table->refcount == 0)
+		destroy_table(cache, table);
+}
+
+static void
+release_table(TableCacheType *cache, CachedTableType *table)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	table->refcount -= 1;
+
+	if (table->evicted && table->refcount == 0)
+		destroy_table(cache, table);
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Returns cached table of same file parsed with same options. The
+ * changed table is evicted. The cache should be locked.
+ */
+static CachedTableType *
+find_table(TableCacheType *cache, const char *path, const ParseOptionsType *options,
+		   struct stat *st)
+{
+	CachedTableType *table;
+
+	for (table = cache->first; table; table = table->next)
+	{
+		if (strcmp(table->path, path) == 0 &&
+			table->options.max_field_size == options->max_field_size &&
+			table->options.encoding == options->encoding &&
+			table->options.invalid_utf8 == options->invalid_utf8)
+			break;
+	}
+
+	if (table &&
+		(table->mtime != st->st_mtim.tv_sec ||
+		 table->mtime_nsec != st->st_mtim.tv_nsec ||
+		 table->size != st->st_size))
+	{
+		/* the file was changed */
+		evict_table(cache, table);
+		table = NULL;
+	}
+
+	return table;
+}
+
+/*
+ * Returns table of file - from cache, or parsed now. The returned table
+ * is moved to start of LRU list, and the least recently used tables are
+ * evicted, when the cache is full. The file is parsed without lock, so
+ * other tables can be rendered meanwhile. Returns NULL, when the file
+ * cannot be read or parsed. The returned table should be released by release_table.
+ */
+static CachedTableType *
+get_table(TableCacheType *cache, const char *path, const ParseOptionsType *options,
+		  TableLoaderType loader, void *arg)
+{
+	CachedTableType *table;
+	CachedTableType *found;
+	struct stat st;
+
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+		return NULL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	table = find_table(cache, path, options, &st);
+	if (table)
+	{
+		unlink_table(cache, table);
+		push_table(cache, table);
+		table->refcount += 1;
+
+		pthread_mutex_unlock(&cache->lock);
+
+		return table;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	table = smalloc(sizeof(CachedTableType), "CachedTableType");
+	memset(table, 0, sizeof(CachedTableType));
+
+	if (!loader(path, options, table, arg))
+	{
+		free(table);
+		return NULL;
+	}
+
+	table->path = smalloc(strlen(path) + 1, "path");
+	strcpy(table->path, path);
+	table->options = *options;
+	table->mtime = st.st_mtim.tv_sec;
+	table->mtime_nsec = st.st_mtim.tv_nsec;
+	table->size = st.st_size;
+	table->refcount = 1;
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* the same table can be parsed by other thread meanwhile */
+	found = find_table(cache, path, options, &st);
+	if (found)
+	{
+		unlink_table(cache, found);
+		push_table(cache, found);
+		found->refcount += 1;
+
+		pthread_mutex_unlock(&cache->lock);
+
+		destroy_table(cache, table);
+
+		return found;
+	}
+
+	push_table(cache, table);
+	cache->memory += table->memory;
+
+	/* the new table is evicted last */
+	while (cache->memory > cache->cache_size && cache->last != table)
+		evict_table(cache, cache->last);
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return table;
+}
+
+static void *
+process_request(void *arg)
+{
+	ConnectionType *conn = (ConnectionType *) arg;
+	DaemonType *daemon = conn->daemon;
+	RenderRequestType request;
+	CachedTableType *table;
+	struct timeval timeout;
+	FILE	   *f;
+	FILE	   *ofile;
+	char		line[PATH_MAX + 256];
+	int			pathpos = 0;
+	int			invalid_utf8;
+	size_t		len;
+
+	/* idle client cannot to hold thread */
+	timeout.tv_sec = DAEMON_REQUEST_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	f = fdopen(conn->fd, "r");
+	if (!f)
+	{
+		close(conn->fd);
+		free(conn);
+		return NULL;
+	}
+
+	ofile = fdopen(dup(conn->fd), "w");
+	free(conn);
+
+	if (!ofile)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	if (!fgets(line, sizeof(line), f))
+		goto done;
+
+	len = strlen(line);
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+
+	memset(&request, 0, sizeof(request));
+
+	if (sscanf(line, "RENDER %ld %d %d %d %c %d %d %d %ld %ld %n",
+			   &request.options.max_field_size, &request.options.encoding,
+			   &invalid_utf8, &request.border, &request.linestyle,
+			   &request.first_column, &request.width, &request.max_width,
+			   &request.first_row, &request.nrows, &pathpos) != 10 ||
+		pathpos == 0 || strlen(line + pathpos) >= sizeof(request.path))
+	{
+		fprintf(ofile, "ERROR invalid request\n");
+		goto done;
+	}
+
+	strcpy(request.path, line + pathpos);
+	request.options.invalid_utf8 = (char) invalid_utf8;
+
+	table = get_table(&daemon->cache, request.path, &request.options,
+					  daemon->loader, daemon->arg);
+	if (!table)
+	{
+		fprintf(ofile, "ERROR cannot to load file \"%s\"\n", request.path);
+		goto done;
+	}
+
+	fprintf(ofile, "OK\n");
+
+	/* without end mark the client reports incomplete output */
+	if (daemon->renderer(ofile, table, &request, daemon->arg))
+		fwrite(DAEMON_END_MARK, 1, DAEMON_END_MARK_SIZE, ofile);
+
+	release_table(&daemon->cache, table);
+
+done:
+
+	fclose(ofile);
+	fclose(f);
+
+	return NULL;
+}
+
+/*
+ * Creates directory of socket, when it doesn't exist. The created
+ * directory is private. The existing directory, that is not private,
+ * can be used only when it is not writable by other users, or when it
+ * has sticky bit (like /tmp).
+ */
+static void
+prepare_socket_dir(const char *socket_path)
+{
+	char		path[PATH_MAX];
+	char	   *dir;
+	struct stat st;
+
+	strcpy(path, socket_path);
+	dir = dirname(path);
+
+	if (mkdir(dir, S_IRWXU) == 0)
+		return;
+
+	if (errno != EEXIST || lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode))
+	{
+		fprintf(stderr, "cannot to create directory \"%s\" of socket: %m\n", dir);
+		exit(1);
+	}
+
+	if (st.st_uid == getuid() && (st.st_mode & (S_IRWXG | S_IRWXO)) == 0)
+		return;
+
+	if ((st.st_uid == getuid() || st.st_uid == 0) &&
+		((st.st_mode & (S_IWGRP | S_IWOTH)) == 0 || (st.st_mode & S_ISVTX)))
+		return;
+
+	fprintf(stderr, "directory \"%s\" of socket is not safe\n", dir);
+	exit(1);
+}
+
+/*
+ * Listens on socket, and renders requested tables. It doesn't return.
+ */
+void
+daemon_run(const char *socket_path, long cache_size,
+		   TableLoaderType loader, TableRendererType renderer,
+		   TableFreeType free_table, void *arg)
+{
+	DaemonType	daemon;
+	struct sockaddr_un addr;
+	pthread_attr_t attr;
+	mode_t	old_umask;
+	int		fd;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "path of socket is too long\n");
+		exit(1);
+	}
+
+	/* the client can close connection before end of output */
+	signal(SIGPIPE, SIG_IGN);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		fprintf(stderr, "cannot to create socket: %m\n");
+		exit(1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	prepare_socket_dir(socket_path);
+
+	/* only the socket of previous daemon of same user can be removed */
+	if (access(socket_path, F_OK) == 0 || errno != ENOENT)
+	{
+		int		conn;
+
+		if (!is_own_socket(socket_path))
+		{
+			fprintf(stderr, "file \"%s\" is not socket of current user\n", socket_path);
+			exit(1);
+		}
+
+		conn = connect_socket(socket_path);
+		if (conn != -1)
+		{
+			close(conn);
+			fprintf(stderr, "daemon is already running on socket \"%s\"\n", socket_path);
+			exit(1);
+		}
+
+		unlink(socket_path);
+	}
+
+	/* the socket is created with access only for owner */
+	old_umask = umask(S_IRWXG | S_IRWXO);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+		listen(fd, 16) == -1)
+	{
+		fprintf(stderr, "cannot to listen on socket \"%s\": %m\n", socket_path);
+		exit(1);
+	}
+
+	umask(old_umask);
+
+	memset(&daemon, 0, sizeof(daemon));
+	daemon.cache.cache_size = cache_size;
+	daemon.cache.free_table = free_table;
+	pthread_mutex_init(&daemon.cache.lock, NULL);
+	daemon.loader = loader;
+	daemon.renderer = renderer;
+	daemon.arg = arg;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (;;)
+	{
+		ConnectionType *conn;
+		pthread_t	thread;
+		int			conn_fd = accept(fd, NULL, NULL);
+
+		if (conn_fd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "cannot to accept connection: %m\n");
+			exit(1);
+		}
+
+		if (!is_own_peer(conn_fd))
+		{
+			close(conn_fd);
+			continue;
+		}
+
+		conn = smalloc(sizeof(ConnectionType), "ConnectionType");
+		conn->fd = conn_fd;
+		conn->daemon = &daemon;
+
+		if (pthread_create(&thread, &attr, process_request, conn) != 0)
+		{
+			close(conn_fd);
+			free(conn);
+		}
+	}
+}
@@ -0,0 +1,87 @@
+/*-------------------------------------------------------------------------
+ *
+ * daemon.h
+ *	  render server with cache of parsed tables
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  daemon.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_DAEMON_H
+#define CSV_PRETTY_DAEMON_H
+
+#include <limits.h>
+#include <sys/types.h>
+
+#include "csv-pretty-format.h"
+
+/*
+ * Options of parsing, that change rendered table. The table is parsed
+ * by daemon with options of client, and these options are part of key
+ * of cached table. The options of storage of rows (dictionary, memory
+ * limit, compression) don't change output, and they are used from
+ * command line of daemon.
+ */
+typedef struct
+{
+	long		max_field_size;
+	int			encoding;
+	char		invalid_utf8;
+} ParseOptionsType;
+
+/*
+ * Parsed table hold by daemon. The tables are in LRU list, the most
+ * recently used table is first.
+ */
+typedef struct _CachedTableType
+{
+	char	   *path;
+	ParseOptionsType options;
+	time_t		mtime;
+	long		mtime_nsec;
+	off_t		size;
+	RowBucketType *rowbucket;
+	LinebufType *linebuf;
+	long		memory;			/* allocated memory of table */
+	int			refcount;		/* number of threads, that use table */
+	bool		evicted;		/* table is not in cache */
+	struct _CachedTableType *prev;
+	struct _CachedTableType *next;
+} CachedTableType;
+
+/*
+ * Options of rendering passed from client to daemon.
+ */
+typedef struct
+{
+	char		path[PATH_MAX];
+	ParseOptionsType options;
+	int			border;
+	char		linestyle;
+	int			first_column;
+	int			width;
+	int			max_width;
+	long		first_row;
+	long		nrows;
+} RenderRequestType;
+
+/* parses file to table, returns false when file cannot be read or parsed */
+typedef bool (*TableLoaderType) (const char *path, const ParseOptionsType *options,
+								 CachedTableType *table, void *arg);
+/* renders table, returns false when the rendering failed */
+typedef bool (*TableRendererType) (FILE *ofile, CachedTableType *table,
+								   RenderRequestType *request, void *arg);
+/* releases rows and buckets of loaded table */
+typedef void (*TableFreeType) (RowBucketType *rowbucket, LinebufType *linebuf);
+
+extern char *daemon_socket_path(void);
+extern bool daemon_render(const char *socket_path, RenderRequestType *request, FILE *ofile);
+extern void daemon_run(const char *socket_path, long cache_size,
+					   TableLoaderType loader, TableRendererType renderer,
+					   TableFreeType free_table, void *arg);
+
+#endif
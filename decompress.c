@@ -0,0 +1,779 @@
+/*-------------------------------------------------------------------------
+ *
+ * decompress.c
+ *	  transparent decompression of gzip and zstd input
+ *
+ * The format of input is detected by magic bytes. Gzip input is
+ * decompressed by zlib (when it is compiled with HAVE_LIBZ), zstd
+ * input by libzstd (when it is compiled with HAVE_LIBZSTD). BGZF
+ * blocks and zstd frames are independent, so when more threads are
+ * allowed, then a batch of these units is decompressed in parallel.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  decompress.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "csv-pretty-format.h"
+#include "decompress.h"
+
+#define METHOD_NONE			0
+#define METHOD_GZIP			1
+#define METHOD_BGZF			2
+#define METHOD_ZSTD			3
+
+#define BGZF_MAX_BLOCK_SIZE		(64 * 1024)
+
+/* the zstd frame longer than this limit is decompressed by streaming */
+#define ZSTD_MAX_UNIT_SIZE		(4 * 1024 * 1024)
+
+#define UNITS_PER_THREAD		4
+
+/*
+ * Independent part of compressed input (BGZF block or zstd frame).
+ * The data are stored as offset to input buffer, because the buffer
+ * can be reallocated when the batch is collected.
+ */
+typedef struct
+{
+	size_t		offset;
+	size_t		size;
+	const char *data;
+	char	   *out;
+	size_t		outlen;
+	size_t		outsize;
+	int			method;
+	bool		failed;
+} DecodeUnitType;
+
+typedef struct
+{
+	ReaderType	reader;
+	ReaderType *source;
+	int			method;
+	int			nthreads;
+
+	char	   *inbuf;
+	size_t		inpos;
+	size_t		inlen;
+	size_t		insize;
+	bool		in_eof;
+
+	DecodeUnitType *units;
+	int			nunits;
+	int			maxunits;
+	int			current_unit;
+	size_t		unit_pos;
+
+#ifdef HAVE_LIBZ
+	z_stream	zs;
+	bool		zs_active;
+#endif
+
+#ifdef HAVE_LIBZSTD
+	ZSTD_DCtx  *dctx;
+	bool		zstd_streaming;
+#endif
+
+	bool		eof;
+} DecompressReaderType;
+
+typedef struct
+{
+	pthread_t	thread;
+	DecodeUnitType *units;
+	int			nunits;
+	int			first;
+	int			step;
+} DecodeWorkerType;
+
+static void *
+dmalloc(size_t size)
+{
+	void	   *result = malloc(size);
+
+	if (!result)
+		fatal_error();
+
+	return result;
+}
+
+/*
+ * Ensures, so at least "need" bytes are available in input buffer.
+ * Returns false, when the input is shorter.
+ */
+static bool
+fill_input(DecompressReaderType *dr, size_t need)
+{
+	while (dr->inlen - dr->inpos < need)
+	{
+		int		n;
+
+		if (dr->in_eof)
+			return false;
+
+		if (dr->insize - dr->inlen < INPUT_BLOCK_SIZE)
+		{
+			/* try to reuse already processed space */
+			if (dr->inpos > 0 && dr->nunits == 0)
+			{
+				memmove(dr->inbuf, dr->inbuf + dr->inpos, dr->inlen - dr->inpos);
+				dr->inlen -= dr->inpos;
+				dr->inpos = 0;
+			}
+
+			if (dr->insize - dr->inlen < INPUT_BLOCK_SIZE)
+			{
+				dr->insize = dr->insize * 2 > dr->inlen + INPUT_BLOCK_SIZE ?
+								dr->insize * 2 : dr->inlen + INPUT_BLOCK_SIZE;
+				dr->inbuf = realloc(dr->inbuf, dr->insize);
+				if (!dr->inbuf)
+					fatal_error();
+			}
+		}
+
+		n = dr->source->read(dr->source, dr->inbuf + dr->inlen, INPUT_BLOCK_SIZE);
+		if (n < 0)
+			input_read_error();
+		if (n == 0)
+			dr->in_eof = true;
+		else
+			dr->inlen += n;
+	}
+
+	return true;
+}
+
+#if defined(HAVE_LIBZ) || defined(HAVE_LIBZSTD)
+
+static void
+unit_reserve(DecodeUnitType *unit, size_t size)
+{
+	if (unit->outsize < size)
+	{
+		unit->outsize = size;
+		unit->out = realloc(unit->out, size);
+		if (!unit->out)
+			fatal_error();
+	}
+}
+
+#endif
+
+/*
+ * Returns size of decompressed data of BGZF block (ISIZE field of
+ * gzip trailer).
+ */
+static uint32_t
+bgzf_isize(const unsigned char *data, size_t size)
+{
+	return data[size - 4] |
+		   (data[size - 3] << 8) |
+		   (data[size - 2] << 16) |
+		   ((uint32_t) data[size - 1] << 24);
+}
+
+static void
+decode_unit(DecodeUnitType *unit)
+{
+	unit->outlen = 0;
+	unit->failed = false;
+
+#ifdef HAVE_LIBZ
+
+	if (unit->method == METHOD_BGZF)
+	{
+		const unsigned char *data = (const unsigned char *) unit->data;
+		size_t		xlen = data[10] | (data[11] << 8);
+		uint32_t	isize;
+		z_stream	zs;
+
+		/* the block was checked by bgzf_block_size already */
+		if (unit->size < 20 + xlen)
+		{
+			unit->failed = true;
+			return;
+		}
+
+		isize = bgzf_isize(data, unit->size);
+		if (isize > BGZF_MAX_BLOCK_SIZE)
+		{
+			unit->failed = true;
+			return;
+		}
+
+		unit_reserve(unit, isize > 0 ? isize : 1);
+
+		memset(&zs, 0, sizeof(zs));
+		if (inflateInit2(&zs, -15) != Z_OK)
+		{
+			unit->failed = true;
+			return;
+		}
+
+		zs.next_in = (unsigned char *) data + 12 + xlen;
+		zs.avail_in = unit->size - 12 - xlen - 8;
+		zs.next_out = (unsigned char *) unit->out;
+		zs.avail_out = isize;
+
+		if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out != 0)
+			unit->failed = true;
+
+		unit->outlen = isize - zs.avail_out;
+		inflateEnd(&zs);
+
+		return;
+	}
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+
+	if (unit->method == METHOD_ZSTD)
+	{
+		unsigned long long csize = ZSTD_getFrameContentSize(unit->data, unit->size);
+
+		if (csize != ZSTD_CONTENTSIZE_UNKNOWN && csize != ZSTD_CONTENTSIZE_ERROR)
+		{
+			size_t		r;
+
+			unit_reserve(unit, csize > 0 ? csize : 1);
+
+			r = ZSTD_decompress(unit->out, csize, unit->data, unit->size);
+			if (ZSTD_isError(r))
+				unit->failed = true;
+			else
+				unit->outlen = r;
+		}
+		else
+		{
+			ZSTD_DCtx  *dctx = ZSTD_createDCtx();
+			ZSTD_inBuffer in = {unit->data, unit->size, 0};
+
+			while (in.pos < in.size)
+			{
+				ZSTD_outBuffer out;
+				size_t		r;
+
+				unit_reserve(unit, unit->outlen + ZSTD_DStreamOutSize());
+
+				out.dst = unit->out;
+				out.size = unit->outsize;
+				out.pos = unit->outlen;
+
+				r = ZSTD_decompressStream(dctx, &out, &in);
+				if (ZSTD_isError(r))
+				{
+					unit->failed = true;
+					break;
+				}
+
+				unit->outlen = out.pos;
+
+				/* fully decoded frame */
+				if (r == 0)
+					break;
+			}
+
+			ZSTD_freeDCtx(dctx);
+		}
+
+		return;
+	}
+
+#endif
+
+	unit->failed = true;
+}
+
+static void *
+decode_worker(void *arg)
+{
+	DecodeWorkerType *worker = (DecodeWorkerType *) arg;
+	int		i;
+
+	for (i = worker->first; i < worker->nunits; i += worker->step)
+		decode_unit(&worker->units[i]);
+
+	return NULL;
+}
+
+/*
+ * Decode collected units. The first part is decoded by current thread.
+ */
+static void
+decode_units_parallel(DecompressReaderType *dr)
+{
+	DecodeWorkerType workers[dr->nthreads];
+	int			nthreads = dr->nthreads < dr->nunits ? dr->nthreads : dr->nunits;
+	int			i;
+
+	for (i = 0; i < dr->nunits; i++)
+		dr->units[i].data = dr->inbuf + dr->units[i].offset;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].units = dr->units;
+		workers[i].nunits = dr->nunits;
+		workers[i].first = i;
+		workers[i].step = nthreads;
+
+		if (i > 0 && pthread_create(&workers[i].thread, NULL, decode_worker, &workers[i]) != 0)
+		{
+			fprintf(stderr, "cannot to create thread\n");
+			exit(1);
+		}
+	}
+
+	decode_worker(&workers[0]);
+
+	for (i = 1; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < dr->nunits; i++)
+	{
+		if (dr->units[i].failed)
+		{
+			fprintf(stderr, "cannot to decompress input, data are broken\n");
+			fatal_error();
+		}
+	}
+}
+
+/*
+ * Returns size of BGZF block at current position, 0 when there is
+ * not valid BGZF block, -1 on end of input. The BSIZE, XLEN and ISIZE
+ * fields are checked, so the block can be decoded as one unit. The
+ * block with broken header should be decoded by streaming, that
+ * reports possible error.
+ */
+static long
+bgzf_block_size(DecompressReaderType *dr)
+{
+	const unsigned char *data;
+	size_t		xlen;
+	size_t		size;
+	size_t		i;
+
+	if (!fill_input(dr, 18))
+		return dr->inlen == dr->inpos ? -1 : 0;
+
+	data = (const unsigned char *) dr->inbuf + dr->inpos;
+
+	if (data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || !(data[3] & 4))
+		return 0;
+
+	xlen = data[10] | (data[11] << 8);
+
+	if (!fill_input(dr, 12 + xlen))
+		return 0;
+
+	data = (const unsigned char *) dr->inbuf + dr->inpos;
+
+	for (i = 12; i + 4 <= 12 + xlen; )
+	{
+		size_t		slen = data[i + 2] | (data[i + 3] << 8);
+
+		if (i + 4 + slen > 12 + xlen)
+			return 0;
+
+		if (data[i] == 'B' && data[i + 1] == 'C' && slen == 2)
+		{
+			size = (data[i + 4] | (data[i + 5] << 8)) + 1;
+
+			/* header, deflate data and trailer (CRC32, ISIZE) */
+			if (size < 20 + xlen)
+				return 0;
+
+			if (!fill_input(dr, size))
+				return 0;
+
+			data = (const unsigned char *) dr->inbuf + dr->inpos;
+
+			if (bgzf_isize(data, size) > BGZF_MAX_BLOCK_SIZE)
+				return 0;
+
+			return size;
+		}
+
+		i += 4 + slen;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_LIBZSTD
+
+/*
+ * Returns size of zstd frame at current position, 0 when the frame is
+ * too long to be decoded as one unit, -1 on end of input.
+ */
+static long
+zstd_frame_size(DecompressReaderType *dr)
+{
+	size_t		need = 1024;
+
+	for (;;)
+	{
+		bool		complete = fill_input(dr, need);
+		size_t		avail = dr->inlen - dr->inpos;
+		size_t		r;
+
+		if (avail == 0)
+			return -1;
+
+		r = ZSTD_findFrameCompressedSize(dr->inbuf + dr->inpos, avail);
+		if (!ZSTD_isError(r))
+			return r;
+
+		if (!complete || need >= ZSTD_MAX_UNIT_SIZE)
+			return 0;
+
+		need *= 2;
+	}
+}
+
+#endif
+
+/*
+ * Collects next batch of independent units. Returns false, when there
+ * are not any units (on end of input or when the unit should be
+ * decoded by streaming).
+ */
+static bool
+collect_units(DecompressReaderType *dr)
+{
+	dr->nunits = 0;
+	dr->current_unit = 0;
+	dr->unit_pos = 0;
+
+	while (dr->nunits < dr->maxunits)
+	{
+		DecodeUnitType *unit;
+		long		size = -1;
+
+		if (dr->method == METHOD_BGZF)
+		{
+			size = bgzf_block_size(dr);
+			if (size == 0)
+			{
+				/* the rest of input is decoded by streaming */
+				dr->method = METHOD_GZIP;
+				break;
+			}
+		}
+
+#ifdef HAVE_LIBZSTD
+
+		else if (dr->method == METHOD_ZSTD)
+		{
+			size = zstd_frame_size(dr);
+			if (size == 0)
+				break;
+		}
+
+#endif
+
+		if (size < 0)
+			break;
+
+		if (!fill_input(dr, size))
+		{
+			fprintf(stderr, "cannot to decompress input, unexpected end of data\n");
+			fatal_error();
+		}
+
+		unit = &dr->units[dr->nunits++];
+		unit->offset = dr->inpos;
+		unit->size = size;
+		unit->method = dr->method;
+
+		dr->inpos += size;
+	}
+
+	if (dr->nunits > 0)
+		decode_units_parallel(dr);
+
+	return dr->nunits > 0;
+}
+
+static int
+decompress_read(ReaderType *reader, char *buf, int size)
+{
+	DecompressReaderType *dr = (DecompressReaderType *) reader;
+
+	if (dr->eof)
+		return 0;
+
+	if (dr->method == METHOD_NONE)
+	{
+		if (dr->inpos < dr->inlen)
+		{
+			size_t		n = dr->inlen - dr->inpos;
+
+			if (n > (size_t) size)
+				n = size;
+
+			memcpy(buf, dr->inbuf + dr->inpos, n);
+			dr->inpos += n;
+
+			return n;
+		}
+
+		return dr->source->read(dr->source, buf, size);
+	}
+
+	/* serve already decoded data */
+	while (dr->current_unit < dr->nunits)
+	{
+		DecodeUnitType *unit = &dr->units[dr->current_unit];
+
+		if (dr->unit_pos < unit->outlen)
+		{
+			size_t		n = unit->outlen - dr->unit_pos;
+
+			if (n > (size_t) size)
+				n = size;
+
+			memcpy(buf, unit->out + dr->unit_pos, n);
+			dr->unit_pos += n;
+
+			return n;
+		}
+
+		dr->current_unit += 1;
+		dr->unit_pos = 0;
+	}
+
+	dr->nunits = 0;
+
+#ifdef HAVE_LIBZSTD
+
+	if (dr->method == METHOD_ZSTD)
+	{
+		while (dr->zstd_streaming || dr->nthreads == 1 || !collect_units(dr))
+		{
+			ZSTD_inBuffer in;
+			ZSTD_outBuffer out = {buf, size, 0};
+			size_t		r;
+
+			if (!fill_input(dr, 1))
+			{
+				if (dr->zstd_streaming)
+				{
+					fprintf(stderr, "cannot to decompress input, unexpected end of data\n");
+					fatal_error();
+				}
+
+				dr->eof = true;
+				return 0;
+			}
+
+			in.src = dr->inbuf + dr->inpos;
+			in.size = dr->inlen - dr->inpos;
+			in.pos = 0;
+
+			r = ZSTD_decompressStream(dr->dctx, &out, &in);
+			if (ZSTD_isError(r))
+			{
+				fprintf(stderr, "cannot to decompress input: %s\n", ZSTD_getErrorName(r));
+				fatal_error();
+			}
+
+			dr->inpos += in.pos;
+			dr->zstd_streaming = r != 0;
+
+			if (out.pos > 0)
+				return out.pos;
+		}
+
+		return decompress_read(reader, buf, size);
+	}
+
+#endif
+
+	if (dr->method == METHOD_BGZF && dr->nthreads > 1)
+	{
+		if (collect_units(dr))
+			return decompress_read(reader, buf, size);
+
+		if (dr->method == METHOD_BGZF)
+		{
+			dr->eof = true;
+			return 0;
+		}
+	}
+
+#ifdef HAVE_LIBZ
+
+	for (;;)
+	{
+		int			r;
+
+		if (!fill_input(dr, 1))
+		{
+			if (dr->zs_active)
+			{
+				fprintf(stderr, "cannot to decompress input, unexpected end of data\n");
+				fatal_error();
+			}
+
+			dr->eof = true;
+			return 0;
+		}
+
+		/* next member of gzip file */
+		if (!dr->zs_active)
+		{
+			inflateReset(&dr->zs);
+			dr->zs_active = true;
+		}
+
+		dr->zs.next_in = (unsigned char *) dr->inbuf + dr->inpos;
+		dr->zs.avail_in = dr->inlen - dr->inpos;
+		dr->zs.next_out = (unsigned char *) buf;
+		dr->zs.avail_out = size;
+
+		r = inflate(&dr->zs, Z_NO_FLUSH);
+		if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+		{
+			fprintf(stderr, "cannot to decompress input: %s\n",
+					dr->zs.msg ? dr->zs.msg : "broken data");
+			fatal_error();
+		}
+
+		dr->inpos = dr->inlen - dr->zs.avail_in;
+
+		if (r == Z_STREAM_END)
+			dr->zs_active = false;
+
+		if (size - dr->zs.avail_out > 0)
+			return size - dr->zs.avail_out;
+	}
+
+#else
+
+	return 0;
+
+#endif
+}
+
+static void
+decompress_close(ReaderType *reader)
+{
+	DecompressReaderType *dr = (DecompressReaderType *) reader;
+	int		i;
+
+#ifdef HAVE_LIBZ
+
+	if (dr->method == METHOD_GZIP || dr->method == METHOD_BGZF)
+		inflateEnd(&dr->zs);
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+
+	if (dr->dctx)
+		ZSTD_freeDCtx(dr->dctx);
+
+#endif
+
+	for (i = 0; i < dr->maxunits; i++)
+		free(dr->units[i].out);
+
+	if (dr->source->close)
+		dr->source->close(dr->source);
+
+	free(dr->units);
+	free(dr->inbuf);
+	free(dr);
+}
+
+/*
+ * Returns reader, that decompress source, when source is compressed.
+ * Not compressed input is passed without change.
+ */
+ReaderType *
+decompress_reader(ReaderType *source, int nthreads)
+{
+	DecompressReaderType *dr = dmalloc(sizeof(DecompressReaderType));
+	const unsigned char *data;
+
+	memset(dr, 0, sizeof(DecompressReaderType));
+
+	dr->reader.read = decompress_read;
+	dr->reader.close = decompress_close;
+	dr->source = source;
+	dr->nthreads = nthreads;
+	dr->method = METHOD_NONE;
+
+	(void) fill_input(dr, 4);
+
+	data = (const unsigned char *) dr->inbuf;
+
+	if (dr->inlen >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+	{
+
+#ifdef HAVE_LIBZ
+
+		dr->method = bgzf_block_size(dr) > 0 ? METHOD_BGZF : METHOD_GZIP;
+
+		/* 32 - automatic detection of gzip header */
+		if (inflateInit2(&dr->zs, 15 + 32) != Z_OK)
+		{
+			fprintf(stderr, "cannot to initialize zlib\n");
+			fatal_error();
+		}
+
+#else
+
+		fprintf(stderr, "input is compressed by gzip, but gzip support is not compiled\n");
+		fatal_error();
+
+#endif
+
+	}
+	else if (dr->inlen >= 4 &&
+			 data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+	{
+
+#ifdef HAVE_LIBZSTD
+
+		dr->method = METHOD_ZSTD;
+		dr->dctx = ZSTD_createDCtx();
+
+#else
+
+		fprintf(stderr, "input is compressed by zstd, but zstd support is not compiled\n");
+		fatal_error();
+
+#endif
+
+	}
+
+	if (dr->method != METHOD_NONE && nthreads > 1)
+	{
+		dr->maxunits = nthreads * UNITS_PER_THREAD;
+		dr->units = dmalloc(dr->maxunits * sizeof(DecodeUnitType));
+		memset(dr->units, 0, dr->maxunits * sizeof(DecodeUnitType));
+	}
+
+	return (ReaderType *) dr;
+}
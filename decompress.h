@@ -0,0 +1,21 @@
+/*-------------------------------------------------------------------------
+ *
+ * decompress.h
+ *	  transparent decompression of gzip and zstd input
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  decompress.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_DECOMPRESS_H
+#define CSV_PRETTY_DECOMPRESS_H
+
+#include "input.h"
+
+extern ReaderType *decompress_reader(ReaderType *source, int nthreads);
+
+#endif
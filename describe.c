@@ -0,0 +1,464 @@
+/*-------------------------------------------------------------------------
+ *
+ * describe.c
+ *	  streaming statistics of columns
+ *
+ * The rows are processed one by one, and they are released immediately,
+ * so the memory is constant per column. The number of distinct values
+ * is estimated by HyperLogLog, and the quartiles of numeric values are
+ * estimated by P-square algorithm (Jain and Chlamtac). The type of column
+ * is inferred by same rules like in table mode, and the first row is
+ * used as names of columns when it is header.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  describe.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "describe.h"
+#include "spill.h"
+#include "unicode.h"
+
+const char *describe_field_names[DESCRIBE_NFIELDS] = {
+	"column", "type", "count", "distinct", "min", "max",
+	"min width", "max width", "p25", "median", "p75"
+};
+
+static const char *type_names[FIELD_TYPE_COUNT] = {
+	"empty", "int", "float", "date", "bool", "text"
+};
+
+/* longer min and max values are shortened */
+#define MAX_VALUE_SIZE		40
+
+static const double quantile_probs[DESCRIBE_QUANTILES] = {0.25, 0.5, 0.75};
+
+static char *
+sstrdup(const char *str)
+{
+	char	   *result = smalloc(strlen(str) + 1, "string");
+
+	strcpy(result, str);
+
+	return result;
+}
+
+static void
+replace_string(char **target, const char *str)
+{
+	free(*target);
+	*target = sstrdup(str);
+}
+
+/*
+ * 64bit FNV-1a hash with final mixing, so all bits of result are usable.
+ */
+static uint64_t
+hash_string(const char *str)
+{
+	uint64_t	hash = 14695981039346656037ULL;
+
+	while (*str)
+	{
+		hash ^= (unsigned char) *str++;
+		hash *= 1099511628211ULL;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static void
+hll_add(uint8_t *registers, const char *str)
+{
+	uint64_t	hash = hash_string(str);
+	int			idx = hash >> (64 - HLL_BITS);
+	uint64_t	rest = (hash << HLL_BITS) | ((uint64_t) 1 << (HLL_BITS - 1));
+	uint8_t		rank = __builtin_clzll(rest) + 1;
+
+	if (rank > registers[idx])
+		registers[idx] = rank;
+}
+
+static double
+hll_estimate(uint8_t *registers)
+{
+	double		m = HLL_REGISTERS;
+	double		alpha = 0.7213 / (1.0 + 1.079 / m);
+	double		sum = 0.0;
+	int			zeros = 0;
+	double		estimate;
+	int			i;
+
+	for (i = 0; i < HLL_REGISTERS; i++)
+	{
+		sum += ldexp(1.0, -registers[i]);
+		if (registers[i] == 0)
+			zeros += 1;
+	}
+
+	estimate = alpha * m * m / sum;
+
+	/* small range correction - linear counting */
+	if (estimate <= 2.5 * m && zeros > 0)
+		estimate = m * log(m / zeros);
+
+	return estimate;
+}
+
+static void
+quantile_init(QuantileType *q, double p)
+{
+	q->p = p;
+	q->count = 0;
+
+	q->increments[0] = 0.0;
+	q->increments[1] = p / 2;
+	q->increments[2] = p;
+	q->increments[3] = (1.0 + p) / 2;
+	q->increments[4] = 1.0;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double		da = *(const double *) a;
+	double		db = *(const double *) b;
+
+	return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+static double
+quantile_parabolic(QuantileType *q, int i, double d)
+{
+	double	   *n = q->positions;
+	double	   *h = q->heights;
+
+	return h[i] + d / (n[i + 1] - n[i - 1]) *
+		((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+		 (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+}
+
+static void
+quantile_add(QuantileType *q, double x)
+{
+	double	   *n = q->positions;
+	double	   *h = q->heights;
+	int			k;
+	int			i;
+
+	/* first five values are markers */
+	if (q->count < 5)
+	{
+		h[q->count++] = x;
+
+		if (q->count == 5)
+		{
+			qsort(h, 5, sizeof(double), cmp_double);
+
+			for (i = 0; i < 5; i++)
+				n[i] = i + 1;
+
+			q->desired[0] = 1.0;
+			q->desired[1] = 1.0 + 2.0 * q->p;
+			q->desired[2] = 1.0 + 4.0 * q->p;
+			q->desired[3] = 3.0 + 2.0 * q->p;
+			q->desired[4] = 5.0;
+		}
+
+		return;
+	}
+
+	if (x < h[0])
+	{
+		h[0] = x;
+		k = 0;
+	}
+	else if (x >= h[4])
+	{
+		h[4] = x;
+		k = 3;
+	}
+	else
+	{
+		for (k = 0; k < 3; k++)
+			if (x < h[k + 1])
+				break;
+	}
+
+	for (i = k + 1; i < 5; i++)
+		n[i] += 1.0;
+
+	for (i = 0; i < 5; i++)
+		q->desired[i] += q->increments[i];
+
+	q->count += 1;
+
+	/* adjust heights of middle markers */
+	for (i = 1; i < 4; i++)
+	{
+		double		d = q->desired[i] - n[i];
+
+		if ((d >= 1.0 && n[i + 1] - n[i] > 1.0) ||
+			(d <= -1.0 && n[i - 1] - n[i] < -1.0))
+		{
+			double		hp;
+			int			s = d > 0 ? 1 : -1;
+
+			hp = quantile_parabolic(q, i, s);
+			if (h[i - 1] < hp && hp < h[i + 1])
+				h[i] = hp;
+			else
+				h[i] = h[i] + s * (h[i + s] - h[i]) / (n[i + s] - n[i]);
+
+			n[i] += s;
+		}
+	}
+}
+
+static double
+quantile_result(QuantileType *q)
+{
+	if (q->count < 5)
+	{
+		double		values[5];
+
+		memcpy(values, q->heights, q->count * sizeof(double));
+		qsort(values, q->count, sizeof(double), cmp_double);
+
+		return values[(int) (q->p * (q->count - 1) + 0.5)];
+	}
+
+	return q->heights[2];
+}
+
+static int
+field_width(RowType *row, int i)
+{
+	if (row->lines && row->lines[i])
+	{
+		int		width = 0;
+		int		j;
+
+		for (j = 0; j < row->lines[i]->nlines; j++)
+		{
+			if (row->lines[i]->lines[j].width > width)
+				width = row->lines[i]->lines[j].width;
+		}
+
+		return width;
+	}
+
+	return utf_string_dsplen(row->fields[i], -1);
+}
+
+/*
+ * Copies first line of value to buffer. Too long value is shortened
+ * (on boundary of multibyte char) and "..." is appended.
+ */
+static char *
+shorten_value(char *buffer, const char *value)
+{
+	size_t		len = strcspn(value, "\n");
+
+	if (len <= MAX_VALUE_SIZE && value[len] == '\0')
+		return (char *) value;
+
+	if (len > MAX_VALUE_SIZE)
+	{
+		len = MAX_VALUE_SIZE;
+		while (len > 0 && ((unsigned char) value[len] & 0xC0) == 0x80)
+			len--;
+	}
+
+	memcpy(buffer, value, len);
+	strcpy(buffer + len, "...");
+
+	return buffer;
+}
+
+static ColumnStatsType *
+column_stats(DescribeType *describe, int colno)
+{
+	ColumnStatsType *stats = describe->columns[colno];
+
+	if (!stats)
+	{
+		int		i;
+
+		stats = smalloc(sizeof(ColumnStatsType), "ColumnStatsType");
+		memset(stats, 0, sizeof(ColumnStatsType));
+
+		for (i = 0; i < DESCRIBE_QUANTILES; i++)
+			quantile_init(&stats->quantiles[i], quantile_probs[i]);
+
+		describe->columns[colno] = stats;
+	}
+
+	return stats;
+}
+
+static void
+accumulate_row(DescribeType *describe, RowType *row)
+{
+	int		i;
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		ColumnStatsType *stats = column_stats(describe, i);
+		const char *field = row->fields[i];
+		int		width;
+
+		/* empty fields are nulls */
+		if (*field == '\0')
+			continue;
+
+		if (stats->count == 0 || strcmp(field, stats->min_value) < 0)
+			replace_string(&stats->min_value, field);
+		if (stats->count == 0 || strcmp(field, stats->max_value) > 0)
+			replace_string(&stats->max_value, field);
+
+		width = field_width(row, i);
+		if (stats->count == 0 || width < stats->min_width)
+			stats->min_width = width;
+		if (width > stats->max_width)
+			stats->max_width = width;
+
+		stats->count += 1;
+
+		hll_add(stats->registers, field);
+
+		if (FIELD_TYPE_IS_NUMERIC(classify_field(field)))
+		{
+			double		value = strtod(field, NULL);
+			int			j;
+
+			if (stats->nnumbers == 0 || value < stats->min_number)
+			{
+				stats->min_number = value;
+				replace_string(&stats->min_number_str, field);
+			}
+			if (stats->nnumbers == 0 || value > stats->max_number)
+			{
+				stats->max_number = value;
+				replace_string(&stats->max_number_str, field);
+			}
+
+			stats->nnumbers += 1;
+
+			for (j = 0; j < DESCRIBE_QUANTILES; j++)
+				quantile_add(&stats->quantiles[j], value);
+		}
+	}
+}
+
+DescribeType *
+describe_init(void)
+{
+	DescribeType *describe = smalloc(sizeof(DescribeType), "DescribeType");
+
+	memset(describe, 0, sizeof(DescribeType));
+
+	return describe;
+}
+
+/*
+ * Row handler of parser. The first row is held, because it is not known
+ * if it is header or data now. Other rows are released after processing.
+ */
+void
+describe_row(RowType *row, bool multiline, void *arg)
+{
+	DescribeType *describe = (DescribeType *) arg;
+
+	(void) multiline;
+
+	if (!describe->first_row)
+	{
+		describe->first_row = row;
+		return;
+	}
+
+	accumulate_row(describe, row);
+	free_row(row);
+}
+
+/*
+ * Should be called after infer_column_types. The first row is processed
+ * as data, when it is not header.
+ */
+void
+describe_finish(DescribeType *describe, LinebufType *linebuf)
+{
+	int		i;
+
+	if (describe->first_row && !linebuf->header)
+		accumulate_row(describe, describe->first_row);
+
+	/* columns without any field */
+	for (i = 0; i < linebuf->maxfields; i++)
+		(void) column_stats(describe, i);
+}
+
+/*
+ * Returns formatted statistics of column. The values are valid until
+ * next call for same column.
+ */
+void
+describe_column(DescribeType *describe, LinebufType *linebuf, int colno, char **values)
+{
+	ColumnStatsType *stats = describe->columns[colno];
+	int			type = linebuf->column_types[colno];
+	bool		numeric = FIELD_TYPE_IS_NUMERIC(type) && stats->nnumbers > 0;
+	int			i;
+
+	for (i = 0; i < DESCRIBE_NFIELDS; i++)
+	{
+		stats->strbufs[i][0] = '\0';
+		values[i] = stats->strbufs[i];
+	}
+
+	if (linebuf->header && describe->first_row && colno < describe->first_row->nfields)
+		values[0] = describe->first_row->fields[colno];
+	else
+		snprintf(stats->strbufs[0], 64, "%d", colno + 1);
+
+	values[1] = (char *) type_names[type];
+
+	snprintf(stats->strbufs[2], 64, "%ld", stats->count);
+
+	if (stats->count > 0)
+	{
+		snprintf(stats->strbufs[3], 64, "%.0f", hll_estimate(stats->registers));
+
+		values[4] = shorten_value(stats->strbufs[4],
+								  numeric ? stats->min_number_str : stats->min_value);
+		values[5] = shorten_value(stats->strbufs[5],
+								  numeric ? stats->max_number_str : stats->max_value);
+
+		snprintf(stats->strbufs[6], 64, "%d", stats->min_width);
+		snprintf(stats->strbufs[7], 64, "%d", stats->max_width);
+	}
+
+	if (numeric)
+	{
+		/* fraction digits like the widest value of column */
+		int		digits = linebuf->fracwidths[colno] > 0 ? linebuf->fracwidths[colno] - 1 : 0;
+
+		for (i = 0; i < DESCRIBE_QUANTILES; i++)
+			snprintf(stats->strbufs[8 + i], 64, "%.*f",
+					 digits, quantile_result(&stats->quantiles[i]));
+	}
+}
@@ -0,0 +1,73 @@
+/*-------------------------------------------------------------------------
+ *
+ * describe.h
+ *	  streaming statistics of columns
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  describe.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_DESCRIBE_H
+#define CSV_PRETTY_DESCRIBE_H
+
+#include <stdint.h>
+
+#include "csv-pretty-format.h"
+
+#define HLL_BITS			12
+#define HLL_REGISTERS		(1 << HLL_BITS)
+
+#define DESCRIBE_QUANTILES	3
+
+/* fields of row of result */
+#define DESCRIBE_NFIELDS	11
+
+/*
+ * State of P-square estimator of one quantile.
+ */
+typedef struct
+{
+	double		p;
+	long		count;
+	double		heights[5];
+	double		positions[5];
+	double		desired[5];
+	double		increments[5];
+} QuantileType;
+
+typedef struct
+{
+	long		count;				/* number of not empty fields */
+	char	   *min_value;
+	char	   *max_value;
+	long		nnumbers;
+	double		min_number;
+	double		max_number;
+	char	   *min_number_str;
+	char	   *max_number_str;
+	int			min_width;
+	int			max_width;
+	QuantileType quantiles[DESCRIBE_QUANTILES];
+	uint8_t		registers[HLL_REGISTERS];	/* HyperLogLog sketch */
+	char		strbufs[DESCRIBE_NFIELDS][64];	/* formatted values of result */
+} ColumnStatsType;
+
+typedef struct
+{
+	ColumnStatsType *columns[1024];
+	RowType	   *first_row;			/* accumulated when it is not header */
+} DescribeType;
+
+extern const char *describe_field_names[DESCRIBE_NFIELDS];
+
+extern DescribeType *describe_init(void);
+extern void describe_row(RowType *row, bool multiline, void *arg);
+extern void describe_finish(DescribeType *describe, LinebufType *linebuf);
+extern void describe_column(DescribeType *describe, LinebufType *linebuf, int colno,
+							char **values);
+
+#endif
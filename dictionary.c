@@ -0,0 +1,169 @@
+/*-------------------------------------------------------------------------
+ *
+ * dictionary.c
+ *	  interning of values of low cardinality columns
+ *
+ * Every column has own hash table of distinct values. When the column
+ * has too much distinct values, then its dictionary is disabled, and
+ * new values are not interned. Already interned values are used
+ * by rows, so they are not released.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  dictionary.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dictionary.h"
+
+#define DICT_INITIAL_SIZE		256
+#define DICT_MAX_ENTRIES		65536
+
+/* after this number of lookups the cardinality is checked */
+#define DICT_SAMPLE_SIZE		1000
+
+static unsigned int
+hash_bytes(const char *str, int size)
+{
+	unsigned int hash = 2166136261u;
+	int		i;
+
+	for (i = 0; i < size; i++)
+	{
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void
+dictionary_grow(DictionaryType *dict)
+{
+	DictEntryType **entries = dict->entries;
+	int			size = dict->size;
+	int			i;
+
+	dict->size = size ? size * 2 : DICT_INITIAL_SIZE;
+	dict->entries = smalloc(dict->size * sizeof(DictEntryType *), "DictEntryType");
+	memset(dict->entries, 0, dict->size * sizeof(DictEntryType *));
+
+	for (i = 0; i < size; i++)
+	{
+		if (entries[i])
+		{
+			unsigned int pos = entries[i]->hash & (dict->size - 1);
+
+			while (dict->entries[pos])
+				pos = (pos + 1) & (dict->size - 1);
+
+			dict->entries[pos] = entries[i];
+		}
+	}
+
+	free(entries);
+}
+
+/*
+ * Returns entry of value or NULL. The dictionary is not modified, so it
+ * can be used by more threads, when the dictionary is not filled.
+ */
+DictEntryType *
+dictionary_find(DictionaryType *dict, const char *str, int size)
+{
+	DictEntryType *entry;
+	unsigned int hash;
+	unsigned int pos;
+
+	if (dict->disabled || dict->size == 0)
+		return NULL;
+
+	hash = hash_bytes(str, size);
+	pos = hash & (dict->size - 1);
+
+	while ((entry = dict->entries[pos]) != NULL)
+	{
+		if (entry->hash == hash && entry->size == size &&
+			memcmp(entry->value, str, size) == 0)
+			return entry;
+
+		pos = (pos + 1) & (dict->size - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns entry of value. When the value is not in dictionary, then new
+ * entry is created, and found is false. The caller should fill info of
+ * new entry. Returns NULL, when the dictionary is disabled.
+ */
+DictEntryType *
+dictionary_lookup(DictionaryType *dict, const char *str, int size, bool *found)
+{
+	DictEntryType *entry;
+	unsigned int hash;
+	unsigned int pos;
+
+	if (dict->disabled)
+		return NULL;
+
+	dict->nlookups += 1;
+
+	hash = hash_bytes(str, size);
+
+	if (dict->size > 0)
+	{
+		pos = hash & (dict->size - 1);
+
+		while ((entry = dict->entries[pos]) != NULL)
+		{
+			if (entry->hash == hash && entry->size == size &&
+				memcmp(entry->value, str, size) == 0)
+			{
+				*found = true;
+				return entry;
+			}
+
+			pos = (pos + 1) & (dict->size - 1);
+		}
+	}
+
+	/* the column has not low cardinality */
+	if (dict->nentries >= DICT_MAX_ENTRIES ||
+		(dict->nlookups >= DICT_SAMPLE_SIZE && dict->nentries > dict->nlookups / 4))
+	{
+		dict->disabled = true;
+		free(dict->entries);
+		dict->entries = NULL;
+		dict->size = 0;
+
+		return NULL;
+	}
+
+	/* load factor is less than 0.5 */
+	if (dict->nentries * 2 >= dict->size)
+		dictionary_grow(dict);
+
+	entry = smalloc(offsetof(DictEntryType, value) + size + 1, "DictEntryType");
+	entry->hash = hash;
+	entry->size = size;
+	memcpy(entry->value, str, size);
+	entry->value[size] = '\0';
+
+	pos = hash & (dict->size - 1);
+	while (dict->entries[pos])
+		pos = (pos + 1) & (dict->size - 1);
+
+	dict->entries[pos] = entry;
+	dict->nentries += 1;
+
+	*found = false;
+
+	return entry;
+}
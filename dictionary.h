@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * dictionary.h
+ *	  interning of values of low cardinality columns
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  dictionary.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_DICTIONARY_H
+#define CSV_PRETTY_DICTIONARY_H
+
+#include "csv-pretty-format.h"
+
+/*
+ * Distinct value of column. The value is stored only once, and its
+ * properties (width, type, ...) are calculated only once too.
+ */
+typedef struct
+{
+	unsigned int hash;
+	int			size;
+	FieldInfoType info;
+	char		value[];
+} DictEntryType;
+
+typedef struct _DictionaryType
+{
+	DictEntryType **entries;		/* open addressing hash table */
+	int			size;				/* size of hash table, power of 2 */
+	int			nentries;
+	long		nlookups;
+	bool		disabled;			/* column has too much distinct values */
+} DictionaryType;
+
+extern DictEntryType *dictionary_lookup(DictionaryType *dict, const char *str, int size, bool *found);
+extern DictEntryType *dictionary_find(DictionaryType *dict, const char *str, int size);
+
+#endif
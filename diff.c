@@ -0,0 +1,653 @@
+/*-------------------------------------------------------------------------
+ *
+ * diff.c
+ *	  comparing of two tables by key columns
+ *
+ * The rows of smaller file are stored in open addressing hash table by
+ * hash of key columns, and the rows of larger file are streamed and they
+ * are searched in hash table. The streamed row without pair is added
+ * (or removed when the streamed file is old file), the streamed row with
+ * different pair is changed. The rows of hash table without pair are
+ * removed (or added) at the end.
+ *
+ * When the smaller file is larger than memory limit, then the rows of
+ * both files are partitioned by hash of key to temp files, and the pairs
+ * of partitions are compared one by one.
+ *
+ * Every row holds its position in own file. The result rows of streamed
+ * file are sent in order of this file, then the rows of hashed file
+ * without pair are sent in order of hashed file. The results of
+ * partitions are sorted same way and they are merged at the end, so the
+ * order of result doesn't depend on partitioning.
+ *
+ * The first rows of files are compared as header. When they are same,
+ * then the first row is result header, else they are compared as data.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  diff.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "diff.h"
+#include "spill.h"
+
+#define DIFF_TABLE_MIN_SIZE		1024
+
+/* the source of result row, the rows of streamed file are first */
+#define DIFF_STREAMED_ROW		0
+#define DIFF_HASHED_ROW			1
+
+/*
+ * Parses list of key columns like "1,3".
+ */
+static void
+parse_diff_keys(DiffType *diff, const char *str)
+{
+	const char *ptr = str;
+
+	diff->nkeys = 0;
+
+	while (*ptr)
+	{
+		char	   *endptr;
+		long		column;
+
+		if (diff->nkeys >= MAX_DIFF_KEYS || !isdigit((unsigned char) *ptr))
+			goto invalid_keys;
+
+		column = strtol(ptr, &endptr, 10);
+		if (column < 1 || column > 1024)
+			goto invalid_keys;
+
+		diff->keys[diff->nkeys++] = column - 1;
+		ptr = endptr;
+
+		if (*ptr == ',')
+		{
+			ptr++;
+			if (*ptr == '\0')
+				goto invalid_keys;
+		}
+		else if (*ptr != '\0')
+			goto invalid_keys;
+	}
+
+	if (diff->nkeys > 0)
+		return;
+
+invalid_keys:
+
+	fprintf(stderr, "invalid diff keys \"%s\"\n", str);
+	exit(1);
+}
+
+static const char *
+field_value(RowType *row, int i)
+{
+	return i < row->nfields ? row->fields[i] : "";
+}
+
+/*
+ * FNV-1a hash of key columns. The values are separated by zero byte.
+ */
+static uint32_t
+key_hash(DiffType *diff, RowType *row)
+{
+	uint32_t	hash = 2166136261u;
+	int			i;
+
+	for (i = 0; i < diff->nkeys; i++)
+	{
+		const unsigned char *ptr = (const unsigned char *) field_value(row, diff->keys[i]);
+
+		do
+		{
+			hash ^= *ptr;
+			hash *= 16777619u;
+		}
+		while (*ptr++);
+	}
+
+	return hash;
+}
+
+static bool
+equal_keys(DiffType *diff, RowType *row1, RowType *row2)
+{
+	int		i;
+
+	for (i = 0; i < diff->nkeys; i++)
+	{
+		if (strcmp(field_value(row1, diff->keys[i]), field_value(row2, diff->keys[i])) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+equal_rows(RowType *row1, RowType *row2)
+{
+	int		i;
+
+	if (row1->nfields != row2->nfields)
+		return false;
+
+	for (i = 0; i < row1->nfields; i++)
+	{
+		if (strcmp(row1->fields[i], row2->fields[i]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns partition of hash. The high bits are used, because the low
+ * bits are used by hash table.
+ */
+static int
+partition_of(DiffType *diff, uint32_t hash)
+{
+	return (int) (((uint64_t) hash * diff->npartitions) >> 32);
+}
+
+static void
+table_insert(DiffTableType *table, uint32_t hash, uint64_t seq, RowType *row)
+{
+	uint32_t	i;
+
+	if ((table->nentries + 1) * 10 > table->size * 7)
+	{
+		DiffEntryType *entries = table->entries;
+		uint32_t	size = table->size;
+		uint32_t	j;
+
+		table->size = size > 0 ? size * 2 : DIFF_TABLE_MIN_SIZE;
+		table->entries = smalloc(table->size * sizeof(DiffEntryType), "DiffEntryType");
+		memset(table->entries, 0, table->size * sizeof(DiffEntryType));
+
+		for (j = 0; j < size; j++)
+		{
+			if (!entries[j].row)
+				continue;
+
+			for (i = entries[j].hash & (table->size - 1);
+				 table->entries[i].row;
+				 i = (i + 1) & (table->size - 1));
+
+			table->entries[i] = entries[j];
+		}
+
+		free(entries);
+	}
+
+	for (i = hash & (table->size - 1);
+		 table->entries[i].row;
+		 i = (i + 1) & (table->size - 1));
+
+	table->entries[i].hash = hash;
+	table->entries[i].matched = false;
+	table->entries[i].seq = seq;
+	table->entries[i].row = row;
+	table->nentries += 1;
+}
+
+/*
+ * Returns not matched entry with same key or NULL.
+ */
+static DiffEntryType *
+table_lookup(DiffType *diff, uint32_t hash, RowType *row)
+{
+	DiffTableType *table = &diff->table;
+	uint32_t	i;
+
+	if (table->size == 0)
+		return NULL;
+
+	for (i = hash & (table->size - 1);
+		 table->entries[i].row;
+		 i = (i + 1) & (table->size - 1))
+	{
+		DiffEntryType *entry = &table->entries[i];
+
+		if (entry->hash == hash && !entry->matched && equal_keys(diff, entry->row, row))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Writes row with its position to temp file.
+ */
+static void
+write_seq_row(FILE *file, int source, uint64_t seq, RowType *row)
+{
+	if (fwrite(&source, sizeof(int), 1, file) != 1 ||
+		fwrite(&seq, sizeof(uint64_t), 1, file) != 1)
+	{
+		fprintf(stderr, "cannot to write temp file: %m\n");
+		exit(1);
+	}
+
+	write_row(file, row);
+}
+
+/*
+ * Reads row written by write_seq_row. Returns NULL on end of file.
+ */
+static RowType *
+read_seq_row(FILE *file, int *source, uint64_t *seq)
+{
+	RowType    *row;
+	long		row_size;
+
+	if (fread(source, sizeof(int), 1, file) != 1)
+		return NULL;
+
+	if (fread(seq, sizeof(uint64_t), 1, file) != 1 ||
+		!(row = read_row(file, &row_size)))
+	{
+		fprintf(stderr, "cannot to read temp file: %m\n");
+		exit(1);
+	}
+
+	return row;
+}
+
+/*
+ * Sends row of result, or stores it to result of current partition.
+ */
+static void
+output_row(DiffType *diff, int source, uint64_t seq, int nfields, char **values)
+{
+	if (diff->result_part)
+	{
+		RowType    *row = smalloc(offsetof(RowType, fields) + nfields * sizeof(char *), "RowType");
+
+		row->nfields = nfields;
+		row->lines = NULL;
+		row->widths = NULL;
+		row->numeric = NULL;
+		memcpy(row->fields, values, nfields * sizeof(char *));
+
+		write_seq_row(diff->result_part, source, seq, row);
+
+		free(row);
+	}
+	else
+		diff->emit(nfields, values, diff->emit_arg);
+}
+
+/*
+ * Sends row of result with kind of change.
+ */
+static void
+emit_row(DiffType *diff, const char *kind, int source, uint64_t seq, RowType *row)
+{
+	char	  **values = smalloc((row->nfields + 1) * sizeof(char *), "values");
+
+	values[0] = (char *) kind;
+	memcpy(values + 1, row->fields, row->nfields * sizeof(char *));
+
+	output_row(diff, source, seq, row->nfields + 1, values);
+
+	free(values);
+}
+
+/*
+ * Sends changed row. The different values are displayed as
+ * "old -> new".
+ */
+static void
+emit_changed_row(DiffType *diff, uint64_t seq, RowType *old_row, RowType *new_row)
+{
+	int		nfields = old_row->nfields > new_row->nfields ? old_row->nfields : new_row->nfields;
+	char  **values = smalloc((nfields + 1) * sizeof(char *), "values");
+	bool   *allocated = smalloc((nfields + 1) * sizeof(bool), "allocated");
+	int		i;
+
+	values[0] = "~";
+	allocated[0] = false;
+
+	for (i = 0; i < nfields; i++)
+	{
+		const char *old_value = field_value(old_row, i);
+		const char *new_value = field_value(new_row, i);
+
+		if (strcmp(old_value, new_value) == 0)
+		{
+			values[i + 1] = (char *) new_value;
+			allocated[i + 1] = false;
+		}
+		else
+		{
+			values[i + 1] = smalloc(strlen(old_value) + strlen(diff->arrow) + strlen(new_value) + 1, "value");
+			sprintf(values[i + 1], "%s%s%s", old_value, diff->arrow, new_value);
+			allocated[i + 1] = true;
+		}
+	}
+
+	output_row(diff, DIFF_STREAMED_ROW, seq, nfields + 1, values);
+
+	for (i = 0; i <= nfields; i++)
+	{
+		if (allocated[i])
+			free(values[i]);
+	}
+
+	free(values);
+	free(allocated);
+}
+
+/*
+ * Compares streamed row with hash table, and sends result.
+ */
+static void
+probe_row(DiffType *diff, uint32_t hash, uint64_t seq, RowType *row)
+{
+	DiffEntryType *entry = table_lookup(diff, hash, row);
+
+	if (!entry)
+		emit_row(diff, diff->hashed_is_old ? "+" : "-", DIFF_STREAMED_ROW, seq, row);
+	else
+	{
+		entry->matched = true;
+
+		if (!equal_rows(entry->row, row))
+		{
+			if (diff->hashed_is_old)
+				emit_changed_row(diff, seq, entry->row, row);
+			else
+				emit_changed_row(diff, seq, row, entry->row);
+		}
+	}
+
+	free_row(row);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+	const DiffEntryType *entry1 = *((DiffEntryType * const *) a);
+	const DiffEntryType *entry2 = *((DiffEntryType * const *) b);
+
+	return entry1->seq < entry2->seq ? -1 : entry1->seq > entry2->seq;
+}
+
+/*
+ * Sends rows of hash table without pair in order of hashed file, and
+ * releases hash table.
+ */
+static void
+flush_table(DiffType *diff)
+{
+	DiffTableType *table = &diff->table;
+	DiffEntryType **unmatched;
+	uint32_t	nunmatched = 0;
+	uint32_t	i;
+
+	unmatched = smalloc((table->nentries + 1) * sizeof(DiffEntryType *), "DiffEntryType");
+
+	for (i = 0; i < table->size; i++)
+	{
+		if (table->entries[i].row && !table->entries[i].matched)
+			unmatched[nunmatched++] = &table->entries[i];
+	}
+
+	qsort(unmatched, nunmatched, sizeof(DiffEntryType *), compare_entries);
+
+	for (i = 0; i < nunmatched; i++)
+		emit_row(diff, diff->hashed_is_old ? "-" : "+", DIFF_HASHED_ROW,
+				 unmatched[i]->seq, unmatched[i]->row);
+
+	for (i = 0; i < table->size; i++)
+	{
+		if (table->entries[i].row)
+			free_row(table->entries[i].row);
+	}
+
+	free(unmatched);
+	free(table->entries);
+
+	table->entries = NULL;
+	table->size = 0;
+	table->nentries = 0;
+}
+
+static FILE *
+create_partition(void)
+{
+	FILE	   *file = tmpfile();
+
+	if (!file)
+	{
+		fprintf(stderr, "cannot to create temp file: %m\n");
+		exit(1);
+	}
+
+	return file;
+}
+
+DiffType *
+diff_init(const char *keys, bool hashed_is_old, int npartitions,
+		  bool unicode, DiffEmitType emit, void *emit_arg)
+{
+	DiffType   *diff = smalloc(sizeof(DiffType), "DiffType");
+	int			i;
+
+	memset(diff, 0, sizeof(DiffType));
+
+	parse_diff_keys(diff, keys);
+
+	diff->hashed_is_old = hashed_is_old;
+	diff->arrow = unicode ? " \342\206\222 " : " -> ";
+	diff->emit = emit;
+	diff->emit_arg = emit_arg;
+	diff->build_first = true;
+	diff->probe_first = true;
+
+	if (npartitions > MAX_DIFF_PARTITIONS)
+		npartitions = MAX_DIFF_PARTITIONS;
+
+	diff->npartitions = npartitions > 1 ? npartitions : 0;
+
+	for (i = 0; i < diff->npartitions; i++)
+	{
+		diff->hashed_parts[i] = create_partition();
+		diff->probed_parts[i] = create_partition();
+	}
+
+	return diff;
+}
+
+static void
+build_row(DiffType *diff, uint64_t seq, RowType *row)
+{
+	uint32_t	hash = key_hash(diff, row);
+
+	if (diff->npartitions > 0)
+	{
+		write_seq_row(diff->hashed_parts[partition_of(diff, hash)], DIFF_HASHED_ROW, seq, row);
+		free_row(row);
+	}
+	else
+		table_insert(&diff->table, hash, seq, row);
+}
+
+/*
+ * Handler of rows of hashed (smaller) file.
+ */
+void
+diff_build_row(RowType *row, bool multiline, void *arg)
+{
+	DiffType   *diff = (DiffType *) arg;
+	uint64_t	seq = diff->build_seq++;
+
+	/* the first row is held, it can be header */
+	if (diff->build_first)
+	{
+		diff->build_first = false;
+		diff->first_row = row;
+		return;
+	}
+
+	build_row(diff, seq, row);
+}
+
+/*
+ * Handler of rows of streamed (larger) file.
+ */
+void
+diff_probe_row(RowType *row, bool multiline, void *arg)
+{
+	DiffType   *diff = (DiffType *) arg;
+	uint64_t	seq;
+	uint32_t	hash;
+
+	if (diff->probe_first)
+	{
+		diff->probe_first = false;
+
+		if (diff->first_row)
+		{
+			RowType    *first_row = diff->first_row;
+
+			diff->first_row = NULL;
+
+			/* same first rows are header */
+			if (equal_rows(first_row, row))
+			{
+				emit_row(diff, "diff", DIFF_STREAMED_ROW, 0, row);
+
+				free_row(first_row);
+				free_row(row);
+
+				return;
+			}
+
+			build_row(diff, 0, first_row);
+		}
+	}
+
+	seq = diff->probe_seq++;
+	hash = key_hash(diff, row);
+
+	if (diff->npartitions > 0)
+	{
+		write_seq_row(diff->probed_parts[partition_of(diff, hash)], DIFF_STREAMED_ROW, seq, row);
+		free_row(row);
+	}
+	else
+		probe_row(diff, hash, seq, row);
+}
+
+/*
+ * Merges sorted results of partitions. The results are stored in files
+ * of hashed partitions.
+ */
+static void
+merge_results(DiffType *diff)
+{
+	RowType    *rows[MAX_DIFF_PARTITIONS];
+	int			sources[MAX_DIFF_PARTITIONS];
+	uint64_t	seqs[MAX_DIFF_PARTITIONS];
+	int			i;
+
+	for (i = 0; i < diff->npartitions; i++)
+	{
+		rewind(diff->hashed_parts[i]);
+		rows[i] = read_seq_row(diff->hashed_parts[i], &sources[i], &seqs[i]);
+	}
+
+	for (;;)
+	{
+		int			min = -1;
+
+		for (i = 0; i < diff->npartitions; i++)
+		{
+			if (rows[i] &&
+				(min == -1 ||
+				 sources[i] < sources[min] ||
+				 (sources[i] == sources[min] && seqs[i] < seqs[min])))
+				min = i;
+		}
+
+		if (min == -1)
+			break;
+
+		diff->emit(rows[min]->nfields, rows[min]->fields, diff->emit_arg);
+		free_row(rows[min]);
+
+		rows[min] = read_seq_row(diff->hashed_parts[min], &sources[min], &seqs[min]);
+	}
+
+	for (i = 0; i < diff->npartitions; i++)
+		fclose(diff->hashed_parts[i]);
+}
+
+/*
+ * Compares partitions, and sends rows of hashed file without pair.
+ */
+void
+diff_finish(DiffType *diff)
+{
+	int		i;
+
+	/* the streamed file was empty */
+	if (diff->first_row)
+	{
+		build_row(diff, 0, diff->first_row);
+		diff->first_row = NULL;
+	}
+
+	if (diff->npartitions == 0)
+	{
+		flush_table(diff);
+		return;
+	}
+
+	for (i = 0; i < diff->npartitions; i++)
+	{
+		FILE	   *hashed_part = diff->hashed_parts[i];
+		RowType    *row;
+		int			source;
+		uint64_t	seq;
+
+		rewind(hashed_part);
+		while ((row = read_seq_row(hashed_part, &source, &seq)))
+			table_insert(&diff->table, key_hash(diff, row), seq, row);
+
+		/* the file of hashed partition is reused for result */
+		rewind(hashed_part);
+		if (ftruncate(fileno(hashed_part), 0) != 0)
+		{
+			fprintf(stderr, "cannot to truncate temp file: %m\n");
+			exit(1);
+		}
+
+		diff->result_part = hashed_part;
+
+		rewind(diff->probed_parts[i]);
+		while ((row = read_seq_row(diff->probed_parts[i], &source, &seq)))
+			probe_row(diff, key_hash(diff, row), seq, row);
+
+		flush_table(diff);
+
+		diff->result_part = NULL;
+
+		fclose(diff->probed_parts[i]);
+	}
+
+	merge_results(diff);
+}
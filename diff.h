@@ -0,0 +1,72 @@
+/*-------------------------------------------------------------------------
+ *
+ * diff.h
+ *	  comparing of two tables by key columns
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  diff.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_DIFF_H
+#define CSV_PRETTY_DIFF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "csv-pretty-format.h"
+
+#define MAX_DIFF_KEYS		16
+#define MAX_DIFF_PARTITIONS	256
+
+/* receiver of rows of result, the first value is kind of change */
+typedef void (*DiffEmitType) (int nfields, char **values, void *arg);
+
+typedef struct
+{
+	uint32_t	hash;
+	bool		matched;
+	uint64_t	seq;			/* position of row in hashed file */
+	RowType	   *row;
+} DiffEntryType;
+
+/*
+ * Open addressing hash table of rows of one file.
+ */
+typedef struct
+{
+	DiffEntryType *entries;
+	uint32_t	size;			/* power of 2 */
+	uint32_t	nentries;
+} DiffTableType;
+
+typedef struct
+{
+	int			keys[MAX_DIFF_KEYS];
+	int			nkeys;
+	bool		hashed_is_old;	/* the hashed file is old file */
+	const char *arrow;			/* separator of old and new value */
+	DiffEmitType emit;
+	void	   *emit_arg;
+	DiffTableType table;
+	RowType	   *first_row;		/* first row of hashed file */
+	bool		build_first;
+	bool		probe_first;
+	uint64_t	build_seq;		/* number of rows of hashed file */
+	uint64_t	probe_seq;		/* number of rows of streamed file */
+	int			npartitions;	/* 0, when rows are not partitioned */
+	FILE	   *hashed_parts[MAX_DIFF_PARTITIONS];
+	FILE	   *probed_parts[MAX_DIFF_PARTITIONS];
+	FILE	   *result_part;	/* target of result of partition or NULL */
+} DiffType;
+
+extern DiffType *diff_init(const char *keys, bool hashed_is_old, int npartitions,
+						   bool unicode, DiffEmitType emit, void *emit_arg);
+extern void diff_build_row(RowType *row, bool multiline, void *arg);
+extern void diff_probe_row(RowType *row, bool multiline, void *arg);
+extern void diff_finish(DiffType *diff);
+
+#endif
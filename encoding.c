@@ -0,0 +1,550 @@
+/*-------------------------------------------------------------------------
+ *
+ * encoding.c
+ *	  detection of input encoding and transcoding to UTF-8
+ *
+ * The encoding is detected by BOM. Without BOM the first block of input
+ * is checked - the input with lot of zero bytes is UTF-16. The input is
+ * UTF-8, when invalid sequences don't clearly outnumber valid multibyte
+ * chars, so few broken chars in UTF-8 text don't change the encoding.
+ * Other input is single byte encoding - cp1250 when there are some
+ * printable chars of cp1250 in range 0x80 .. 0x9F, else latin1.
+ *
+ * UTF-8 input is passed without copying. Other encodings are transcoded
+ * by tables to UTF-8. The runs of ASCII chars are copied by 16 bytes (by
+ * SSE2 when it is available), so the tokenizer gets only UTF-8 and the
+ * rest of processing is not changed.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  encoding.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csv-pretty-format.h"
+#include "encoding.h"
+
+/* the longest UTF-8 form of one input byte (cp1250 0x80 is U+20AC) */
+#define MAX_EXPANSION		3
+
+typedef struct
+{
+	ReaderType	reader;
+	ReaderType *source;
+	int			encoding;
+	char	   *inbuf;
+	int			inlen;
+	int			inpos;				/* only for passed UTF-8 input */
+	char	   *outbuf;
+	int			outlen;
+	int			outpos;
+	bool		eof;
+	char		utf8[256][4];		/* UTF-8 forms of bytes of single byte encoding */
+} EncodingReaderType;
+
+static const unsigned short cp1250_table[128] = {
+	0x20AC, 0xFFFD, 0x201A, 0xFFFD, 0x201E, 0x2026, 0x2020, 0x2021,
+	0xFFFD, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+	0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0xFFFD, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+	0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+	0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+	0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+	0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+	0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+	0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+	0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+	0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+	0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+	0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+	0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+	0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+};
+
+int
+encoding_from_name(const char *name)
+{
+	if (strcmp(name, "auto") == 0)
+		return ENCODING_AUTO;
+	else if (strcmp(name, "utf8") == 0 || strcmp(name, "utf-8") == 0)
+		return ENCODING_UTF8;
+	else if (strcmp(name, "latin1") == 0 || strcmp(name, "iso-8859-1") == 0)
+		return ENCODING_LATIN1;
+	else if (strcmp(name, "cp1250") == 0 || strcmp(name, "windows-1250") == 0)
+		return ENCODING_CP1250;
+	else if (strcmp(name, "utf16le") == 0 || strcmp(name, "utf-16le") == 0)
+		return ENCODING_UTF16LE;
+	else if (strcmp(name, "utf16be") == 0 || strcmp(name, "utf-16be") == 0)
+		return ENCODING_UTF16BE;
+
+	return -1;
+}
+
+/*
+ * Writes UTF-8 form of char, returns number of bytes.
+ */
+static int
+encode_utf8(unsigned int c, char *out)
+{
+	if (c < 0x80)
+	{
+		out[0] = c;
+		return 1;
+	}
+	else if (c < 0x800)
+	{
+		out[0] = 0xC0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3F);
+		return 2;
+	}
+	else if (c < 0x10000)
+	{
+		out[0] = 0xE0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3F);
+		out[2] = 0x80 | (c & 0x3F);
+		return 3;
+	}
+
+	out[0] = 0xF0 | (c >> 18);
+	out[1] = 0x80 | ((c >> 12) & 0x3F);
+	out[2] = 0x80 | ((c >> 6) & 0x3F);
+	out[3] = 0x80 | (c & 0x3F);
+	return 4;
+}
+
+/*
+ * Counts valid multibyte UTF-8 chars and invalid sequences in data.
+ * The not complete char at end of data is valid.
+ */
+static void
+count_utf8(const unsigned char *data, int len, int *valid, int *invalid)
+{
+	int		pos = 0;
+
+	*valid = 0;
+	*invalid = 0;
+
+	while (pos < len)
+	{
+		unsigned char c = data[pos];
+		int		seqlen;
+		int		i;
+
+		if (c < 0x80)
+		{
+			pos++;
+			continue;
+		}
+		else if (c >= 0xC2 && c <= 0xDF)
+			seqlen = 2;
+		else if (c >= 0xE0 && c <= 0xEF)
+			seqlen = 3;
+		else if (c >= 0xF0 && c <= 0xF4)
+			seqlen = 4;
+		else
+		{
+			*invalid += 1;
+			pos++;
+			continue;
+		}
+
+		for (i = 1; i < seqlen && pos + i < len; i++)
+		{
+			if ((data[pos + i] & 0xC0) != 0x80)
+				break;
+		}
+
+		/* the broken sequence is skipped to first not continuation byte */
+		if (i < seqlen && pos + i < len)
+			*invalid += 1;
+		else
+			*valid += 1;
+
+		pos += i;
+	}
+}
+
+/*
+ * Detects encoding by BOM or by content of first block. The length
+ * of BOM is returned in bomlen.
+ */
+static int
+detect_encoding(const unsigned char *data, int len, int *bomlen)
+{
+	int		zeros[2] = {0, 0};
+	int		valid;
+	int		invalid;
+	int		i;
+
+	*bomlen = 0;
+
+	if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+	{
+		*bomlen = 3;
+		return ENCODING_UTF8;
+	}
+	else if (len >= 2 && data[0] == 0xFF && data[1] == 0xFE)
+	{
+		*bomlen = 2;
+		return ENCODING_UTF16LE;
+	}
+	else if (len >= 2 && data[0] == 0xFE && data[1] == 0xFF)
+	{
+		*bomlen = 2;
+		return ENCODING_UTF16BE;
+	}
+
+	/* zero bytes are not in text, but every second byte of ASCII in UTF-16 */
+	for (i = 0; i < len; i++)
+	{
+		if (data[i] == 0)
+			zeros[i & 1] += 1;
+	}
+
+	if (zeros[1] > len / 8 && zeros[1] > zeros[0] * 4)
+		return ENCODING_UTF16LE;
+	if (zeros[0] > len / 8 && zeros[0] > zeros[1] * 4)
+		return ENCODING_UTF16BE;
+
+	/*
+	 * Single byte encoded text has almost only invalid sequences, because
+	 * valid sequence needs accented letter followed by symbol. UTF-8 text
+	 * with some broken chars has more valid chars, so the single byte
+	 * encoding is used only when invalid sequences clearly outnumber
+	 * valid chars.
+	 */
+	count_utf8(data, len, &valid, &invalid);
+	if (invalid <= valid * 2)
+		return ENCODING_UTF8;
+
+	/* latin1 has only control chars in range 0x80 .. 0x9F */
+	for (i = 0; i < len; i++)
+	{
+		if (data[i] >= 0x80 && data[i] <= 0x9F)
+			return ENCODING_CP1250;
+	}
+
+	return ENCODING_LATIN1;
+}
+
+/*
+ * Returns length of ASCII prefix of single byte encoded data.
+ */
+static int
+ascii_prefix(const char *data, int len)
+{
+	int		pos = 0;
+
+#ifdef __SSE2__
+
+	while (pos + 16 <= len)
+	{
+		int		mask;
+
+		mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (data + pos)));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+
+		pos += 16;
+	}
+
+#endif
+
+	while (pos < len && (unsigned char) data[pos] < 0x80)
+		pos++;
+
+	return pos;
+}
+
+static void
+transcode_single_byte(EncodingReaderType *er)
+{
+	const unsigned char *data = (const unsigned char *) er->inbuf;
+	char	   *out = er->outbuf;
+	int		pos = 0;
+
+	while (pos < er->inlen)
+	{
+		int		n = ascii_prefix((const char *) data + pos, er->inlen - pos);
+		const char *utf8;
+
+		if (n > 0)
+		{
+			memcpy(out, data + pos, n);
+			out += n;
+			pos += n;
+			continue;
+		}
+
+		/* the first byte of table entry is length */
+		utf8 = er->utf8[data[pos++]];
+		memcpy(out, utf8 + 1, utf8[0]);
+		out += utf8[0];
+	}
+
+	er->outlen = out - er->outbuf;
+	er->inlen = 0;
+}
+
+static void
+transcode_utf16(EncodingReaderType *er)
+{
+	const unsigned char *data = (const unsigned char *) er->inbuf;
+	bool	le = er->encoding == ENCODING_UTF16LE;
+	char   *out = er->outbuf;
+	int		pos = 0;
+
+	while (pos + 2 <= er->inlen)
+	{
+		unsigned int unit;
+
+#ifdef __SSE2__
+
+		/* eight ASCII chars are packed together */
+		while (pos + 16 <= er->inlen)
+		{
+			__m128i		v = _mm_loadu_si128((const __m128i *) (data + pos));
+
+			if (!le)
+				v = _mm_or_si128(_mm_srli_epi16(v, 8), _mm_slli_epi16(v, 8));
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short) 0xFF80)),
+												  _mm_setzero_si128())) != 0xFFFF)
+				break;
+
+			_mm_storel_epi64((__m128i *) out, _mm_packus_epi16(v, v));
+			out += 8;
+			pos += 16;
+		}
+
+		if (pos + 2 > er->inlen)
+			break;
+
+#endif
+
+		unit = le ? data[pos] | (data[pos + 1] << 8) : (data[pos] << 8) | data[pos + 1];
+
+		if (unit >= 0xD800 && unit <= 0xDBFF)
+		{
+			unsigned int low;
+
+			/* the low surrogate can be in next block */
+			if (pos + 4 > er->inlen)
+			{
+				if (!er->eof)
+					break;
+
+				unit = 0xFFFD;
+				pos += 2;
+			}
+			else
+			{
+				low = le ? data[pos + 2] | (data[pos + 3] << 8) : (data[pos + 2] << 8) | data[pos + 3];
+
+				if (low >= 0xDC00 && low <= 0xDFFF)
+				{
+					unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+					pos += 4;
+				}
+				else
+				{
+					unit = 0xFFFD;
+					pos += 2;
+				}
+			}
+		}
+		else
+		{
+			if (unit >= 0xDC00 && unit <= 0xDFFF)
+				unit = 0xFFFD;
+
+			pos += 2;
+		}
+
+		out += encode_utf8(unit, out);
+	}
+
+	/* odd byte at end of input */
+	if (er->eof && pos < er->inlen && pos + 2 > er->inlen)
+	{
+		out += encode_utf8(0xFFFD, out);
+		pos = er->inlen;
+	}
+
+	er->outlen = out - er->outbuf;
+
+	memmove(er->inbuf, er->inbuf + pos, er->inlen - pos);
+	er->inlen -= pos;
+}
+
+/*
+ * Reads from source to inbuf, and returns false on error.
+ */
+static bool
+fill_inbuf(EncodingReaderType *er)
+{
+	while (!er->eof && er->inlen < INPUT_BLOCK_SIZE)
+	{
+		int		n = er->source->read(er->source, er->inbuf + er->inlen,
+									 INPUT_BLOCK_SIZE - er->inlen);
+
+		if (n < 0)
+			return false;
+		if (n == 0)
+			er->eof = true;
+
+		er->inlen += n;
+
+		/* don't wait for full block, when something can be transcoded */
+		if (er->inlen >= 4)
+			break;
+	}
+
+	return true;
+}
+
+static int
+encoding_read(ReaderType *reader, char *buf, int size)
+{
+	EncodingReaderType *er = (EncodingReaderType *) reader;
+	int		n;
+
+	/* UTF-8 input is passed - only the rest of first block is copied */
+	if (er->encoding == ENCODING_UTF8)
+	{
+		if (er->inpos < er->inlen)
+		{
+			n = er->inlen - er->inpos;
+			if (n > size)
+				n = size;
+
+			memcpy(buf, er->inbuf + er->inpos, n);
+			er->inpos += n;
+
+			return n;
+		}
+
+		return er->source->read(er->source, buf, size);
+	}
+
+	while (er->outpos >= er->outlen)
+	{
+		if (er->eof && er->inlen == 0)
+			return 0;
+
+		if (!fill_inbuf(er))
+			return -1;
+
+		er->outpos = 0;
+		er->outlen = 0;
+
+		if (er->encoding == ENCODING_UTF16LE || er->encoding == ENCODING_UTF16BE)
+			transcode_utf16(er);
+		else
+			transcode_single_byte(er);
+	}
+
+	n = er->outlen - er->outpos;
+	if (n > size)
+		n = size;
+
+	memcpy(buf, er->outbuf + er->outpos, n);
+	er->outpos += n;
+
+	return n;
+}
+
+static void
+encoding_close(ReaderType *reader)
+{
+	EncodingReaderType *er = (EncodingReaderType *) reader;
+
+	if (er->source->close)
+		er->source->close(er->source);
+
+	free(er->inbuf);
+	free(er->outbuf);
+	free(er);
+}
+
+/*
+ * Returns reader, that transcodes source to UTF-8. When encoding is
+ * ENCODING_AUTO, then the encoding is detected. The BOM is removed.
+ */
+ReaderType *
+encoding_reader(ReaderType *source, int encoding)
+{
+	EncodingReaderType *er = malloc(sizeof(EncodingReaderType));
+	int		detected;
+	int		bomlen;
+	int		i;
+
+	if (!er)
+		fatal_error();
+
+	memset(er, 0, sizeof(EncodingReaderType));
+
+	er->reader.read = encoding_read;
+	er->reader.close = encoding_close;
+	er->source = source;
+
+	er->inbuf = malloc(INPUT_BLOCK_SIZE);
+	er->outbuf = malloc(INPUT_BLOCK_SIZE * MAX_EXPANSION);
+	if (!er->inbuf || !er->outbuf)
+		fatal_error();
+
+	/* first block is used for detection */
+	while (!er->eof && er->inlen < INPUT_BLOCK_SIZE)
+	{
+		int		n = source->read(source, er->inbuf + er->inlen,
+								 INPUT_BLOCK_SIZE - er->inlen);
+
+		if (n < 0)
+			input_read_error();
+		if (n == 0)
+			er->eof = true;
+		else
+			er->inlen += n;
+	}
+
+	detected = detect_encoding((const unsigned char *) er->inbuf, er->inlen, &bomlen);
+
+	/* BOM of other encoding is not removed */
+	if (encoding != ENCODING_AUTO && encoding != detected)
+		bomlen = 0;
+	else
+		encoding = detected;
+
+	if (bomlen > 0)
+	{
+		memmove(er->inbuf, er->inbuf + bomlen, er->inlen - bomlen);
+		er->inlen -= bomlen;
+	}
+
+	er->encoding = encoding;
+
+	if (encoding == ENCODING_LATIN1 || encoding == ENCODING_CP1250)
+	{
+		for (i = 0; i < 256; i++)
+		{
+			unsigned int c = i;
+
+			if (i >= 0x80 && encoding == ENCODING_CP1250)
+				c = cp1250_table[i - 0x80];
+
+			er->utf8[i][0] = encode_utf8(c, &er->utf8[i][1]);
+		}
+	}
+
+	return (ReaderType *) er;
+}
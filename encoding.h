@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * encoding.h
+ *	  detection of input encoding and transcoding to UTF-8
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  encoding.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_ENCODING_H
+#define CSV_PRETTY_ENCODING_H
+
+#include "input.h"
+
+#define ENCODING_AUTO			0
+#define ENCODING_UTF8			1
+#define ENCODING_LATIN1			2
+#define ENCODING_CP1250			3
+#define ENCODING_UTF16LE		4
+#define ENCODING_UTF16BE		5
+
+extern int encoding_from_name(const char *name);
+extern ReaderType *encoding_reader(ReaderType *source, int encoding);
+
+#endif
@@ -0,0 +1,323 @@
+/*-------------------------------------------------------------------------
+ *
+ * expanded.c
+ *	  streaming expanded (record per block) output
+ *
+ * Every record is printed as block of lines "column | value" like
+ * expanded mode of psql. The names of columns are taken from first row,
+ * when all its fields are text, else the columns are numbered and the
+ * first row is printed as record. The other rows are not known yet, so
+ * the first row with text only fields is used as header always.
+ *
+ * The layout depends only on widths of names and widths of values of
+ * printed record, so the rows are printed immediately, when they are
+ * parsed, and they are not stored.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  expanded.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "expanded.h"
+#include "spill.h"
+#include "unicode.h"
+
+/* name of column without name in first row is its number */
+#define COLUMN_NUMBER_SIZE		16
+
+ExpandedType *
+expanded_init(FILE *ofile, ConfigType *config)
+{
+	ExpandedType *expanded = smalloc(sizeof(ExpandedType), "ExpandedType");
+
+	memset(expanded, 0, sizeof(ExpandedType));
+
+	expanded->ofile = ofile;
+	expanded->config = config;
+
+	return expanded;
+}
+
+/*
+ * Returns true, when the row can be header - all fields are text
+ * like in header detection of table.
+ */
+static bool
+is_header_row(RowType *row)
+{
+	int		i;
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		if (classify_field(row->fields[i]) != FIELD_TYPE_TEXT)
+			return false;
+	}
+
+	return row->nfields > 0;
+}
+
+static void
+set_names(ExpandedType *expanded, RowType *row)
+{
+	int		i;
+
+	expanded->nnames = row->nfields;
+	expanded->names = smalloc(row->nfields * sizeof(char *), "names");
+	expanded->name_widths = smalloc(row->nfields * sizeof(int), "name widths");
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		expanded->names[i] = smalloc(strlen(row->fields[i]) + 1, "name");
+		strcpy(expanded->names[i], row->fields[i]);
+
+		/* only first line of multiline name is displayed */
+		expanded->name_widths[i] = utf_string_dsplen(row->fields[i],
+													 strcspn(row->fields[i], "\n"));
+	}
+}
+
+static void
+repeat_string(FILE *ofile, const char *str, int n)
+{
+	while (n-- > 0)
+		fputs(str, ofile);
+}
+
+/*
+ * Prints line with number of record. The pos is 't' for first
+ * record, 'm' for others, and 'b' for line after last record.
+ */
+static void
+print_record_line(ExpandedType *expanded, char pos, int name_width, int value_width)
+{
+	FILE	   *ofile = expanded->ofile;
+	int			border = expanded->config->border;
+	bool		unicode = expanded->config->linestyle == 'u';
+	const char *hline = unicode ? "\342\224\200" : "-";
+	char		label[64];
+	int			label_width = 0;
+	int			total;
+
+	if (border == 0)
+	{
+		if (pos != 'b')
+			fprintf(ofile, "* Record %ld\n", expanded->nrecords);
+		return;
+	}
+
+	if (pos == 'b' && border != 2)
+		return;
+
+	if (pos != 'b')
+		label_width = snprintf(label, sizeof(label), "[ RECORD %ld ]", expanded->nrecords);
+
+	/* width of line between borders */
+	total = name_width + value_width + (border == 2 ? 5 : 3);
+
+	if (border == 2)
+	{
+		if (!unicode)
+			fputc('+', ofile);
+		else if (pos == 't')
+			fputs("\342\224\214", ofile);
+		else if (pos == 'm')
+			fputs("\342\224\234", ofile);
+		else
+			fputs("\342\224\224", ofile);
+	}
+
+	if (pos != 'b')
+	{
+		fputs(hline, ofile);
+		fputs(label, ofile);
+		repeat_string(ofile, hline, total - label_width - 1);
+	}
+	else
+	{
+		repeat_string(ofile, hline, name_width + 2);
+		fputs(unicode ? "\342\224\264" : "+", ofile);
+		repeat_string(ofile, hline, value_width + 2);
+	}
+
+	if (border == 2)
+	{
+		if (!unicode)
+			fputc('+', ofile);
+		else if (pos == 't')
+			fputs("\342\224\220", ofile);
+		else if (pos == 'm')
+			fputs("\342\224\244", ofile);
+		else
+			fputs("\342\224\230", ofile);
+	}
+
+	fputc('\n', ofile);
+}
+
+/*
+ * Prints record, the first row with text only fields is not printed,
+ * but it is used as names of columns. The row is not modified, and it
+ * is not released.
+ */
+void
+expanded_print_row(ExpandedType *expanded, RowType *row)
+{
+	FILE	   *ofile = expanded->ofile;
+	int			border = expanded->config->border;
+	const char *vline = expanded->config->linestyle == 'u' ? "\342\224\202" : "|";
+	char		numbuf[COLUMN_NUMBER_SIZE];
+	int			name_width = 0;
+	int			value_width = 0;
+	int			i;
+
+	if (!expanded->first_row_done)
+	{
+		expanded->first_row_done = true;
+
+		if (is_header_row(row))
+		{
+			set_names(expanded, row);
+			return;
+		}
+	}
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		const char *ptr = row->fields[i];
+		int		width;
+
+		if (i < expanded->nnames)
+			width = expanded->name_widths[i];
+		else
+			width = snprintf(numbuf, sizeof(numbuf), "%d", i + 1);
+
+		if (width > name_width)
+			name_width = width;
+
+		/* the width of value is the width of the longest line */
+		for (;;)
+		{
+			int		size = strcspn(ptr, "\n");
+
+			width = size > 0 ? utf_string_dsplen(ptr, size) : 0;
+			if (width > value_width)
+				value_width = width;
+
+			if (ptr[size] == '\0')
+				break;
+
+			ptr += size + 1;
+		}
+	}
+
+	expanded->nrecords += 1;
+
+	/* the line with number of record should not be wider than record */
+	if (border != 0)
+	{
+		int		label_width = snprintf(numbuf, sizeof(numbuf), "%ld", expanded->nrecords) + 11;
+		int		min_width = label_width + 1 - name_width - (border == 2 ? 5 : 3);
+
+		if (value_width < min_width)
+			value_width = min_width;
+	}
+
+	print_record_line(expanded, expanded->nrecords == 1 ? 't' : 'm', name_width, value_width);
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		const char *name;
+		const char *ptr = row->fields[i];
+		int		width;
+		bool	first_line = true;
+
+		if (i < expanded->nnames)
+		{
+			name = expanded->names[i];
+			width = expanded->name_widths[i];
+		}
+		else
+		{
+			width = snprintf(numbuf, sizeof(numbuf), "%d", i + 1);
+			name = numbuf;
+		}
+
+		/* the lines of multiline value have own lines without name */
+		for (;;)
+		{
+			int		size = strcspn(ptr, "\n");
+			bool	last_line = ptr[size] == '\0';
+
+			if (border == 2)
+				fprintf(ofile, "%s ", vline);
+
+			if (first_line)
+			{
+				fwrite(name, 1, strcspn(name, "\n"), ofile);
+				fprintf(ofile, "%*s", name_width - width, "");
+			}
+			else
+				fprintf(ofile, "%*s", name_width, "");
+
+			if (border == 0)
+				fputc(' ', ofile);
+			else
+				fprintf(ofile, " %s ", vline);
+
+			fwrite(ptr, 1, size, ofile);
+
+			if (border == 2)
+			{
+				width = size > 0 ? utf_string_dsplen(ptr, size) : 0;
+				fprintf(ofile, "%*s %s", value_width - width, "", vline);
+			}
+
+			fputc('\n', ofile);
+
+			if (last_line)
+				break;
+
+			ptr += size + 1;
+			first_line = false;
+		}
+	}
+
+	/* the last line of table is printed by expanded_finish */
+	expanded->last_name_width = name_width;
+	expanded->last_value_width = value_width;
+}
+
+/*
+ * Handler of parsed rows - the row is printed and released
+ * immediately. Only the first row can be hold as names of columns.
+ */
+void
+expanded_row(RowType *row, bool multiline, void *arg)
+{
+	ExpandedType *expanded = (ExpandedType *) arg;
+
+	/* the records of truncated file are numbered continuously */
+	if (!row)
+		return;
+
+	expanded_print_row(expanded, row);
+
+	free_row(row);
+}
+
+void
+expanded_finish(ExpandedType *expanded)
+{
+	if (expanded->nrecords == 0)
+		fprintf(expanded->ofile, "(0 rows)\n");
+	else
+		print_record_line(expanded, 'b',
+						  expanded->last_name_width,
+						  expanded->last_value_width);
+}
@@ -0,0 +1,37 @@
+/*-------------------------------------------------------------------------
+ *
+ * expanded.h
+ *	  streaming expanded (record per block) output
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  expanded.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_EXPANDED_H
+#define CSV_PRETTY_EXPANDED_H
+
+#include "csv-pretty-format.h"
+
+typedef struct
+{
+	FILE	   *ofile;
+	ConfigType *config;
+	bool		first_row_done;	/* the first row was checked */
+	char	  **names;			/* fields of first row or NULL */
+	int		   *name_widths;
+	int			nnames;
+	long		nrecords;
+	int			last_name_width;	/* layout of last printed record */
+	int			last_value_width;
+} ExpandedType;
+
+extern ExpandedType *expanded_init(FILE *ofile, ConfigType *config);
+extern void expanded_print_row(ExpandedType *expanded, RowType *row);
+extern void expanded_row(RowType *row, bool multiline, void *arg);
+extern void expanded_finish(ExpandedType *expanded);
+
+#endif
@@ -0,0 +1,190 @@
+/*-------------------------------------------------------------------------
+ *
+ * follow.c
+ *	  reading of growing file
+ *
+ * The reader doesn't return end of input at end of file, but it waits
+ * (by inotify) to appended data. So the tokenizer holds its state (open
+ * string, partial row, detected separator) while it waits, and it
+ * continues by appended bytes. The end of input is returned, when the
+ * file is removed or renamed. When the file is truncated, the reading
+ * starts from begin of file again, and READER_RESTART is returned, so
+ * the tokenizer can forget the state of previous content.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  follow.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "follow.h"
+
+/* the file is checked periodically, when inotify is not available */
+#define FOLLOW_POLL_TIMEOUT		1000
+
+typedef struct
+{
+	ReaderType	reader;
+	int			fd;
+	int			inotify_fd;		/* or -1 */
+	off_t		offset;
+	bool		removed;
+} FollowReaderType;
+
+/*
+ * Waits to change of file. Returns false, when file was removed.
+ */
+static bool
+wait_for_change(FollowReaderType *fr)
+{
+	struct pollfd pfd;
+	char		buf[4096]
+				__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t		n;
+	char	   *ptr;
+
+	if (fr->inotify_fd == -1)
+	{
+		(void) poll(NULL, 0, FOLLOW_POLL_TIMEOUT);
+		return true;
+	}
+
+	pfd.fd = fr->inotify_fd;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, FOLLOW_POLL_TIMEOUT) <= 0)
+		return true;
+
+	n = read(fr->inotify_fd, buf, sizeof(buf));
+	if (n <= 0)
+		return true;
+
+	for (ptr = buf; ptr < buf + n;)
+	{
+		const struct inotify_event *event = (const struct inotify_event *) ptr;
+
+		if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+			return false;
+
+		ptr += sizeof(struct inotify_event) + event->len;
+	}
+
+	return true;
+}
+
+static int
+follow_read(ReaderType *reader, char *buf, int size)
+{
+	FollowReaderType *fr = (FollowReaderType *) reader;
+
+	for (;;)
+	{
+		ssize_t		n;
+		struct stat st;
+
+		n = read(fr->fd, buf, size);
+
+		if (n > 0)
+		{
+			fr->offset += n;
+			return (int) n;
+		}
+		else if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (fr->removed)
+			return 0;
+
+		/* rows printed until now should be visible while waiting */
+		fflush(stdout);
+
+		if (!wait_for_change(fr))
+			fr->removed = true;
+
+		if (fstat(fr->fd, &st) == 0)
+		{
+			/* the removed file is not deleted, while it is opened */
+			if (st.st_nlink == 0)
+				fr->removed = true;
+
+			if (st.st_size < fr->offset && lseek(fr->fd, 0, SEEK_SET) == 0)
+			{
+				fr->offset = 0;
+				return READER_RESTART;
+			}
+		}
+
+		/* data written before removing are read before end */
+	}
+}
+
+static void
+follow_close(ReaderType *reader)
+{
+	FollowReaderType *fr = (FollowReaderType *) reader;
+
+	if (fr->inotify_fd != -1)
+		close(fr->inotify_fd);
+
+	free(fr);
+}
+
+/*
+ * Returns reader of growing file. The path is used for watching of
+ * file. When it is NULL, then the opened file is watched by its link
+ * in proc filesystem.
+ */
+ReaderType *
+follow_reader(FILE *file, const char *path)
+{
+	FollowReaderType *fr;
+	char		procpath[64];
+
+	fr = malloc(sizeof(FollowReaderType));
+	if (!fr)
+		exit(1);
+
+	fr->reader.read = follow_read;
+	fr->reader.close = follow_close;
+	fr->fd = fileno(file);
+	fr->offset = lseek(fr->fd, 0, SEEK_CUR);
+	fr->removed = false;
+
+	if (fr->offset < 0)
+	{
+		fprintf(stderr, "follow mode requires regular file\n");
+		exit(1);
+	}
+
+	if (!path)
+	{
+		snprintf(procpath, sizeof(procpath), "/proc/self/fd/%d", fr->fd);
+		path = procpath;
+	}
+
+	fr->inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (fr->inotify_fd != -1 &&
+		inotify_add_watch(fr->inotify_fd, path,
+						  IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) == -1)
+	{
+		close(fr->inotify_fd);
+		fr->inotify_fd = -1;
+	}
+
+	return (ReaderType *) fr;
+}
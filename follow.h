@@ -0,0 +1,23 @@
+/*-------------------------------------------------------------------------
+ *
+ * follow.h
+ *	  reading of growing file
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  follow.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_FOLLOW_H
+#define CSV_PRETTY_FOLLOW_H
+
+#include <stdio.h>
+
+#include "input.h"
+
+extern ReaderType *follow_reader(FILE *file, const char *path);
+
+#endif
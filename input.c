@@ -0,0 +1,141 @@
+/*-------------------------------------------------------------------------
+ *
+ * input.c
+ *	  block oriented reading of input
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  input.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csv-pretty-format.h"
+#include "input.h"
+
+typedef struct
+{
+	ReaderType	reader;
+	int			fd;
+} FileReaderType;
+
+static int
+file_read(ReaderType *reader, char *buf, int size)
+{
+	FileReaderType *fr = (FileReaderType *) reader;
+
+	for (;;)
+	{
+		ssize_t		n = read(fr->fd, buf, size);
+
+		if (n >= 0)
+			return (int) n;
+
+		if (errno != EINTR)
+			return -1;
+	}
+}
+
+static void
+file_close(ReaderType *reader)
+{
+	free(reader);
+}
+
+/*
+ * Returns reader of opened file. The reader reads directly from
+ * file descriptor, so the file should not be read by stdio API.
+ */
+ReaderType *
+file_reader(FILE *file)
+{
+	FileReaderType *fr;
+
+	fr = malloc(sizeof(FileReaderType));
+	if (!fr)
+		fatal_error();
+
+	fr->reader.read = file_read;
+	fr->reader.close = file_close;
+	fr->fd = fileno(file);
+
+	return (ReaderType *) fr;
+}
+
+void
+input_init(InputType *input, ReaderType *reader)
+{
+	input->reader = reader;
+	input->buffer = malloc(INPUT_BLOCK_SIZE);
+	if (!input->buffer)
+		fatal_error();
+
+	input->len = 0;
+	input->pos = 0;
+	input->eof = false;
+	input->restarted = false;
+}
+
+/*
+ * Reads next block of input, and returns first char of this block or EOF.
+ */
+int
+input_fill(InputType *input)
+{
+	int		n;
+
+	if (input->eof)
+		return EOF;
+
+	n = input->reader->read(input->reader, input->buffer, INPUT_BLOCK_SIZE);
+
+	/* the tokenizer is reset, when it finds this flag */
+	while (n == READER_RESTART)
+	{
+		input->restarted = true;
+		n = input->reader->read(input->reader, input->buffer, INPUT_BLOCK_SIZE);
+	}
+
+	if (n < 0)
+		input_read_error();
+
+	if (n == 0)
+	{
+		input->eof = true;
+		input->len = 0;
+		input->pos = 0;
+
+		return EOF;
+	}
+
+	input->len = n;
+	input->pos = 1;
+
+	return (unsigned char) input->buffer[0];
+}
+
+/*
+ * Reports failed reading of input. The not complete input cannot be
+ * displayed like complete table, so the processing is stopped.
+ */
+void
+input_read_error(void)
+{
+	fprintf(stderr, "cannot to read input: %s\n", strerror(errno));
+	fatal_error();
+}
+
+void
+input_close(InputType *input)
+{
+	if (input->reader->close)
+		input->reader->close(input->reader);
+
+	free(input->buffer);
+}
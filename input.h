@@ -0,0 +1,67 @@
+/*-------------------------------------------------------------------------
+ *
+ * input.h
+ *	  block oriented reading of input
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  input.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_INPUT_H
+#define CSV_PRETTY_INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define INPUT_BLOCK_SIZE		(64 * 1024)
+
+#define READER_RESTART			(-2)
+
+/*
+ * Generic source of input bytes. The read function returns number of
+ * read bytes, 0 on end of input, and -1 on error. The readers can be
+ * stacked - some reader can read from other reader (source). The reader
+ * of growing file returns READER_RESTART, when the file was truncated,
+ * and next bytes are read from begin of file.
+ */
+typedef struct _ReaderType
+{
+	int		(*read) (struct _ReaderType *reader, char *buf, int size);
+	void	(*close) (struct _ReaderType *reader);
+} ReaderType;
+
+/*
+ * Input buffer used by tokenizer. The bytes are taken from buffer
+ * by input_getc macro, and only when the buffer is empty, then the
+ * reader is called.
+ */
+typedef struct
+{
+	ReaderType *reader;
+	char	   *buffer;
+	int			len;
+	int			pos;
+	bool		eof;
+	bool		restarted;		/* input started from begin again */
+} InputType;
+
+extern void input_init(InputType *input, ReaderType *reader);
+extern int input_fill(InputType *input);
+extern void input_close(InputType *input);
+extern void input_read_error(void) __attribute__ ((noreturn));
+
+extern ReaderType *file_reader(FILE *file);
+
+#define input_getc(input) \
+	((input)->pos < (input)->len ? \
+		(unsigned char) (input)->buffer[(input)->pos++] : input_fill(input))
+
+/* only last read char can be returned back */
+#define input_ungetc(c, input) \
+	do { if ((c) != EOF) (input)->pos--; } while (0)
+
+#endif
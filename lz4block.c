@@ -0,0 +1,314 @@
+/*-------------------------------------------------------------------------
+ *
+ * lz4block.c
+ *	  fast block compression (LZ4 block format)
+ *
+ * When it is compiled with HAVE_LIBLZ4, then the blocks are compressed
+ * and decompressed by liblz4. The built-in codec is used without liblz4,
+ * and for blocks larger than liblz4 limit. Both produce standard LZ4
+ * block format, so they can decode data of each other.
+ *
+ * The built-in codec is simple greedy compressor and safe decompressor.
+ * The compressor uses hash table of positions of 4 bytes sequences, and
+ * it doesn't try to find longest match. It is designed for compression
+ * of serialized rows, where the speed is more important than ratio.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  lz4block.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+
+#include "csv-pretty-format.h"
+#include "lz4block.h"
+
+#define MINMATCH		4
+#define LASTLITERALS	5		/* last bytes are always literals */
+#define MFLIMIT			12		/* last match should start before this limit */
+#define MAX_DISTANCE	65535
+
+#define HASH_BITS		16
+
+static uint32_t
+read32(const unsigned char *ptr)
+{
+	uint32_t	result;
+
+	memcpy(&result, ptr, sizeof(uint32_t));
+
+	return result;
+}
+
+static uint32_t
+hash4(uint32_t value)
+{
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static unsigned char *
+write_length(unsigned char *op, size_t len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = (unsigned char) len;
+
+	return op;
+}
+
+static unsigned char *
+write_literals(unsigned char *op, unsigned char *token,
+			   const unsigned char *anchor, size_t litlen)
+{
+	if (litlen >= 15)
+	{
+		*token = 15 << 4;
+		op = write_length(op, litlen - 15);
+	}
+	else
+		*token = (unsigned char) (litlen << 4);
+
+	memcpy(op, anchor, litlen);
+
+	return op + litlen;
+}
+
+static size_t
+builtin_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+static size_t
+builtin_compress(const char *source, size_t size, char *dest)
+{
+	const unsigned char *src = (const unsigned char *) source;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *iend = src + size;
+	unsigned char *op = (unsigned char *) dest;
+	unsigned char *token;
+	uint32_t   *table;
+
+	if (size > MFLIMIT)
+	{
+		const unsigned char *mflimit = iend - MFLIMIT;
+		const unsigned char *matchlimit = iend - LASTLITERALS;
+
+		table = calloc(1 << HASH_BITS, sizeof(uint32_t));
+		if (!table)
+			fatal_error();
+
+		while (ip < mflimit)
+		{
+			uint32_t	seq = read32(ip);
+			uint32_t	h = hash4(seq);
+			const unsigned char *ref = src + table[h];
+
+			table[h] = ip - src;
+
+			if (ref < ip && ip - ref <= MAX_DISTANCE && read32(ref) == seq)
+			{
+				const unsigned char *mstart = ip;
+				size_t		offset = ip - ref;
+				size_t		matchlen;
+
+				ip += MINMATCH;
+				ref += MINMATCH;
+
+				while (ip < matchlimit && *ip == *ref)
+				{
+					ip++;
+					ref++;
+				}
+
+				matchlen = ip - mstart - MINMATCH;
+
+				token = op++;
+				op = write_literals(op, token, anchor, mstart - anchor);
+
+				*op++ = offset & 0xff;
+				*op++ = offset >> 8;
+
+				if (matchlen >= 15)
+				{
+					*token |= 15;
+					op = write_length(op, matchlen - 15);
+				}
+				else
+					*token |= (unsigned char) matchlen;
+
+				anchor = ip;
+			}
+			else
+				ip++;
+		}
+
+		free(table);
+	}
+
+	/* last literals */
+	token = op++;
+	op = write_literals(op, token, anchor, iend - anchor);
+
+	return op - (unsigned char *) dest;
+}
+
+static long
+builtin_decompress(const char *source, size_t size, char *dest, size_t dest_size)
+{
+	const unsigned char *ip = (const unsigned char *) source;
+	const unsigned char *iend = ip + size;
+	unsigned char *op = (unsigned char *) dest;
+	unsigned char *oend = op + dest_size;
+
+	while (ip < iend)
+	{
+		unsigned int token = *ip++;
+		size_t		litlen = token >> 4;
+		size_t		matchlen;
+		size_t		offset;
+		const unsigned char *ref;
+
+		if (litlen == 15)
+		{
+			unsigned int b;
+
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				litlen += b;
+			}
+			while (b == 255);
+		}
+
+		if ((size_t) (iend - ip) < litlen || (size_t) (oend - op) < litlen)
+			return -1;
+
+		memcpy(op, ip, litlen);
+		op += litlen;
+		ip += litlen;
+
+		/* last sequence has only literals */
+		if (ip >= iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t) (op - (unsigned char *) dest))
+			return -1;
+
+		matchlen = token & 15;
+		if (matchlen == 15)
+		{
+			unsigned int b;
+
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				matchlen += b;
+			}
+			while (b == 255);
+		}
+
+		matchlen += MINMATCH;
+
+		if ((size_t) (oend - op) < matchlen)
+			return -1;
+
+		/* the match can overlap output */
+		ref = op - offset;
+		while (matchlen-- > 0)
+			*op++ = *ref++;
+	}
+
+	return op - (unsigned char *) dest;
+}
+
+size_t
+lz4_compress_bound(size_t size)
+{
+
+#ifdef HAVE_LIBLZ4
+
+	if (size <= LZ4_MAX_INPUT_SIZE)
+		return LZ4_compressBound((int) size);
+
+#endif
+
+	return builtin_compress_bound(size);
+}
+
+/*
+ * Compress source to dest. The dest should have lz4_compress_bound
+ * bytes. Returns size of compressed data.
+ */
+size_t
+lz4_compress(const char *source, size_t size, char *dest)
+{
+
+#ifdef HAVE_LIBLZ4
+
+	if (size <= LZ4_MAX_INPUT_SIZE)
+	{
+		int		result = LZ4_compress_default(source, dest, (int) size,
+											  LZ4_compressBound((int) size));
+
+		if (result <= 0)
+		{
+			fprintf(stderr, "cannot to compress data\n");
+			fatal_error();
+		}
+
+		return result;
+	}
+
+#endif
+
+	return builtin_compress(source, size, dest);
+}
+
+/*
+ * Decompress source to dest. Returns size of decompressed data or -1,
+ * when the data are broken.
+ */
+long
+lz4_decompress(const char *source, size_t size, char *dest, size_t dest_size)
+{
+
+#ifdef HAVE_LIBLZ4
+
+	if (size <= INT_MAX && dest_size <= INT_MAX)
+	{
+		int		result = LZ4_decompress_safe(source, dest, (int) size, (int) dest_size);
+
+		return result < 0 ? -1 : result;
+	}
+
+#endif
+
+	return builtin_decompress(source, size, dest, dest_size);
+}
@@ -0,0 +1,23 @@
+/*-------------------------------------------------------------------------
+ *
+ * lz4block.h
+ *	  fast block compression (LZ4 block format)
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  lz4block.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_LZ4BLOCK_H
+#define CSV_PRETTY_LZ4BLOCK_H
+
+#include <stddef.h>
+
+extern size_t lz4_compress_bound(size_t size);
+extern size_t lz4_compress(const char *source, size_t size, char *dest);
+extern long lz4_decompress(const char *source, size_t size, char *dest, size_t dest_size);
+
+#endif
@@ -0,0 +1,403 @@
+/*-------------------------------------------------------------------------
+ *
+ * pipeline.c
+ *	  reader and writer threads connected by lock-free rings
+ *
+ * The reading of input and the writing of output are moved to own
+ * threads, so the main thread (tokenizer and formatter) is not blocked
+ * by IO. The threads are connected by bounded single producer, single
+ * consumer rings of blocks.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  pipeline.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+#define RING_SLOTS			16
+#define RING_BLOCK_SIZE		INPUT_BLOCK_SIZE
+#define RING_SPIN_LOOPS		64
+
+typedef struct
+{
+	char		data[RING_BLOCK_SIZE];
+	int			len;				/* 0 means end of stream, -1 error */
+	int			err;				/* errno of failed reading */
+} RingSlotType;
+
+/*
+ * Bounded SPSC ring. The head is moved only by producer, the tail only
+ * by consumer, so there are not necessary any locks for data. The mutex
+ * and condition variable are used only for parking of waiting side. The
+ * sleepers is incremented under mutex before last check of ring, so the
+ * other side, that moves head or tail and then sees zero sleepers, cannot
+ * miss a sleeping thread.
+ */
+typedef struct
+{
+	RingSlotType slots[RING_SLOTS];
+	atomic_uint	head;
+	atomic_uint	tail;
+	atomic_int	sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} RingType;
+
+typedef struct
+{
+	ReaderType	reader;
+	ReaderType *source;
+	RingType	ring;
+	pthread_t	thread;
+	char	   *data;				/* not consumed data of current slot */
+	int			len;
+	bool		eof;
+} PipelineReaderType;
+
+typedef struct
+{
+	FILE	   *target;
+	RingType	ring;
+	pthread_t	thread;
+} PipelineWriterType;
+
+static void *
+ring_alloc(size_t size)
+{
+	void	   *result = calloc(1, size);
+
+	if (!result)
+		exit(1);
+
+	return result;
+}
+
+static void
+ring_init(RingType *ring)
+{
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+}
+
+static void
+ring_destroy(RingType *ring)
+{
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->cond);
+}
+
+static bool
+ring_is_full(RingType *ring, unsigned int head)
+{
+	return head - atomic_load(&ring->tail) >= RING_SLOTS;
+}
+
+static bool
+ring_is_empty(RingType *ring, unsigned int tail)
+{
+	return atomic_load(&ring->head) == tail;
+}
+
+/*
+ * Waits until the ring is not blocked. Spins for short time, because
+ * the other side is usually fast, and then sleeps.
+ */
+static void
+ring_wait(RingType *ring,
+		  bool (*is_blocked) (RingType *ring, unsigned int pos),
+		  unsigned int pos)
+{
+	int			i;
+
+	for (i = 0; i < RING_SPIN_LOOPS; i++)
+	{
+		if (!is_blocked(ring, pos))
+			return;
+
+		sched_yield();
+	}
+
+	pthread_mutex_lock(&ring->lock);
+	atomic_fetch_add(&ring->sleepers, 1);
+
+	while (is_blocked(ring, pos))
+		pthread_cond_wait(&ring->cond, &ring->lock);
+
+	atomic_fetch_sub(&ring->sleepers, 1);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * Wakes up the other side, when it sleeps.
+ */
+static void
+ring_wakeup(RingType *ring)
+{
+	if (atomic_load(&ring->sleepers) > 0)
+	{
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+/*
+ * Returns free slot for producer. Waits when the ring is full.
+ */
+static RingSlotType *
+ring_produce_begin(RingType *ring)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	ring_wait(ring, ring_is_full, head);
+
+	return &ring->slots[head % RING_SLOTS];
+}
+
+static void
+ring_produce_end(RingType *ring)
+{
+	atomic_fetch_add(&ring->head, 1);
+	ring_wakeup(ring);
+}
+
+/*
+ * Returns filled slot for consumer. Waits when the ring is empty.
+ */
+static RingSlotType *
+ring_consume_begin(RingType *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	ring_wait(ring, ring_is_empty, tail);
+
+	return &ring->slots[tail % RING_SLOTS];
+}
+
+static void
+ring_consume_end(RingType *ring)
+{
+	atomic_fetch_add(&ring->tail, 1);
+	ring_wakeup(ring);
+}
+
+static void *
+reader_thread(void *arg)
+{
+	PipelineReaderType *pr = (PipelineReaderType *) arg;
+	int			len;
+
+	do
+	{
+		RingSlotType *slot = ring_produce_begin(&pr->ring);
+
+		len = pr->source->read(pr->source, slot->data, RING_BLOCK_SIZE);
+
+		/* the error is reported by consumer */
+		slot->len = len >= 0 ? len : -1;
+		slot->err = errno;
+
+		ring_produce_end(&pr->ring);
+	}
+	while (len > 0);
+
+	return NULL;
+}
+
+static int
+pipeline_read(ReaderType *reader, char *buf, int size)
+{
+	PipelineReaderType *pr = (PipelineReaderType *) reader;
+	RingSlotType *slot;
+	int			n;
+
+	if (pr->eof)
+		return 0;
+
+	slot = ring_consume_begin(&pr->ring);
+
+	/* the reader thread is finished after end of input or error */
+	if (slot->len <= 0)
+	{
+		n = slot->len;
+		errno = slot->err;
+
+		pr->eof = true;
+		ring_consume_end(&pr->ring);
+		return n;
+	}
+
+	if (!pr->data)
+	{
+		pr->data = slot->data;
+		pr->len = slot->len;
+	}
+
+	n = size < pr->len ? size : pr->len;
+	memcpy(buf, pr->data, n);
+
+	pr->data += n;
+	pr->len -= n;
+
+	if (pr->len == 0)
+	{
+		pr->data = NULL;
+		ring_consume_end(&pr->ring);
+	}
+
+	return n;
+}
+
+static void
+pipeline_reader_close(ReaderType *reader)
+{
+	PipelineReaderType *pr = (PipelineReaderType *) reader;
+
+	/* the reader thread can be stopped only after end of input */
+	while (!pr->eof)
+	{
+		char	buf[1024];
+
+		(void) pipeline_read(reader, buf, sizeof(buf));
+	}
+
+	pthread_join(pr->thread, NULL);
+
+	if (pr->source->close)
+		pr->source->close(pr->source);
+
+	ring_destroy(&pr->ring);
+	free(pr);
+}
+
+/*
+ * Returns reader, that reads source in own thread.
+ */
+ReaderType *
+pipeline_reader(ReaderType *source)
+{
+	PipelineReaderType *pr = ring_alloc(sizeof(PipelineReaderType));
+
+	pr->reader.read = pipeline_read;
+	pr->reader.close = pipeline_reader_close;
+	pr->source = source;
+	ring_init(&pr->ring);
+
+	if (pthread_create(&pr->thread, NULL, reader_thread, pr) != 0)
+	{
+		fprintf(stderr, "cannot to create reader thread\n");
+		exit(1);
+	}
+
+	return (ReaderType *) pr;
+}
+
+static void *
+writer_thread(void *arg)
+{
+	PipelineWriterType *pw = (PipelineWriterType *) arg;
+
+	for (;;)
+	{
+		RingSlotType *slot = ring_consume_begin(&pw->ring);
+		int			len = slot->len;
+
+		if (len > 0)
+			fwrite(slot->data, 1, len, pw->target);
+
+		ring_consume_end(&pw->ring);
+
+		if (len == 0)
+			break;
+	}
+
+	fflush(pw->target);
+
+	return NULL;
+}
+
+static ssize_t
+pipeline_write(void *cookie, const char *buf, size_t size)
+{
+	PipelineWriterType *pw = (PipelineWriterType *) cookie;
+	size_t		written = 0;
+
+	while (written < size)
+	{
+		RingSlotType *slot = ring_produce_begin(&pw->ring);
+		size_t		n = size - written;
+
+		if (n > RING_BLOCK_SIZE)
+			n = RING_BLOCK_SIZE;
+
+		memcpy(slot->data, buf + written, n);
+		slot->len = n;
+
+		ring_produce_end(&pw->ring);
+
+		written += n;
+	}
+
+	return written;
+}
+
+static int
+pipeline_writer_close(void *cookie)
+{
+	PipelineWriterType *pw = (PipelineWriterType *) cookie;
+	RingSlotType *slot;
+
+	slot = ring_produce_begin(&pw->ring);
+	slot->len = 0;
+	ring_produce_end(&pw->ring);
+
+	pthread_join(pw->thread, NULL);
+
+	ring_destroy(&pw->ring);
+	free(pw);
+
+	return 0;
+}
+
+/*
+ * Returns stream, that is written to target by own thread. The stream
+ * should be closed by fclose, that waits on writing all data.
+ */
+FILE *
+pipeline_writer(FILE *target)
+{
+	PipelineWriterType *pw = ring_alloc(sizeof(PipelineWriterType));
+	cookie_io_functions_t funcs = {NULL, pipeline_write, NULL, pipeline_writer_close};
+	FILE	   *result;
+
+	pw->target = target;
+	ring_init(&pw->ring);
+
+	if (pthread_create(&pw->thread, NULL, writer_thread, pw) != 0)
+	{
+		fprintf(stderr, "cannot to create writer thread\n");
+		exit(1);
+	}
+
+	result = fopencookie(pw, "w", funcs);
+	if (!result)
+		exit(1);
+
+	setvbuf(result, NULL, _IOFBF, RING_BLOCK_SIZE);
+
+	return result;
+}
@@ -0,0 +1,24 @@
+/*-------------------------------------------------------------------------
+ *
+ * pipeline.h
+ *	  reader and writer threads connected by lock-free rings
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  pipeline.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_PIPELINE_H
+#define CSV_PRETTY_PIPELINE_H
+
+#include <stdio.h>
+
+#include "input.h"
+
+extern ReaderType *pipeline_reader(ReaderType *source);
+extern FILE *pipeline_writer(FILE *target);
+
+#endif
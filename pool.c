@@ -0,0 +1,195 @@
+/*-------------------------------------------------------------------------
+ *
+ * pool.c
+ *	  work-stealing pool of threads
+ *
+ * The tasks are identified by numbers 0 .. ntasks - 1. Every worker has
+ * own queue of tasks, the tasks are distributed round robin, so the
+ * first tasks are processed first. The worker takes tasks from start of
+ * own queue, and when its queue is empty, it steals task from end of
+ * queue of other worker. The tasks are coarse (one file), so the queues
+ * are protected by mutexes.
+ *
+ * The caller can wait for completion of any task, so the results can be
+ * consumed in order of tasks, while other tasks are processed.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  pool.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "csv-pretty-format.h"
+
+typedef struct
+{
+	pthread_t	thread;
+	pthread_mutex_t mutex;
+	int		   *tasks;
+	int			head;			/* next own task */
+	int			tail;			/* after last task */
+	int			workerno;
+	PoolType   *pool;
+} PoolWorkerType;
+
+struct _PoolType
+{
+	PoolTaskType task;
+	void	   *arg;
+	int			ntasks;
+	int			nthreads;
+	PoolWorkerType *workers;
+	bool	   *done;
+	pthread_mutex_t done_mutex;
+	pthread_cond_t done_cond;
+};
+
+/*
+ * Returns next task of worker - own or stolen, or -1, when all
+ * queues are empty.
+ */
+static int
+next_task(PoolWorkerType *worker)
+{
+	PoolType   *pool = worker->pool;
+	int			taskno = -1;
+	int			i;
+
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->head < worker->tail)
+		taskno = worker->tasks[worker->head++];
+	pthread_mutex_unlock(&worker->mutex);
+
+	for (i = 1; taskno == -1 && i < pool->nthreads; i++)
+	{
+		PoolWorkerType *victim = &pool->workers[(worker->workerno + i) % pool->nthreads];
+
+		pthread_mutex_lock(&victim->mutex);
+		if (victim->head < victim->tail)
+			taskno = victim->tasks[--victim->tail];
+		pthread_mutex_unlock(&victim->mutex);
+	}
+
+	return taskno;
+}
+
+static void *
+pool_worker(void *arg)
+{
+	PoolWorkerType *worker = (PoolWorkerType *) arg;
+	PoolType   *pool = worker->pool;
+	int			taskno;
+
+	while ((taskno = next_task(worker)) != -1)
+	{
+		pool->task(taskno, pool->arg);
+
+		pthread_mutex_lock(&pool->done_mutex);
+		pool->done[taskno] = true;
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->done_mutex);
+	}
+
+	return NULL;
+}
+
+/*
+ * Starts nthreads threads, that process ntasks tasks.
+ */
+PoolType *
+pool_start(int ntasks, int nthreads, PoolTaskType task, void *arg)
+{
+	PoolType   *pool = smalloc(sizeof(PoolType), "PoolType");
+	int			i;
+
+	if (nthreads > ntasks)
+		nthreads = ntasks;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	pool->task = task;
+	pool->arg = arg;
+	pool->ntasks = ntasks;
+	pool->nthreads = nthreads;
+
+	pool->done = smalloc(ntasks * sizeof(bool), "done");
+	memset(pool->done, 0, ntasks * sizeof(bool));
+
+	pthread_mutex_init(&pool->done_mutex, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->workers = smalloc(nthreads * sizeof(PoolWorkerType), "PoolWorkerType");
+
+	for (i = 0; i < nthreads; i++)
+	{
+		PoolWorkerType *worker = &pool->workers[i];
+		int		j;
+
+		pthread_mutex_init(&worker->mutex, NULL);
+		worker->tasks = smalloc((ntasks / nthreads + 1) * sizeof(int), "tasks");
+		worker->head = 0;
+		worker->tail = 0;
+		worker->workerno = i;
+		worker->pool = pool;
+
+		for (j = i; j < ntasks; j += nthreads)
+			worker->tasks[worker->tail++] = j;
+	}
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&pool->workers[i].thread, NULL, pool_worker, &pool->workers[i]) != 0)
+		{
+			fprintf(stderr, "cannot to create thread\n");
+			exit(1);
+		}
+	}
+
+	return pool;
+}
+
+/*
+ * Waits until the task is processed.
+ */
+void
+pool_wait(PoolType *pool, int taskno)
+{
+	pthread_mutex_lock(&pool->done_mutex);
+
+	while (!pool->done[taskno])
+		pthread_cond_wait(&pool->done_cond, &pool->done_mutex);
+
+	pthread_mutex_unlock(&pool->done_mutex);
+}
+
+/*
+ * Waits for end of all threads, and releases pool.
+ */
+void
+pool_finish(PoolType *pool)
+{
+	int		i;
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		pthread_join(pool->workers[i].thread, NULL);
+		pthread_mutex_destroy(&pool->workers[i].mutex);
+		free(pool->workers[i].tasks);
+	}
+
+	pthread_mutex_destroy(&pool->done_mutex);
+	pthread_cond_destroy(&pool->done_cond);
+
+	free(pool->workers);
+	free(pool->done);
+	free(pool);
+}
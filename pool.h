@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * pool.h
+ *	  work-stealing pool of threads
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  pool.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_POOL_H
+#define CSV_PRETTY_POOL_H
+
+typedef void (*PoolTaskType) (int taskno, void *arg);
+
+typedef struct _PoolType PoolType;
+
+extern PoolType *pool_start(int ntasks, int nthreads, PoolTaskType task, void *arg);
+extern void pool_wait(PoolType *pool, int taskno);
+extern void pool_finish(PoolType *pool);
+
+#endif
@@ -0,0 +1,303 @@
+/*-------------------------------------------------------------------------
+ *
+ * shape.c
+ *	  fast counting of records and fields without parsing
+ *
+ * The input is processed in 64 bytes chunks. For every chunk there are
+ * calculated bitmaps of quotes, newlines, separators and other chars
+ * (by SSE2 when it is available). The bitmap of chars inside strings is
+ * calculated as prefix xor of quotes bitmap, so the newlines and the
+ * separators inside quoted fields are ignored, and multiline fields are
+ * counted correctly. The rules are same like rules of parse_csv: the
+ * separator is first char ',', ';' or '|' outside string, and the empty
+ * rows (rows without stored chars) are not counted.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  shape.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shape.h"
+
+#define CHUNK_SIZE		64
+
+typedef struct
+{
+	uint64_t	quotes;
+	uint64_t	newlines;
+	uint64_t	spaces;
+	uint64_t	commas;
+	uint64_t	semicolons;
+	uint64_t	pipes;
+} ChunkMasksType;
+
+typedef struct
+{
+	bool		instr;			/* the chunk starts inside string */
+	int			separator;
+	int			nseparators;	/* separators of current row */
+	bool		stored;			/* current row has some stored char */
+	bool		quoted;			/* current row has some quote */
+	int			tail;			/* chars after first quote of row */
+} ScanStateType;
+
+#ifdef __SSE2__
+
+static uint64_t
+eq_mask(__m128i v[4], char c)
+{
+	__m128i		cv = _mm_set1_epi8(c);
+	uint64_t	result;
+
+	result = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[0], cv));
+	result |= (uint64_t) (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[1], cv)) << 16;
+	result |= (uint64_t) (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[2], cv)) << 32;
+	result |= (uint64_t) (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[3], cv)) << 48;
+
+	return result;
+}
+
+static void
+chunk_masks(const char *ptr, ChunkMasksType *masks)
+{
+	__m128i		v[4];
+
+	v[0] = _mm_loadu_si128((const __m128i *) ptr);
+	v[1] = _mm_loadu_si128((const __m128i *) (ptr + 16));
+	v[2] = _mm_loadu_si128((const __m128i *) (ptr + 32));
+	v[3] = _mm_loadu_si128((const __m128i *) (ptr + 48));
+
+	masks->quotes = eq_mask(v, '"');
+	masks->newlines = eq_mask(v, '\n');
+	masks->spaces = eq_mask(v, ' ');
+	masks->commas = eq_mask(v, ',');
+	masks->semicolons = eq_mask(v, ';');
+	masks->pipes = eq_mask(v, '|');
+}
+
+#else
+
+static void
+chunk_masks(const char *ptr, ChunkMasksType *masks)
+{
+	int		i;
+
+	memset(masks, 0, sizeof(ChunkMasksType));
+
+	for (i = 0; i < CHUNK_SIZE; i++)
+	{
+		uint64_t	bit = (uint64_t) 1 << i;
+
+		switch (ptr[i])
+		{
+			case '"':
+				masks->quotes |= bit;
+				break;
+			case '\n':
+				masks->newlines |= bit;
+				break;
+			case ' ':
+				masks->spaces |= bit;
+				break;
+			case ',':
+				masks->commas |= bit;
+				break;
+			case ';':
+				masks->semicolons |= bit;
+				break;
+			case '|':
+				masks->pipes |= bit;
+				break;
+		}
+	}
+}
+
+#endif
+
+/*
+ * Returns mask of bits from start (inclusive) to end (exclusive).
+ */
+static uint64_t
+range_mask(int start, int end)
+{
+	uint64_t	upper = end >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << end) - 1;
+	uint64_t	lower = start >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << start) - 1;
+
+	return upper & ~lower;
+}
+
+static void
+end_row(ScanStateType *state, ShapeType *shape)
+{
+	/*
+	 * The row without other chars than spaces and quotes is empty,
+	 * when there are only leading spaces and an empty string.
+	 */
+	if (state->stored || state->tail > 2)
+	{
+		int		nfields = state->nseparators + 1;
+
+		if (shape->records == 0 || nfields < shape->min_fields)
+			shape->min_fields = nfields;
+		if (shape->records == 0 || nfields > shape->max_fields)
+			shape->max_fields = nfields;
+
+		shape->records += 1;
+	}
+
+	state->nseparators = 0;
+	state->stored = false;
+	state->quoted = false;
+	state->tail = 0;
+}
+
+/*
+ * Process n (<= CHUNK_SIZE) chars of one chunk.
+ */
+static void
+scan_chunk(const char *ptr, int n, ChunkMasksType *masks,
+		   ScanStateType *state, ShapeType *shape)
+{
+	uint64_t	valid = range_mask(0, n);
+	uint64_t	instr;
+	uint64_t	newlines;
+	uint64_t	separators;
+	uint64_t	others;
+	int			start = 0;
+
+	/* prefix xor of quotes - bits of chars after odd number of quotes */
+	instr = masks->quotes;
+	instr ^= instr << 1;
+	instr ^= instr << 2;
+	instr ^= instr << 4;
+	instr ^= instr << 8;
+	instr ^= instr << 16;
+	instr ^= instr << 32;
+
+	if (state->instr)
+		instr = ~instr;
+
+	state->instr = (__builtin_popcountll(masks->quotes) & 1) ? !state->instr : state->instr;
+
+	newlines = masks->newlines & ~instr & valid;
+
+	if (state->separator == -1)
+	{
+		uint64_t	candidates;
+
+		candidates = (masks->commas | masks->semicolons | masks->pipes) & ~instr & valid;
+		if (candidates)
+			state->separator = ptr[__builtin_ctzll(candidates)];
+	}
+
+	if (state->separator == ',')
+		separators = masks->commas;
+	else if (state->separator == ';')
+		separators = masks->semicolons;
+	else if (state->separator == '|')
+		separators = masks->pipes;
+	else
+		separators = 0;
+
+	separators &= ~instr & valid;
+
+	/* the newlines inside string are stored too */
+	others = valid & ~masks->spaces & ~masks->quotes & ~newlines;
+
+	for (;;)
+	{
+		int			end = newlines ? __builtin_ctzll(newlines) : CHUNK_SIZE;
+		uint64_t	row = range_mask(start, end) & valid;
+
+		state->nseparators += __builtin_popcountll(separators & row);
+
+		if (others & row)
+			state->stored = true;
+		else if (!state->stored)
+		{
+			if (state->quoted)
+				state->tail += __builtin_popcountll(row);
+			else if (masks->quotes & row)
+			{
+				int		first = __builtin_ctzll(masks->quotes & row);
+
+				state->tail += __builtin_popcountll(row & range_mask(first, CHUNK_SIZE));
+				state->quoted = true;
+			}
+		}
+
+		if (!newlines)
+			break;
+
+		end_row(state, shape);
+
+		start = end + 1;
+		newlines &= newlines - 1;
+	}
+}
+
+/*
+ * Counts records and fields of input. The separator can be -1, then
+ * it is detected.
+ */
+void
+count_shape(InputType *input, int separator, ShapeType *shape)
+{
+	ScanStateType state;
+	ChunkMasksType masks;
+	int			c;
+
+	memset(&state, 0, sizeof(state));
+	state.separator = separator;
+
+	memset(shape, 0, sizeof(ShapeType));
+
+	for (;;)
+	{
+		const char *ptr = input->buffer + input->pos;
+		const char *end = input->buffer + input->len;
+
+		while (end - ptr >= CHUNK_SIZE)
+		{
+			chunk_masks(ptr, &masks);
+			scan_chunk(ptr, CHUNK_SIZE, &masks, &state, shape);
+			ptr += CHUNK_SIZE;
+		}
+
+		if (ptr < end)
+		{
+			char		buffer[CHUNK_SIZE];
+
+			/* rest of block is zero padded */
+			memset(buffer, 0, CHUNK_SIZE);
+			memcpy(buffer, ptr, end - ptr);
+
+			chunk_masks(buffer, &masks);
+			scan_chunk(buffer, end - ptr, &masks, &state, shape);
+		}
+
+		input->pos = input->len;
+
+		c = input_fill(input);
+		if (c == EOF)
+			break;
+
+		input_ungetc(c, input);
+	}
+
+	/* last row is closed by end of input */
+	end_row(&state, shape);
+
+	shape->separator = state.separator;
+}
@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * shape.h
+ *	  fast counting of records and fields without parsing
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  shape.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_SHAPE_H
+#define CSV_PRETTY_SHAPE_H
+
+#include "input.h"
+
+typedef struct
+{
+	long		records;		/* number of not empty rows */
+	int			min_fields;
+	int			max_fields;
+	int			separator;		/* detected separator or -1 */
+} ShapeType;
+
+extern void count_shape(InputType *input, int separator, ShapeType *shape);
+
+#endif
@@ -0,0 +1,612 @@
+/*-------------------------------------------------------------------------
+ *
+ * sort.c
+ *	  sorting of rows by columns with bounded memory
+ *
+ * The rows are collected in memory. When they need more memory than is
+ * allowed, then they are sorted and written to temp file (run). At the
+ * end the runs and the rows in memory are merged by k-way merge, and
+ * the result is stored to row buckets (that can be spilled too).
+ *
+ * The values of columns are compared as numbers or as case folded text
+ * (by utf8_tofold). The prefix of first key is calculated before sorting
+ * as 64bit integer (order preserving bits of double or first three case
+ * folded chars), so most comparisons don't need to touch the fields.
+ *
+ * When the number of rows is limited, then the rows are hold in heap
+ * (the worst row is on top), and only limit rows are in memory. The runs
+ * are not used in this case.
+ *
+ * The first row is not sorted, when it is header.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  sort.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort.h"
+#include "spill.h"
+#include "unicode.h"
+
+/*
+ * Source of sorted rows for merge - first row, run or rows in memory.
+ */
+typedef struct
+{
+	SortItemType head;
+	bool		has_head;
+	FILE	   *file;
+	SortItemType *items;
+	int			nitems;
+	int			pos;
+} MergeSourceType;
+
+/*
+ * Parses list of sort keys like "3n,-1" - the number of column, optional
+ * "-" for descending order and optional "n" for numeric comparison.
+ */
+static void
+parse_sort_keys(SorterType *sorter, const char *str)
+{
+	const char *ptr = str;
+
+	sorter->nkeys = 0;
+
+	while (*ptr)
+	{
+		SortKeyType *key;
+		char	   *endptr;
+		long		column;
+
+		if (sorter->nkeys >= MAX_SORT_KEYS)
+			goto invalid_keys;
+
+		key = &sorter->keys[sorter->nkeys++];
+
+		key->descending = *ptr == '-';
+		if (key->descending)
+			ptr++;
+
+		if (!isdigit((unsigned char) *ptr))
+			goto invalid_keys;
+
+		column = strtol(ptr, &endptr, 10);
+		if (column < 1 || column > 1024)
+			goto invalid_keys;
+
+		key->column = column - 1;
+		ptr = endptr;
+
+		key->numeric = *ptr == 'n';
+		if (key->numeric)
+			ptr++;
+
+		if (*ptr == ',')
+		{
+			ptr++;
+			if (*ptr == '\0')
+				goto invalid_keys;
+		}
+		else if (*ptr != '\0')
+			goto invalid_keys;
+	}
+
+	if (sorter->nkeys > 0)
+		return;
+
+invalid_keys:
+
+	fprintf(stderr, "invalid sort keys \"%s\"\n", str);
+	exit(1);
+}
+
+static const char *
+key_field(RowType *row, int column)
+{
+	return column < row->nfields ? row->fields[column] : "";
+}
+
+static bool
+number_value(const char *str, double *value)
+{
+	if (!FIELD_TYPE_IS_NUMERIC(classify_field(str)))
+		return false;
+
+	*value = strtod(str, NULL);
+
+	return true;
+}
+
+/*
+ * Values that are not numbers are sorted before numbers.
+ */
+static uint64_t
+key_prefix(SortKeyType *key, RowType *row)
+{
+	const char *field = key_field(row, key->column);
+	uint64_t	result = 0;
+
+	if (key->numeric)
+	{
+		double		value;
+
+		if (number_value(field, &value))
+		{
+			memcpy(&result, &value, sizeof(uint64_t));
+
+			/* the bits of double are ordered like unsigned integers */
+			if (result & ((uint64_t) 1 << 63))
+				result = ~result;
+			else
+				result |= (uint64_t) 1 << 63;
+		}
+	}
+	else
+	{
+		int		i;
+
+		/* three chars by 21 bits, shorter strings have zeros */
+		for (i = 0; i < 3; i++)
+		{
+			result <<= 21;
+
+			if (*field)
+			{
+				result |= utf8_tofold(field) & 0x1FFFFF;
+				field += utf8charlen(*field);
+			}
+		}
+	}
+
+	return result;
+}
+
+static int
+compare_text(const char *a, const char *b)
+{
+	while (*a && *b)
+	{
+		int		fa = utf8_tofold(a);
+		int		fb = utf8_tofold(b);
+
+		if (fa != fb)
+			return fa < fb ? -1 : 1;
+
+		a += utf8charlen(*a);
+		b += utf8charlen(*b);
+	}
+
+	return *a ? 1 : (*b ? -1 : 0);
+}
+
+static int
+compare_key(SortKeyType *key, RowType *a, RowType *b)
+{
+	const char *fa = key_field(a, key->column);
+	const char *fb = key_field(b, key->column);
+
+	if (key->numeric)
+	{
+		double		va, vb;
+		bool		isnum_a = number_value(fa, &va);
+		bool		isnum_b = number_value(fb, &vb);
+
+		if (isnum_a != isnum_b)
+			return isnum_a ? 1 : -1;
+
+		if (!isnum_a || va == vb)
+			return 0;
+
+		return va < vb ? -1 : 1;
+	}
+
+	return compare_text(fa, fb);
+}
+
+static int
+compare_items(SorterType *sorter, SortItemType *a, SortItemType *b)
+{
+	int		result;
+	int		i;
+
+	/* the prefix of numeric key is exact */
+	if (a->prefix != b->prefix)
+		result = a->prefix < b->prefix ? -1 : 1;
+	else if (!sorter->keys[0].numeric)
+		result = compare_key(&sorter->keys[0], a->row, b->row);
+	else
+		result = 0;
+
+	if (result != 0)
+		return sorter->keys[0].descending ? -result : result;
+
+	for (i = 1; i < sorter->nkeys; i++)
+	{
+		result = compare_key(&sorter->keys[i], a->row, b->row);
+		if (result != 0)
+			return sorter->keys[i].descending ? -result : result;
+	}
+
+	return 0;
+}
+
+static int
+compare_items_stable(const void *a, const void *b, void *arg)
+{
+	const SortItemType *ia = (const SortItemType *) a;
+	const SortItemType *ib = (const SortItemType *) b;
+	int		result;
+
+	result = compare_items((SorterType *) arg, (SortItemType *) ia, (SortItemType *) ib);
+	if (result != 0)
+		return result;
+
+	return ia->seqno < ib->seqno ? -1 : (ia->seqno > ib->seqno ? 1 : 0);
+}
+
+static void
+set_item(SorterType *sorter, SortItemType *item, RowType *row, bool multiline, long row_size)
+{
+	item->row = row;
+	item->multiline = multiline;
+	item->row_size = row_size;
+	item->seqno = sorter->seqno++;
+	item->prefix = key_prefix(&sorter->keys[0], row);
+}
+
+/*
+ * Writes sorted rows from memory to new run.
+ */
+static void
+write_run(SorterType *sorter)
+{
+	FILE	   *file;
+	int			i;
+
+	qsort_r(sorter->items, sorter->nitems, sizeof(SortItemType),
+			compare_items_stable, sorter);
+
+	file = tmpfile();
+	if (!file)
+	{
+		fprintf(stderr, "cannot to create temp file: %m\n");
+		exit(1);
+	}
+
+	for (i = 0; i < sorter->nitems; i++)
+	{
+		write_row(file, sorter->items[i].row);
+		free_row(sorter->items[i].row);
+	}
+
+	if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0)
+	{
+		fprintf(stderr, "cannot to write temp file: %m\n");
+		exit(1);
+	}
+
+	sorter->runs = realloc(sorter->runs, (sorter->nruns + 1) * sizeof(FILE *));
+	if (!sorter->runs)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	sorter->runs[sorter->nruns++] = file;
+
+	sorter->nitems = 0;
+	sorter->memory = 0;
+}
+
+SorterType *
+sorter_init(const char *keys, long memory_limit, int limit)
+{
+	SorterType *sorter = smalloc(sizeof(SorterType), "SorterType");
+
+	memset(sorter, 0, sizeof(SorterType));
+
+	parse_sort_keys(sorter, keys);
+	sorter->memory_limit = memory_limit;
+	sorter->limit = limit;
+
+	return sorter;
+}
+
+static void
+swap_items(SortItemType *a, SortItemType *b)
+{
+	SortItemType tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/*
+ * Adds row to heap of limit rows. The top of heap is the row, that
+ * would be last in result, so it is replaced by better row.
+ */
+static void
+heap_add_item(SorterType *sorter, SortItemType *item)
+{
+	SortItemType *items = sorter->items;
+	int			i;
+
+	if (sorter->nitems < sorter->limit)
+	{
+		i = sorter->nitems++;
+		items[i] = *item;
+
+		while (i > 0)
+		{
+			int		parent = (i - 1) / 2;
+
+			if (compare_items_stable(&items[parent], &items[i], sorter) >= 0)
+				break;
+
+			swap_items(&items[parent], &items[i]);
+			i = parent;
+		}
+
+		return;
+	}
+
+	if (compare_items_stable(item, &items[0], sorter) >= 0)
+	{
+		free_row(item->row);
+		return;
+	}
+
+	free_row(items[0].row);
+	items[0] = *item;
+
+	i = 0;
+	for (;;)
+	{
+		int		left = 2 * i + 1;
+		int		right = left + 1;
+		int		largest = i;
+
+		if (left < sorter->nitems &&
+			compare_items_stable(&items[left], &items[largest], sorter) > 0)
+			largest = left;
+		if (right < sorter->nitems &&
+			compare_items_stable(&items[right], &items[largest], sorter) > 0)
+			largest = right;
+
+		if (largest == i)
+			break;
+
+		swap_items(&items[i], &items[largest]);
+		i = largest;
+	}
+}
+
+/*
+ * Row handler of parser.
+ */
+void
+sorter_add_row(RowType *row, bool multiline, void *arg)
+{
+	SorterType *sorter = (SorterType *) arg;
+	long		row_size;
+	int			i;
+
+	row_size = offsetof(RowType, fields) + row->nfields * sizeof(char *);
+	for (i = 0; i < row->nfields; i++)
+		row_size += strlen(row->fields[i]) + 1;
+
+	if (!sorter->has_first_row)
+	{
+		set_item(sorter, &sorter->first_row, row, multiline, row_size);
+		sorter->has_first_row = true;
+		return;
+	}
+
+	if (sorter->nitems >= sorter->maxitems)
+	{
+		sorter->maxitems = sorter->maxitems > 0 ? sorter->maxitems * 2 : 1024;
+		sorter->items = realloc(sorter->items, sorter->maxitems * sizeof(SortItemType));
+		if (!sorter->items)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	if (sorter->limit > 0)
+	{
+		SortItemType item;
+
+		set_item(sorter, &item, row, multiline, row_size);
+		heap_add_item(sorter, &item);
+		return;
+	}
+
+	set_item(sorter, &sorter->items[sorter->nitems++], row, multiline, row_size);
+
+	sorter->memory += row_size + sizeof(SortItemType);
+
+	if (sorter->memory_limit > 0 && sorter->memory > sorter->memory_limit)
+		write_run(sorter);
+}
+
+/*
+ * Moves next row of source to its head.
+ */
+static void
+source_next(SorterType *sorter, MergeSourceType *source)
+{
+	source->has_head = false;
+
+	if (source->file)
+	{
+		RowType	   *row;
+		long		row_size;
+		int			i;
+		bool		multiline = false;
+
+		row = read_row(source->file, &row_size);
+		if (!row)
+			return;
+
+		for (i = 0; i < row->nfields && !multiline; i++)
+			multiline = strchr(row->fields[i], '\n') != NULL;
+
+		set_item(sorter, &source->head, row, multiline, row_size);
+		source->has_head = true;
+	}
+	else if (source->pos < source->nitems)
+	{
+		source->head = source->items[source->pos++];
+		source->has_head = true;
+	}
+}
+
+/*
+ * Returns true, when head of source a should be before head of source b.
+ * The sources are ordered like input, so equal rows are stable.
+ */
+static bool
+source_precedes(SorterType *sorter, MergeSourceType *sources, int a, int b)
+{
+	int		result = compare_items(sorter, &sources[a].head, &sources[b].head);
+
+	return result < 0 || (result == 0 && a < b);
+}
+
+static void
+sift_down(SorterType *sorter, MergeSourceType *sources, int *heap, int nheap, int i)
+{
+	for (;;)
+	{
+		int		left = 2 * i + 1;
+		int		right = left + 1;
+		int		smallest = i;
+		int		tmp;
+
+		if (left < nheap && source_precedes(sorter, sources, heap[left], heap[smallest]))
+			smallest = left;
+		if (right < nheap && source_precedes(sorter, sources, heap[right], heap[smallest]))
+			smallest = right;
+
+		if (smallest == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+
+		i = smallest;
+	}
+}
+
+/*
+ * Merges runs and rows in memory, and stores sorted rows to rowbucket.
+ * It should be called after infer_column_types, because the first row
+ * is sorted only when it is not header. Returns number of rows, that
+ * are over limit (they are released).
+ */
+int
+sorter_finish(SorterType *sorter, RowBucketType *rowbucket,
+			  LinebufType *linebuf, ConfigType *config)
+{
+	RowBucketType *current = rowbucket;
+	MergeSourceType *sources;
+	int		   *heap;
+	int			nsources = 0;
+	int			nheap = 0;
+	int			nrows = 0;
+	int			nremoved = 0;
+	int			i;
+
+	if (!sorter->has_first_row)
+		return 0;
+
+	qsort_r(sorter->items, sorter->nitems, sizeof(SortItemType),
+			compare_items_stable, sorter);
+
+	sources = smalloc((sorter->nruns + 2) * sizeof(MergeSourceType), "MergeSourceType");
+	memset(sources, 0, (sorter->nruns + 2) * sizeof(MergeSourceType));
+
+	heap = smalloc((sorter->nruns + 2) * sizeof(int), "heap");
+
+	if (linebuf->header)
+		current = store_row(current, rowbucket, linebuf, config,
+							sorter->first_row.row,
+							sorter->first_row.multiline,
+							sorter->first_row.row_size);
+	else
+	{
+		sources[nsources].head = sorter->first_row;
+		sources[nsources++].has_head = true;
+	}
+
+	for (i = 0; i < sorter->nruns; i++)
+	{
+		sources[nsources].file = sorter->runs[i];
+		source_next(sorter, &sources[nsources++]);
+	}
+
+	sources[nsources].items = sorter->items;
+	sources[nsources].nitems = sorter->nitems;
+	source_next(sorter, &sources[nsources++]);
+
+	for (i = 0; i < nsources; i++)
+	{
+		if (sources[i].has_head)
+			heap[nheap++] = i;
+	}
+
+	for (i = nheap / 2 - 1; i >= 0; i--)
+		sift_down(sorter, sources, heap, nheap, i);
+
+	while (nheap > 0)
+	{
+		MergeSourceType *source = &sources[heap[0]];
+
+		if (sorter->limit > 0 && nrows >= sorter->limit)
+		{
+			free_row(source->head.row);
+			nremoved += 1;
+		}
+		else
+		{
+			current = store_row(current, rowbucket, linebuf, config,
+								source->head.row,
+								source->head.multiline,
+								source->head.row_size);
+			nrows += 1;
+		}
+
+		source_next(sorter, source);
+
+		if (!source->has_head)
+			heap[0] = heap[--nheap];
+
+		sift_down(sorter, sources, heap, nheap, 0);
+	}
+
+	for (i = 0; i < sorter->nruns; i++)
+		fclose(sorter->runs[i]);
+
+	free(sources);
+	free(heap);
+	free(sorter->items);
+	free(sorter->runs);
+
+	sorter->items = NULL;
+	sorter->runs = NULL;
+	sorter->nitems = 0;
+	sorter->nruns = 0;
+
+	return nremoved;
+}
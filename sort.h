@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * sort.h
+ *	  sorting of rows by columns with bounded memory
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  sort.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_SORT_H
+#define CSV_PRETTY_SORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "csv-pretty-format.h"
+
+#define MAX_SORT_KEYS		16
+
+typedef struct
+{
+	int			column;
+	bool		numeric;
+	bool		descending;
+} SortKeyType;
+
+typedef struct
+{
+	uint64_t	prefix;			/* fixed width prefix of first key */
+	long		seqno;			/* for stable sort */
+	long		row_size;
+	bool		multiline;
+	RowType	   *row;
+} SortItemType;
+
+typedef struct
+{
+	SortKeyType	keys[MAX_SORT_KEYS];
+	int			nkeys;
+	long		memory_limit;	/* over this limit the rows are written to run */
+	int			limit;			/* only first limit rows are kept or 0 */
+	SortItemType *items;		/* rows of current run */
+	int			nitems;
+	int			maxitems;
+	long		memory;
+	long		seqno;
+	SortItemType first_row;		/* can be header, so it is not sorted yet */
+	bool		has_first_row;
+	FILE	  **runs;			/* temp files with sorted rows */
+	int			nruns;
+} SorterType;
+
+extern SorterType *sorter_init(const char *keys, long memory_limit, int limit);
+extern void sorter_add_row(RowType *row, bool multiline, void *arg);
+extern int sorter_finish(SorterType *sorter, RowBucketType *rowbucket,
+						  LinebufType *linebuf, ConfigType *config);
+
+#endif
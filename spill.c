@@ -0,0 +1,438 @@
+/*-------------------------------------------------------------------------
+ *
+ * spill.c
+ *	  serialization of row buckets, compression and spilling to temp file
+ *
+ * The rows of full bucket can be serialized and released from memory.
+ * The serialized rows are stored in temp file, and they are loaded
+ * back only for the time of processing of the bucket. The widths and
+ * other properties of columns are calculated before serialization, and
+ * the multiline flags of rows are kept in bucket.
+ *
+ * The serialized rows can be compressed and kept in memory. Only one
+ * bucket is decompressed at time. The compressed bucket can be spilled
+ * too, then compressed data are stored in temp file.
+ *
+ * Format of serialized bucket - for every row: int nfields, and for
+ * every field: int size and bytes of field (without terminating zero).
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  spill.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4block.h"
+#include "spill.h"
+
+static void
+buffer_append(char **buf, size_t *len, size_t *size, const void *data, size_t n)
+{
+	if (*len + n > *size)
+	{
+		*size = *size * 2 > *len + n ? *size * 2 : *len + n;
+		*buf = realloc(*buf, *size);
+		if (!*buf)
+		{
+			fprintf(stderr, "out of memory\n");
+			fatal_error();
+		}
+	}
+
+	memcpy(*buf + *len, data, n);
+	*len += n;
+}
+
+char *
+serialize_bucket(RowBucketType *rb, size_t *size)
+{
+	char	   *result = NULL;
+	size_t		len = 0;
+	size_t		alloc = 0;
+	int			i;
+
+	for (i = 0; i < rb->nrows; i++)
+	{
+		RowType	   *row = rb->rows[i];
+		int			j;
+
+		buffer_append(&result, &len, &alloc, &row->nfields, sizeof(int));
+
+		for (j = 0; j < row->nfields; j++)
+		{
+			int		fsize = strlen(row->fields[j]);
+
+			buffer_append(&result, &len, &alloc, &fsize, sizeof(int));
+			buffer_append(&result, &len, &alloc, row->fields[j], fsize);
+		}
+	}
+
+	*size = len;
+
+	return result;
+}
+
+/*
+ * Creates rows of bucket from serialized data. The row and its
+ * fields are allocated together like rows created by parser.
+ */
+void
+deserialize_bucket(RowBucketType *rb, const char *data, size_t size)
+{
+	const char *ptr = data;
+	int			i;
+
+	for (i = 0; i < rb->nrows; i++)
+	{
+		const char *fptr;
+		RowType	   *row;
+		char	   *locbuf;
+		int			nfields;
+		int			data_size = 0;
+		int			j;
+
+		memcpy(&nfields, ptr, sizeof(int));
+		ptr += sizeof(int);
+
+		/* calculate size of fields */
+		for (j = 0, fptr = ptr; j < nfields; j++)
+		{
+			int		fsize;
+
+			memcpy(&fsize, fptr, sizeof(int));
+			fptr += sizeof(int) + fsize;
+			data_size += fsize + 1;
+		}
+
+		if (fptr > data + size)
+		{
+			fprintf(stderr, "broken serialized data\n");
+			fatal_error();
+		}
+
+		row = smalloc(offsetof(RowType, fields) + nfields * sizeof(char *) + data_size, "RowType");
+		row->nfields = nfields;
+		row->lines = NULL;
+		row->widths = NULL;
+		row->numeric = NULL;
+
+		locbuf = (char *) &row->fields[nfields];
+
+		for (j = 0; j < nfields; j++)
+		{
+			int		fsize;
+
+			memcpy(&fsize, ptr, sizeof(int));
+			ptr += sizeof(int);
+
+			row->fields[j] = locbuf;
+			memcpy(locbuf, ptr, fsize);
+			locbuf[fsize] = '\0';
+
+			locbuf += fsize + 1;
+			ptr += fsize;
+		}
+
+		rb->rows[i] = row;
+	}
+}
+
+/*
+ * Writes one row to file in format of serialized bucket.
+ */
+void
+write_row(FILE *file, RowType *row)
+{
+	int		i;
+
+	if (fwrite(&row->nfields, sizeof(int), 1, file) != 1)
+		goto write_error;
+
+	for (i = 0; i < row->nfields; i++)
+	{
+		int		fsize = strlen(row->fields[i]);
+
+		if (fwrite(&fsize, sizeof(int), 1, file) != 1 ||
+			fwrite(row->fields[i], 1, fsize, file) != (size_t) fsize)
+			goto write_error;
+	}
+
+	return;
+
+write_error:
+
+	fprintf(stderr, "cannot to write temp file: %m\n");
+	fatal_error();
+}
+
+/*
+ * Reads one row written by write_row. Returns NULL on end of file.
+ * The size of allocated row is returned in row_size.
+ */
+RowType *
+read_row(FILE *file, long *row_size)
+{
+	static char *buffer = NULL;
+	static size_t buffer_size = 0;
+	size_t		len = 0;
+	RowType	   *row;
+	char	   *locbuf;
+	const char *ptr;
+	int			nfields;
+	int			i;
+
+	if (fread(&nfields, sizeof(int), 1, file) != 1)
+		return NULL;
+
+	/* read sizes and values of fields to buffer */
+	for (i = 0; i < nfields; i++)
+	{
+		int		fsize;
+
+		if (fread(&fsize, sizeof(int), 1, file) != 1)
+			goto read_error;
+
+		if (len + sizeof(int) + fsize > buffer_size)
+		{
+			buffer_size = (len + sizeof(int) + fsize) * 2;
+			buffer = realloc(buffer, buffer_size);
+			if (!buffer)
+			{
+				fprintf(stderr, "out of memory\n");
+				fatal_error();
+			}
+		}
+
+		memcpy(buffer + len, &fsize, sizeof(int));
+		len += sizeof(int);
+
+		if (fread(buffer + len, 1, fsize, file) != (size_t) fsize)
+			goto read_error;
+
+		len += fsize;
+	}
+
+	/* every field has terminating zero instead of size */
+	*row_size = offsetof(RowType, fields) + nfields * sizeof(char *) + len - nfields * (sizeof(int) - 1);
+
+	row = smalloc(*row_size, "RowType");
+	row->nfields = nfields;
+	row->lines = NULL;
+	row->widths = NULL;
+	row->numeric = NULL;
+
+	locbuf = (char *) &row->fields[nfields];
+
+	for (i = 0, ptr = buffer; i < nfields; i++)
+	{
+		int		fsize;
+
+		memcpy(&fsize, ptr, sizeof(int));
+		ptr += sizeof(int);
+
+		row->fields[i] = locbuf;
+		memcpy(locbuf, ptr, fsize);
+		locbuf[fsize] = '\0';
+
+		locbuf += fsize + 1;
+		ptr += fsize;
+	}
+
+	return row;
+
+read_error:
+
+	fprintf(stderr, "cannot to read temp file: %m\n");
+	fatal_error();
+}
+
+/*
+ * Releases row with its fields and with indexes of multiline fields,
+ * that are not shared with dictionary.
+ */
+void
+free_row(RowType *row)
+{
+	if (row->lines)
+	{
+		int		i;
+
+		for (i = 0; i < row->nfields; i++)
+		{
+			if (row->lines[i] && !row->lines[i]->shared)
+				free(row->lines[i]);
+		}
+
+		free(row->lines);
+	}
+
+	free(row);
+}
+
+void
+free_bucket_rows(RowBucketType *rb)
+{
+	int		i;
+
+	for (i = 0; i < rb->nrows; i++)
+	{
+		free_row(rb->rows[i]);
+		rb->rows[i] = NULL;
+	}
+}
+
+/*
+ * Replaces rows of bucket by compressed serialized rows.
+ */
+void
+compress_bucket(RowBucketType *rb)
+{
+	char	   *raw;
+	char	   *data;
+	size_t		raw_size;
+	size_t		size;
+
+	raw = serialize_bucket(rb, &raw_size);
+
+	data = smalloc(lz4_compress_bound(raw_size), "compressed rows");
+	size = lz4_compress(raw, raw_size, data);
+
+	free(raw);
+
+	/* don't hold unused tail of buffer */
+	rb->data = realloc(data, size > 0 ? size : 1);
+	if (!rb->data)
+		rb->data = data;
+
+	rb->data_size = size;
+	rb->raw_size = raw_size;
+	rb->compressed = true;
+	rb->memory = size;
+
+	free_bucket_rows(rb);
+}
+
+/*
+ * Writes rows of bucket to spill file and releases them.
+ */
+void
+spill_bucket(RowBucketType *rb, FILE **spill_file)
+{
+	char	   *data;
+	size_t		size;
+
+	if (!*spill_file)
+	{
+		*spill_file = tmpfile();
+		if (!*spill_file)
+		{
+			fprintf(stderr, "cannot to create spill file: %m\n");
+			fatal_error();
+		}
+	}
+
+	if (rb->compressed)
+	{
+		data = rb->data;
+		size = rb->data_size;
+		rb->data = NULL;
+	}
+	else
+		data = serialize_bucket(rb, &size);
+
+	if (fseek(*spill_file, 0, SEEK_END) != 0)
+	{
+		fprintf(stderr, "cannot to seek in spill file: %m\n");
+		fatal_error();
+	}
+
+	rb->spill_file = *spill_file;
+	rb->spill_offset = ftell(*spill_file);
+	rb->spill_size = size;
+
+	if (fwrite(data, 1, size, *spill_file) != size)
+	{
+		fprintf(stderr, "cannot to write spill file: %m\n");
+		fatal_error();
+	}
+
+	free(data);
+
+	if (!rb->compressed)
+		free_bucket_rows(rb);
+}
+
+static pthread_mutex_t spill_read_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Ensures, so the rows of bucket are in memory.
+ */
+void
+bucket_acquire(RowBucketType *rb)
+{
+	char	   *data;
+	size_t		size;
+
+	if (rb->spill_file)
+	{
+		size = rb->spill_size;
+		data = smalloc(size > 0 ? size : 1, "spill data");
+
+		/* the position of file is shared by threads of daemon */
+		pthread_mutex_lock(&spill_read_lock);
+
+		if (fseek(rb->spill_file, rb->spill_offset, SEEK_SET) != 0 ||
+			fread(data, 1, size, rb->spill_file) != size)
+		{
+			fprintf(stderr, "cannot to read spill file: %m\n");
+
+			pthread_mutex_unlock(&spill_read_lock);
+			fatal_error();
+		}
+
+		pthread_mutex_unlock(&spill_read_lock);
+	}
+	else if (rb->compressed)
+	{
+		data = rb->data;
+		size = rb->data_size;
+	}
+	else
+		return;
+
+	if (rb->compressed)
+	{
+		char	   *raw = smalloc(rb->raw_size > 0 ? rb->raw_size : 1, "decompressed rows");
+
+		if (lz4_decompress(data, size, raw, rb->raw_size) != (long) rb->raw_size)
+		{
+			fprintf(stderr, "broken compressed data\n");
+			fatal_error();
+		}
+
+		deserialize_bucket(rb, raw, rb->raw_size);
+
+		free(raw);
+	}
+	else
+		deserialize_bucket(rb, data, size);
+
+	if (data != rb->data)
+		free(data);
+}
+
+/*
+ * Releases rows loaded by bucket_acquire.
+ */
+void
+bucket_release(RowBucketType *rb)
+{
+	if (rb->spill_file || rb->compressed)
+		free_bucket_rows(rb);
+}
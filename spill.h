@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * spill.h
+ *	  serialization of row buckets, compression and spilling to temp file
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  spill.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_SPILL_H
+#define CSV_PRETTY_SPILL_H
+
+#include <stdio.h>
+
+#include "csv-pretty-format.h"
+
+extern char *serialize_bucket(RowBucketType *rb, size_t *size);
+extern void deserialize_bucket(RowBucketType *rb, const char *data, size_t size);
+extern void write_row(FILE *file, RowType *row);
+extern RowType *read_row(FILE *file, long *row_size);
+extern void free_row(RowType *row);
+extern void free_bucket_rows(RowBucketType *rb);
+
+extern void compress_bucket(RowBucketType *rb);
+extern void spill_bucket(RowBucketType *rb, FILE **spill_file);
+
+extern void bucket_acquire(RowBucketType *rb);
+extern void bucket_release(RowBucketType *rb);
+
+#endif
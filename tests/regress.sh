@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# regress.sh
+#	  runs csv-pretty-format on test data and compares output with
+#	  expected output
+#
+# Usage: tests/regress.sh [PROGRAM]
+#
+# The test is line "name|options" in list below. The output of program
+# with options is compared with file expected/name.out.
+#
+
+PROGRAM=$(realpath "${1:-./csv-pretty-format}")
+TESTDIR=$(dirname "$0")
+
+cd "$TESTDIR" || exit 1
+
+mkdir -p results
+
+failed=0
+passed=0
+
+while IFS='|' read -r name options
+do
+	[ -z "$name" ] && continue
+
+	# the daemon is not used, the output should not depend on environment
+	eval "\"$PROGRAM\" --no-daemon $options" > "results/$name.out" 2>&1
+
+	if cmp -s "expected/$name.out" "results/$name.out"
+	then
+		passed=$((passed + 1))
+	else
+		echo "test $name failed:"
+		diff -u "expected/$name.out" "results/$name.out"
+		failed=$((failed + 1))
+	fi
+done <<TESTS
+describe|--describe data/a.csv
+describe_viewport|--describe --first-column=1 --width=60 --max-width=5 data/a.csv
+describe_max_width_auto|--describe --width=40 --max-width=auto data/a.csv
+union_header|--union data/h1.csv data/h2.csv
+union_same_first_rows|--union data/u1.csv data/u2.csv
+expanded_no_header|--expanded --border=2 data/n.csv
+diff|--diff --key=1 data/d1.csv data/d2.csv
+diff_partitioned|--diff --key=1 --memory-limit=100 data/d1.csv data/d2.csv
+encoding_broken_utf8|data/broken_utf8.csv
+encoding_invalid_utf8|--invalid-utf8=replace data/latin1.csv
+TESTS
+
+echo "passed: $passed, failed: $failed"
+
+[ $failed -eq 0 ]
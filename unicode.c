@@ -11,7 +11,13 @@
  *-------------------------------------------------------------------------
  */
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "unicode.h"
 #include "string.h"
@@ -349,6 +355,34 @@ utf_string_dsplen(const char *s, size_t max_bytes)
 	return result;
 }
 
+/*
+ * Returns size in bytes of the longest prefix of string, that has
+ * display width less or equal to max_width. The display width of
+ * prefix is stored to width. The string is limited by max_bytes
+ * (-1 is not limited) and by end of line.
+ */
+int
+utf_string_prefix(const char *s, int max_bytes, int max_width, int *width)
+{
+	const char *ptr = s;
+	int		result = 0;
+
+	while (*ptr != '\0' && *ptr != '\n' && (max_bytes == -1 || ptr - s < max_bytes))
+	{
+		int		w = utf_dsplen(ptr);
+
+		if (result + w > max_width)
+			break;
+
+		result += w;
+		ptr += utf8charlen(*ptr);
+	}
+
+	*width = result;
+
+	return ptr - s;
+}
+
 int
 utf_string_dsplen_multiline(const char *s, size_t max_bytes, bool *multiline, bool first_only)
 {
@@ -439,7 +473,7 @@ typedef struct range_table
 } range_table;
 
 static int
-convert_char(conv_table *t, size_t size, wchar_t ucs)
+find_in_range(range_table *t, size_t size, wchar_t ucs)
 {
 	size_t begin, end;
 
@@ -449,116 +483,147 @@ convert_char(conv_table *t, size_t size, wchar_t ucs)
 	while (begin < end)
 	{
 		int mid = (begin + end) / 2;
+
 		if (t[mid].last < ucs)
 			begin = mid + 1;
 		else if (t[mid].first > ucs)
 			end = mid;
-		else if ((ucs - t[mid].first) % t[mid].step == 0)
-			return ucs + t[mid].offset;
 		else
-			return ucs;
+			return (ucs - t[mid].first) % t[mid].step == 0;
 	}
 
-	return ucs;
+	return 0;
 }
 
-static int
-find_in_range(range_table *t, size_t size, wchar_t ucs)
-{
-	size_t begin, end;
+#define table_size(t) (sizeof(t)/sizeof((t)[0]))
 
-	begin = 0;
-	end = size;
+static const conv_table tofold_table[] = {
+	{ 0x41, 0x5A, 1, 32 }, { 0xB5, 0xB5, 1, 775 }, { 0xC0, 0xD6, 1, 32 },
+	{ 0xD8, 0xDE, 1, 32 }, { 0x100, 0x12E, 2, 1 }, { 0x132, 0x136, 2, 1 },
+	{ 0x139, 0x147, 2, 1 }, { 0x14A, 0x176, 2, 1 }, { 0x178, 0x178, 1, -121 },
+	{ 0x179, 0x17D, 2, 1 }, { 0x17F, 0x17F, 1, -268 }, { 0x181, 0x181, 1, 210 },
+	{ 0x182, 0x184, 2, 1 }, { 0x186, 0x186, 1, 206 }, { 0x187, 0x187, 1, 1 },
+	{ 0x189, 0x18A, 1, 205 }, { 0x18B, 0x18B, 1, 1 }, { 0x18E, 0x18E, 1, 79 },
+	{ 0x18F, 0x18F, 1, 202 }, { 0x190, 0x190, 1, 203 }, { 0x191, 0x191, 1, 1 },
+	{ 0x193, 0x193, 1, 205 }, { 0x194, 0x194, 1, 207 }, { 0x196, 0x196, 1, 211 },
+	{ 0x197, 0x197, 1, 209 }, { 0x198, 0x198, 1, 1 }, { 0x19C, 0x19C, 1, 211 },
+	{ 0x19D, 0x19D, 1, 213 }, { 0x19F, 0x19F, 1, 214 }, { 0x1A0, 0x1A4, 2, 1 },
+	{ 0x1A6, 0x1A6, 1, 218 }, { 0x1A7, 0x1A7, 1, 1 }, { 0x1A9, 0x1A9, 1, 218 },
+	{ 0x1AC, 0x1AC, 1, 1 }, { 0x1AE, 0x1AE, 1, 218 }, { 0x1AF, 0x1AF, 1, 1 },
+	{ 0x1B1, 0x1B2, 1, 217 }, { 0x1B3, 0x1B5, 2, 1 }, { 0x1B7, 0x1B7, 1, 219 },
+	{ 0x1B8, 0x1BC, 4, 1 }, { 0x1C4, 0x1C4, 1, 2 }, { 0x1C5, 0x1C5, 1, 1 },
+	{ 0x1C7, 0x1C7, 1, 2 }, { 0x1C8, 0x1C8, 1, 1 }, { 0x1CA, 0x1CA, 1, 2 },
+	{ 0x1CB, 0x1DB, 2, 1 }, { 0x1DE, 0x1EE, 2, 1 }, { 0x1F1, 0x1F1, 1, 2 },
+	{ 0x1F2, 0x1F4, 2, 1 }, { 0x1F6, 0x1F6, 1, -97 }, { 0x1F7, 0x1F7, 1, -56 },
+	{ 0x1F8, 0x21E, 2, 1 }, { 0x220, 0x220, 1, -130 }, { 0x222, 0x232, 2, 1 },
+	{ 0x23A, 0x23A, 1, 10795 }, { 0x23B, 0x23B, 1, 1 }, { 0x23D, 0x23D, 1, -163 },
+	{ 0x23E, 0x23E, 1, 10792 }, { 0x241, 0x241, 1, 1 }, { 0x243, 0x243, 1, -195 },
+	{ 0x244, 0x244, 1, 69 }, { 0x245, 0x245, 1, 71 }, { 0x246, 0x24E, 2, 1 },
+	{ 0x345, 0x345, 1, 116 }, { 0x370, 0x372, 2, 1 }, { 0x376, 0x376, 1, 1 },
+	{ 0x37F, 0x37F, 1, 116 }, { 0x386, 0x386, 1, 38 }, { 0x388, 0x38A, 1, 37 },
+	{ 0x38C, 0x38C, 1, 64 }, { 0x38E, 0x38F, 1, 63 }, { 0x391, 0x3A1, 1, 32 },
+	{ 0x3A3, 0x3AB, 1, 32 }, { 0x3C2, 0x3C2, 1, 1 }, { 0x3CF, 0x3CF, 1, 8 },
+	{ 0x3D0, 0x3D0, 1, -30 }, { 0x3D1, 0x3D1, 1, -25 }, { 0x3D5, 0x3D5, 1, -15 },
+	{ 0x3D6, 0x3D6, 1, -22 }, { 0x3D8, 0x3EE, 2, 1 }, { 0x3F0, 0x3F0, 1, -54 },
+	{ 0x3F1, 0x3F1, 1, -48 }, { 0x3F4, 0x3F4, 1, -60 }, { 0x3F5, 0x3F5, 1, -64 },
+	{ 0x3F7, 0x3F7, 1, 1 }, { 0x3F9, 0x3F9, 1, -7 }, { 0x3FA, 0x3FA, 1, 1 },
+	{ 0x3FD, 0x3FF, 1, -130 }, { 0x400, 0x40F, 1, 80 }, { 0x410, 0x42F, 1, 32 },
+	{ 0x460, 0x480, 2, 1 }, { 0x48A, 0x4BE, 2, 1 }, { 0x4C0, 0x4C0, 1, 15 },
+	{ 0x4C1, 0x4CD, 2, 1 }, { 0x4D0, 0x52E, 2, 1 }, { 0x531, 0x556, 1, 48 },
+	{ 0x10A0, 0x10C5, 1, 7264 }, { 0x10C7, 0x10CD, 6, 7264 }, { 0x13F8, 0x13FD, 1, -8 },
+	{ 0x1E00, 0x1E94, 2, 1 }, { 0x1E9B, 0x1E9B, 1, -58 }, { 0x1E9E, 0x1E9E, 1, -7615 },
+	{ 0x1EA0, 0x1EFE, 2, 1 }, { 0x1F08, 0x1F0F, 1, -8 }, { 0x1F18, 0x1F1D, 1, -8 },
+	{ 0x1F28, 0x1F2F, 1, -8 }, { 0x1F38, 0x1F3F, 1, -8 }, { 0x1F48, 0x1F4D, 1, -8 },
+	{ 0x1F59, 0x1F5F, 2, -8 }, { 0x1F68, 0x1F6F, 1, -8 }, { 0x1F88, 0x1F8F, 1, -8 },
+	{ 0x1F98, 0x1F9F, 1, -8 }, { 0x1FA8, 0x1FAF, 1, -8 }, { 0x1FB8, 0x1FB9, 1, -8 },
+	{ 0x1FBA, 0x1FBB, 1, -74 }, { 0x1FBC, 0x1FBC, 1, -9 }, { 0x1FBE, 0x1FBE, 1, -7173 },
+	{ 0x1FC8, 0x1FCB, 1, -86 }, { 0x1FCC, 0x1FCC, 1, -9 }, { 0x1FD8, 0x1FD9, 1, -8 },
+	{ 0x1FDA, 0x1FDB, 1, -100 }, { 0x1FE8, 0x1FE9, 1, -8 }, { 0x1FEA, 0x1FEB, 1, -112 },
+	{ 0x1FEC, 0x1FEC, 1, -7 }, { 0x1FF8, 0x1FF9, 1, -128 }, { 0x1FFA, 0x1FFB, 1, -126 },
+	{ 0x1FFC, 0x1FFC, 1, -9 },{ 0x2126, 0x2126, 1, -7517 }, { 0x212A, 0x212A, 1, -8383 },
+	{ 0x212B, 0x212B, 1, -8262 }, { 0x2132, 0x2132, 1, 28 }, { 0x2160, 0x216F, 1, 16 },
+	{ 0x2183, 0x2183, 1, 1 }, { 0x24B6, 0x24CF, 1, 26 }, { 0x2C00, 0x2C2E, 1, 48 },
+	{ 0x2C60, 0x2C60, 1, 1 }, { 0x2C62, 0x2C62, 1, -10743 }, { 0x2C63, 0x2C63, 1, -3814 },
+	{ 0x2C64, 0x2C64, 1, -10727 }, { 0x2C67, 0x2C6B, 2, 1 }, { 0x2C6D, 0x2C6D, 1, -10780 },
+	{ 0x2C6E, 0x2C6E, 1, -10749 }, { 0x2C6F, 0x2C6F, 1, -10783 }, { 0x2C70, 0x2C70, 1, -10782 },
+	{ 0x2C72, 0x2C75, 3, 1 },{ 0x2C7E, 0x2C7F, 1, -10815 }, { 0x2C80, 0x2CE2, 2, 1 },
+	{ 0x2CEB, 0x2CED, 2, 1 }, { 0x2CF2, 0xA640, 31054, 1 }, { 0xA642, 0xA66C, 2, 1 },
+	{ 0xA680, 0xA69A, 2, 1 }, { 0xA722, 0xA72E, 2, 1 }, { 0xA732, 0xA76E, 2, 1 },
+	{ 0xA779, 0xA77B, 2, 1 }, { 0xA77D, 0xA77D, 1, -35332 }, { 0xA77E, 0xA786, 2, 1 },
+	{ 0xA78B, 0xA78B, 1, 1 }, { 0xA78D, 0xA78D, 1, -42280 }, { 0xA790, 0xA792, 2, 1 },
+	{ 0xA796, 0xA7A8, 2, 1 }, { 0xA7AA, 0xA7AA, 1, -42308 }, { 0xA7AB, 0xA7AB, 1, -42319 },
+	{ 0xA7AC, 0xA7AC, 1, -42315 },{ 0xA7AD, 0xA7AD, 1, -42305 }, { 0xA7B0, 0xA7B0, 1, -42258 },
+	{ 0xA7B1, 0xA7B1, 1, -42282 }, { 0xA7B2, 0xA7B2, 1, -42261 }, { 0xA7B3, 0xA7B3, 1, 928 },
+	{ 0xA7B4, 0xA7B6, 2, 1 }, { 0xAB70, 0xABBF, 1, -38864 }, { 0xFF21, 0xFF3A, 1, 32 }
 
-	while (begin < end)
+#if __WCHAR_MAX__ > 0x10000
+
+	, { 0x10400, 0x10427, 1, 40 }, { 0x10C80, 0x10CB2, 1, 64 }, { 0x118A0, 0x118BF, 1, 32 }
+
+#endif
+
+};
+
+/*
+ * Direct lookup table of folding - the differences between folded and
+ * original chars are stored in pages of 256 chars. The pages without
+ * folded chars are not allocated. The table is created from tofold_table
+ * when it is used first time. The folding can be used by more threads,
+ * so the table is initialized by pthread_once.
+ */
+#define FOLD_PAGE_BITS		8
+#define FOLD_PAGE_SIZE		(1 << FOLD_PAGE_BITS)
+#define FOLD_MAX_CHAR		0x11FFF
+
+static int *fold_pages[(FOLD_MAX_CHAR >> FOLD_PAGE_BITS) + 1];
+static pthread_once_t fold_pages_once = PTHREAD_ONCE_INIT;
+
+static void
+init_fold_pages(void)
+{
+	size_t		i;
+
+	for (i = 0; i < table_size(tofold_table); i++)
 	{
-		int mid = (begin + end) / 2;
+		const conv_table *t = &tofold_table[i];
+		wchar_t		ucs;
 
-		if (t[mid].last < ucs)
-			begin = mid + 1;
-		else if (t[mid].first > ucs)
-			end = mid;
-		else
-			return (ucs - t[mid].first) % t[mid].step == 0;
-	}
+		for (ucs = t->first; ucs <= t->last && ucs <= FOLD_MAX_CHAR; ucs += t->step)
+		{
+			int		  **page = &fold_pages[ucs >> FOLD_PAGE_BITS];
 
-	return 0;
-}
+			if (!*page)
+			{
+				*page = calloc(FOLD_PAGE_SIZE, sizeof(int));
+				if (!*page)
+					exit(1);
+			}
 
-#define table_size(t) (sizeof(t)/sizeof((t)[0]))
+			(*page)[ucs & (FOLD_PAGE_SIZE - 1)] = t->offset;
+		}
+	}
+}
 
 int
 utf8_tofold(const char *s)
 {
-	static struct conv_table tofold_table[] = {
-		{ 0x41, 0x5A, 1, 32 }, { 0xB5, 0xB5, 1, 775 }, { 0xC0, 0xD6, 1, 32 },
-		{ 0xD8, 0xDE, 1, 32 }, { 0x100, 0x12E, 2, 1 }, { 0x132, 0x136, 2, 1 },
-		{ 0x139, 0x147, 2, 1 }, { 0x14A, 0x176, 2, 1 }, { 0x178, 0x178, 1, -121 },
-		{ 0x179, 0x17D, 2, 1 }, { 0x17F, 0x17F, 1, -268 }, { 0x181, 0x181, 1, 210 },
-		{ 0x182, 0x184, 2, 1 }, { 0x186, 0x186, 1, 206 }, { 0x187, 0x187, 1, 1 },
-		{ 0x189, 0x18A, 1, 205 }, { 0x18B, 0x18B, 1, 1 }, { 0x18E, 0x18E, 1, 79 },
-		{ 0x18F, 0x18F, 1, 202 }, { 0x190, 0x190, 1, 203 }, { 0x191, 0x191, 1, 1 },
-		{ 0x193, 0x193, 1, 205 }, { 0x194, 0x194, 1, 207 }, { 0x196, 0x196, 1, 211 },
-		{ 0x197, 0x197, 1, 209 }, { 0x198, 0x198, 1, 1 }, { 0x19C, 0x19C, 1, 211 },
-		{ 0x19D, 0x19D, 1, 213 }, { 0x19F, 0x19F, 1, 214 }, { 0x1A0, 0x1A4, 2, 1 },
-		{ 0x1A6, 0x1A6, 1, 218 }, { 0x1A7, 0x1A7, 1, 1 }, { 0x1A9, 0x1A9, 1, 218 },
-		{ 0x1AC, 0x1AC, 1, 1 }, { 0x1AE, 0x1AE, 1, 218 }, { 0x1AF, 0x1AF, 1, 1 },
-		{ 0x1B1, 0x1B2, 1, 217 }, { 0x1B3, 0x1B5, 2, 1 }, { 0x1B7, 0x1B7, 1, 219 },
-		{ 0x1B8, 0x1BC, 4, 1 }, { 0x1C4, 0x1C4, 1, 2 }, { 0x1C5, 0x1C5, 1, 1 },
-		{ 0x1C7, 0x1C7, 1, 2 }, { 0x1C8, 0x1C8, 1, 1 }, { 0x1CA, 0x1CA, 1, 2 },
-		{ 0x1CB, 0x1DB, 2, 1 }, { 0x1DE, 0x1EE, 2, 1 }, { 0x1F1, 0x1F1, 1, 2 },
-		{ 0x1F2, 0x1F4, 2, 1 }, { 0x1F6, 0x1F6, 1, -97 }, { 0x1F7, 0x1F7, 1, -56 },
-		{ 0x1F8, 0x21E, 2, 1 }, { 0x220, 0x220, 1, -130 }, { 0x222, 0x232, 2, 1 },
-		{ 0x23A, 0x23A, 1, 10795 }, { 0x23B, 0x23B, 1, 1 }, { 0x23D, 0x23D, 1, -163 },
-		{ 0x23E, 0x23E, 1, 10792 }, { 0x241, 0x241, 1, 1 }, { 0x243, 0x243, 1, -195 },
-		{ 0x244, 0x244, 1, 69 }, { 0x245, 0x245, 1, 71 }, { 0x246, 0x24E, 2, 1 },
-		{ 0x345, 0x345, 1, 116 }, { 0x370, 0x372, 2, 1 }, { 0x376, 0x376, 1, 1 },
-		{ 0x37F, 0x37F, 1, 116 }, { 0x386, 0x386, 1, 38 }, { 0x388, 0x38A, 1, 37 },
-		{ 0x38C, 0x38C, 1, 64 }, { 0x38E, 0x38F, 1, 63 }, { 0x391, 0x3A1, 1, 32 },
-		{ 0x3A3, 0x3AB, 1, 32 }, { 0x3C2, 0x3C2, 1, 1 }, { 0x3CF, 0x3CF, 1, 8 },
-		{ 0x3D0, 0x3D0, 1, -30 }, { 0x3D1, 0x3D1, 1, -25 }, { 0x3D5, 0x3D5, 1, -15 },
-		{ 0x3D6, 0x3D6, 1, -22 }, { 0x3D8, 0x3EE, 2, 1 }, { 0x3F0, 0x3F0, 1, -54 },
-		{ 0x3F1, 0x3F1, 1, -48 }, { 0x3F4, 0x3F4, 1, -60 }, { 0x3F5, 0x3F5, 1, -64 },
-		{ 0x3F7, 0x3F7, 1, 1 }, { 0x3F9, 0x3F9, 1, -7 }, { 0x3FA, 0x3FA, 1, 1 },
-		{ 0x3FD, 0x3FF, 1, -130 }, { 0x400, 0x40F, 1, 80 }, { 0x410, 0x42F, 1, 32 },
-		{ 0x460, 0x480, 2, 1 }, { 0x48A, 0x4BE, 2, 1 }, { 0x4C0, 0x4C0, 1, 15 },
-		{ 0x4C1, 0x4CD, 2, 1 }, { 0x4D0, 0x52E, 2, 1 }, { 0x531, 0x556, 1, 48 },
-		{ 0x10A0, 0x10C5, 1, 7264 }, { 0x10C7, 0x10CD, 6, 7264 }, { 0x13F8, 0x13FD, 1, -8 },
-		{ 0x1E00, 0x1E94, 2, 1 }, { 0x1E9B, 0x1E9B, 1, -58 }, { 0x1E9E, 0x1E9E, 1, -7615 },
-		{ 0x1EA0, 0x1EFE, 2, 1 }, { 0x1F08, 0x1F0F, 1, -8 }, { 0x1F18, 0x1F1D, 1, -8 },
-		{ 0x1F28, 0x1F2F, 1, -8 }, { 0x1F38, 0x1F3F, 1, -8 }, { 0x1F48, 0x1F4D, 1, -8 },
-		{ 0x1F59, 0x1F5F, 2, -8 }, { 0x1F68, 0x1F6F, 1, -8 }, { 0x1F88, 0x1F8F, 1, -8 },
-		{ 0x1F98, 0x1F9F, 1, -8 }, { 0x1FA8, 0x1FAF, 1, -8 }, { 0x1FB8, 0x1FB9, 1, -8 },
-		{ 0x1FBA, 0x1FBB, 1, -74 }, { 0x1FBC, 0x1FBC, 1, -9 }, { 0x1FBE, 0x1FBE, 1, -7173 },
-		{ 0x1FC8, 0x1FCB, 1, -86 }, { 0x1FCC, 0x1FCC, 1, -9 }, { 0x1FD8, 0x1FD9, 1, -8 },
-		{ 0x1FDA, 0x1FDB, 1, -100 }, { 0x1FE8, 0x1FE9, 1, -8 }, { 0x1FEA, 0x1FEB, 1, -112 },
-		{ 0x1FEC, 0x1FEC, 1, -7 }, { 0x1FF8, 0x1FF9, 1, -128 }, { 0x1FFA, 0x1FFB, 1, -126 },
-		{ 0x1FFC, 0x1FFC, 1, -9 },{ 0x2126, 0x2126, 1, -7517 }, { 0x212A, 0x212A, 1, -8383 },
-		{ 0x212B, 0x212B, 1, -8262 }, { 0x2132, 0x2132, 1, 28 }, { 0x2160, 0x216F, 1, 16 },
-		{ 0x2183, 0x2183, 1, 1 }, { 0x24B6, 0x24CF, 1, 26 }, { 0x2C00, 0x2C2E, 1, 48 },
-		{ 0x2C60, 0x2C60, 1, 1 }, { 0x2C62, 0x2C62, 1, -10743 }, { 0x2C63, 0x2C63, 1, -3814 },
-		{ 0x2C64, 0x2C64, 1, -10727 }, { 0x2C67, 0x2C6B, 2, 1 }, { 0x2C6D, 0x2C6D, 1, -10780 },
-		{ 0x2C6E, 0x2C6E, 1, -10749 }, { 0x2C6F, 0x2C6F, 1, -10783 }, { 0x2C70, 0x2C70, 1, -10782 },
-		{ 0x2C72, 0x2C75, 3, 1 },{ 0x2C7E, 0x2C7F, 1, -10815 }, { 0x2C80, 0x2CE2, 2, 1 },
-		{ 0x2CEB, 0x2CED, 2, 1 }, { 0x2CF2, 0xA640, 31054, 1 }, { 0xA642, 0xA66C, 2, 1 },
-		{ 0xA680, 0xA69A, 2, 1 }, { 0xA722, 0xA72E, 2, 1 }, { 0xA732, 0xA76E, 2, 1 },
-		{ 0xA779, 0xA77B, 2, 1 }, { 0xA77D, 0xA77D, 1, -35332 }, { 0xA77E, 0xA786, 2, 1 },
-		{ 0xA78B, 0xA78B, 1, 1 }, { 0xA78D, 0xA78D, 1, -42280 }, { 0xA790, 0xA792, 2, 1 },
-		{ 0xA796, 0xA7A8, 2, 1 }, { 0xA7AA, 0xA7AA, 1, -42308 }, { 0xA7AB, 0xA7AB, 1, -42319 },
-		{ 0xA7AC, 0xA7AC, 1, -42315 },{ 0xA7AD, 0xA7AD, 1, -42305 }, { 0xA7B0, 0xA7B0, 1, -42258 },
-		{ 0xA7B1, 0xA7B1, 1, -42282 }, { 0xA7B2, 0xA7B2, 1, -42261 }, { 0xA7B3, 0xA7B3, 1, 928 },
-		{ 0xA7B4, 0xA7B6, 2, 1 }, { 0xAB70, 0xABBF, 1, -38864 }, { 0xFF21, 0xFF3A, 1, 32 }
+	unsigned char c = *s;
+	wchar_t		ucs;
+	int		   *page;
 
-#if __WCHAR_MAX__ > 0x10000
+	/* fast path for ASCII */
+	if (c < 0x80)
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
 
-		, { 0x10400, 0x10427, 1, 40 }, { 0x10C80, 0x10CB2, 1, 64 }, { 0x118A0, 0x118BF, 1, 32 }
+	pthread_once(&fold_pages_once, init_fold_pages);
 
-#endif
+	ucs = utf8_to_unicode((const unsigned char *) s);
+	if (ucs < 0 || ucs > FOLD_MAX_CHAR)
+		return ucs;
 
-	};
+	page = fold_pages[ucs >> FOLD_PAGE_BITS];
 
-	return convert_char(tofold_table, table_size(tofold_table),
-						  utf8_to_unicode((const unsigned char *) s));
+	return page ? ucs + page[ucs & (FOLD_PAGE_SIZE - 1)] : ucs;
 }
 
 const char *
@@ -648,67 +713,139 @@ utf8_nstrstr(const char *haystack, const char *needle)
 }
 
 /*
- * Special string searching, lower chars are case insensitive,
- * upper chars are case sensitive.
+ * Returns pointer to first char of haystack, that can be start of
+ * match of needle, or NULL at end of haystack. When the first char of
+ * needle is ASCII, then the chars, that cannot be equal to first char
+ * of needle, are skipped (by SSE2 when it is available). Every not ASCII
+ * char of haystack is possible start, because some not ASCII chars are
+ * folded to ASCII chars.
  */
-const char *
-utf8_nstrstr_ignore_lower_case(const char *haystack, const char *needle)
+static const char *
+next_candidate(const char *haystack, const char *needle, bool needle_char_is_upper)
 {
-	const char *haystack_cur, *needle_cur, *needle_prev;
-	int		f1 = 0, f2 = 0;
-	bool	eq;
+	unsigned char c1 = *needle;
+	unsigned char c2;
 
-	needle_cur = needle;
-	needle_prev = NULL;
-	haystack_cur = haystack;
+	if (c1 >= 0x80)
+		return *haystack ? haystack : NULL;
+
+	c2 = c1;
+	if (!needle_char_is_upper && c1 >= 'a' && c1 <= 'z')
+		c2 = c1 - ('a' - 'A');
+
+#ifdef __SSE2__
 
-	while (*needle_cur != '\0')
 	{
-		int		haystack_char_len;
-		int		needle_char_len = 0;
-		bool	needle_char_is_upper =  false;
+		/* aligned loads cannot to cross end of page */
+		const char *ptr = (const char *) ((uintptr_t) haystack & ~(uintptr_t) 15);
+		unsigned int mask = ~0u << (haystack - ptr);
+		__m128i		zero = _mm_setzero_si128();
+		__m128i		v1 = _mm_set1_epi8((char) c1);
+		__m128i		v2 = _mm_set1_epi8((char) c2);
+		__m128i		lead = _mm_set1_epi8((char) 0xBF);
+
+		for (;;)
+		{
+			__m128i		v = _mm_load_si128((const __m128i *) ptr);
+			__m128i		r;
+			unsigned int bits;
+
+			r = _mm_or_si128(_mm_cmpeq_epi8(v, zero),
+							 _mm_or_si128(_mm_cmpeq_epi8(v, v1),
+										  _mm_cmpeq_epi8(v, v2)));
+
+			/* lead bytes of multibyte chars are 0xC0 .. 0xFF (-64 .. -1) */
+			r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(v, lead),
+											  _mm_cmplt_epi8(v, zero)));
+
+			bits = _mm_movemask_epi8(r) & mask;
+			if (bits)
+			{
+				ptr += __builtin_ctz(bits);
+				return *ptr ? ptr : NULL;
+			}
+
+			ptr += 16;
+			mask = ~0u;
+		}
+	}
 
-		if (*haystack_cur == '\0')
+#else
+
+	for (;;)
+	{
+		unsigned char c = *haystack;
+
+		if (c == '\0')
 			return NULL;
 
-		haystack_char_len = utf8charlen(*haystack_cur);
+		if (c == c1 || c == c2 || c >= 0xC0)
+			return haystack;
 
-		if (needle_prev != needle_cur)
-		{
-			needle_prev = needle_cur;
-			needle_char_len = utf8charlen(*needle_cur);
-			needle_char_is_upper = utf8_isupper(needle_cur);
-			f1 = utf8_tofold(needle_cur);
-		}
+		haystack++;
+	}
+
+#endif
+
+}
 
-		if (needle_char_is_upper)
+/*
+ * Returns true, when haystack starts by needle. The upper chars of needle
+ * are compared case sensitive, other chars are compared case insensitive.
+ */
+static bool
+match_ignore_lower_case(const char *haystack, const char *needle)
+{
+	while (*needle)
+	{
+		int		needle_char_len = utf8charlen(*needle);
+		int		haystack_char_len;
+
+		if (*haystack == '\0')
+			return false;
+
+		haystack_char_len = utf8charlen(*haystack);
+
+		if (utf8_isupper(needle))
 		{
 			/* case sensitive */
-			if (needle_char_len == haystack_char_len)
-				eq = memcmp(haystack_cur, needle_cur, needle_char_len) == 0;
-			else
-				eq = false;
-		}
-		else
-		{
-			/* case insensitive */
-			f2 = utf8_tofold(haystack_cur);
-			eq = f1 == f2;
+			if (needle_char_len != haystack_char_len ||
+				memcmp(haystack, needle, needle_char_len) != 0)
+				return false;
 		}
+		else if (utf8_tofold(needle) != utf8_tofold(haystack))
+			return false;
 
-		if (eq)
-		{
-			needle_cur += needle_char_len;
-			haystack_cur += haystack_char_len;
-		}
-		else
-		{
-			needle_cur = needle;
-			haystack_cur = haystack += utf8charlen(*haystack);
-		}
+		needle += needle_char_len;
+		haystack += haystack_char_len;
 	}
 
-	return haystack;
+	return true;
+}
+
+/*
+ * Special string searching, lower chars are case insensitive,
+ * upper chars are case sensitive.
+ */
+const char *
+utf8_nstrstr_ignore_lower_case(const char *haystack, const char *needle)
+{
+	bool	needle_char_is_upper;
+
+	if (*needle == '\0')
+		return haystack;
+
+	needle_char_is_upper = utf8_isupper(needle);
+
+	while ((haystack = next_candidate(haystack, needle, needle_char_is_upper)) != NULL)
+	{
+		if (match_ignore_lower_case(haystack, needle))
+			return haystack;
+
+		haystack += utf8charlen(*haystack);
+	}
+
+	return NULL;
 }
 
 bool
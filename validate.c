@@ -0,0 +1,302 @@
+/*-------------------------------------------------------------------------
+ *
+ * validate.c
+ *	  validation and repair of UTF-8 input
+ *
+ * The blocks of input are validated before tokenization, so the parser
+ * and the width calculation get only valid UTF-8 chars. The ASCII chars
+ * are checked by 16 bytes (by SSE2 when it is available), the multibyte
+ * chars are checked by rules of RFC 3629 (overlong forms, surrogates and
+ * chars over U+10FFFF are invalid). Every maximal invalid subpart of
+ * sequence is replaced by U+FFFD or by hex escapes of its bytes. The
+ * number of invalid sequences is reported when the reader is closed.
+ *
+ * The chars can be split between blocks, so not complete char at end
+ * of block is moved to begin of next block.
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  validate.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csv-pretty-format.h"
+#include "validate.h"
+
+/* the longest replacement of one byte is \xHH */
+#define MAX_EXPANSION		4
+
+typedef struct
+{
+	ReaderType	reader;
+	ReaderType *source;
+	char		mode;
+	char	   *inbuf;
+	int			inlen;				/* valid bytes in inbuf */
+	char	   *outbuf;
+	int			outlen;
+	int			outpos;
+	bool		eof;
+	long		ninvalid;			/* number of invalid sequences */
+} ValidateReaderType;
+
+/*
+ * Returns length of ASCII prefix of data.
+ */
+static int
+ascii_prefix(const char *data, int len)
+{
+	int		pos = 0;
+
+#ifdef __SSE2__
+
+	while (pos + 16 <= len)
+	{
+		int		mask;
+
+		mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (data + pos)));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+
+		pos += 16;
+	}
+
+#endif
+
+	while (pos < len && (unsigned char) data[pos] < 0x80)
+		pos++;
+
+	return pos;
+}
+
+/*
+ * Returns number of bytes of valid prefix of multibyte sequence
+ * started by lead byte. The expected length of sequence is returned
+ * in seqlen (0 for bytes, that cannot be lead byte).
+ */
+static int
+valid_subpart(const unsigned char *data, int len, int *seqlen)
+{
+	unsigned char c = data[0];
+	unsigned char lower = 0x80;
+	unsigned char upper = 0xBF;
+	int		i;
+
+	if (c >= 0xC2 && c <= 0xDF)
+		*seqlen = 2;
+	else if (c >= 0xE0 && c <= 0xEF)
+	{
+		*seqlen = 3;
+		if (c == 0xE0)
+			lower = 0xA0;			/* overlong */
+		else if (c == 0xED)
+			upper = 0x9F;			/* surrogates */
+	}
+	else if (c >= 0xF0 && c <= 0xF4)
+	{
+		*seqlen = 4;
+		if (c == 0xF0)
+			lower = 0x90;			/* overlong */
+		else if (c == 0xF4)
+			upper = 0x8F;			/* over U+10FFFF */
+	}
+	else
+	{
+		*seqlen = 0;
+		return 0;
+	}
+
+	for (i = 1; i < *seqlen && i < len; i++)
+	{
+		unsigned char cc = data[i];
+
+		if (i == 1 ? (cc < lower || cc > upper) : (cc < 0x80 || cc > 0xBF))
+			break;
+	}
+
+	return i;
+}
+
+static void
+emit_invalid(ValidateReaderType *vr, const unsigned char *data, int len)
+{
+	char	   *out = vr->outbuf + vr->outlen;
+
+	vr->ninvalid += 1;
+
+	if (vr->mode == INVALID_UTF8_ESCAPE)
+	{
+		static const char hexdigits[] = "0123456789ABCDEF";
+		int		i;
+
+		for (i = 0; i < len; i++)
+		{
+			*out++ = '\\';
+			*out++ = 'x';
+			*out++ = hexdigits[data[i] >> 4];
+			*out++ = hexdigits[data[i] & 0x0F];
+		}
+	}
+	else
+	{
+		/* U+FFFD */
+		*out++ = (char) 0xEF;
+		*out++ = (char) 0xBF;
+		*out++ = (char) 0xBD;
+	}
+
+	vr->outlen = out - vr->outbuf;
+}
+
+/*
+ * Validates content of inbuf, and moves valid or repaired data to
+ * outbuf. Not complete char at end of inbuf is left in inbuf, when
+ * the input is not finished.
+ */
+static void
+validate_block(ValidateReaderType *vr)
+{
+	const unsigned char *data = (const unsigned char *) vr->inbuf;
+	int		len = vr->inlen;
+	int		pos = 0;
+
+	vr->outlen = 0;
+	vr->outpos = 0;
+
+	while (pos < len)
+	{
+		int		n = ascii_prefix((const char *) data + pos, len - pos);
+		int		seqlen;
+		int		valid;
+
+		if (n > 0)
+		{
+			memcpy(vr->outbuf + vr->outlen, data + pos, n);
+			vr->outlen += n;
+			pos += n;
+			continue;
+		}
+
+		valid = valid_subpart(data + pos, len - pos, &seqlen);
+
+		if (seqlen > 0 && valid == seqlen)
+		{
+			memcpy(vr->outbuf + vr->outlen, data + pos, seqlen);
+			vr->outlen += seqlen;
+			pos += seqlen;
+		}
+		else if (seqlen > 0 && pos + valid == len && !vr->eof)
+		{
+			/* the rest of char will be in next block */
+			break;
+		}
+		else
+		{
+			if (valid == 0)
+				valid = 1;
+
+			emit_invalid(vr, data + pos, valid);
+			pos += valid;
+		}
+	}
+
+	memmove(vr->inbuf, vr->inbuf + pos, len - pos);
+	vr->inlen = len - pos;
+}
+
+static int
+validate_read(ReaderType *reader, char *buf, int size)
+{
+	ValidateReaderType *vr = (ValidateReaderType *) reader;
+	int		n;
+
+	while (vr->outpos >= vr->outlen)
+	{
+		if (vr->eof && vr->inlen == 0)
+			return 0;
+
+		if (!vr->eof)
+		{
+			n = vr->source->read(vr->source, vr->inbuf + vr->inlen,
+								 INPUT_BLOCK_SIZE - vr->inlen);
+			/* the incomplete char of previous content is not used */
+			if (n == READER_RESTART)
+			{
+				vr->inlen = 0;
+				return n;
+			}
+			if (n < 0)
+				return -1;
+			if (n == 0)
+				vr->eof = true;
+
+			vr->inlen += n;
+		}
+
+		validate_block(vr);
+	}
+
+	n = vr->outlen - vr->outpos;
+	if (n > size)
+		n = size;
+
+	memcpy(buf, vr->outbuf + vr->outpos, n);
+	vr->outpos += n;
+
+	return n;
+}
+
+static void
+validate_close(ReaderType *reader)
+{
+	ValidateReaderType *vr = (ValidateReaderType *) reader;
+
+	if (vr->ninvalid > 0)
+		fprintf(stderr, "%ld invalid UTF-8 sequences were %s\n",
+				vr->ninvalid,
+				vr->mode == INVALID_UTF8_ESCAPE ? "escaped" : "replaced");
+
+	if (vr->source->close)
+		vr->source->close(vr->source);
+
+	free(vr->inbuf);
+	free(vr->outbuf);
+	free(vr);
+}
+
+/*
+ * Returns reader, that replaces invalid UTF-8 sequences of source
+ * by U+FFFD or by hex escapes.
+ */
+ReaderType *
+validate_reader(ReaderType *source, char mode)
+{
+	ValidateReaderType *vr = malloc(sizeof(ValidateReaderType));
+
+	if (!vr)
+		fatal_error();
+
+	memset(vr, 0, sizeof(ValidateReaderType));
+
+	vr->reader.read = validate_read;
+	vr->reader.close = validate_close;
+	vr->source = source;
+	vr->mode = mode;
+
+	vr->inbuf = malloc(INPUT_BLOCK_SIZE);
+	vr->outbuf = malloc(INPUT_BLOCK_SIZE * MAX_EXPANSION);
+	if (!vr->inbuf || !vr->outbuf)
+		fatal_error();
+
+	return (ReaderType *) vr;
+}
@@ -0,0 +1,24 @@
+/*-------------------------------------------------------------------------
+ *
+ * validate.h
+ *	  validation and repair of UTF-8 input
+ *
+ * Portions Copyright (c) 2017-2019 Pavel Stehule
+ *
+ * IDENTIFICATION
+ *	  validate.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSV_PRETTY_VALIDATE_H
+#define CSV_PRETTY_VALIDATE_H
+
+#include "input.h"
+
+#define INVALID_UTF8_REPLACE		'r'		/* replace by U+FFFD */
+#define INVALID_UTF8_ESCAPE			'x'		/* replace by \xHH */
+
+extern ReaderType *validate_reader(ReaderType *source, char mode);
+
+#endif